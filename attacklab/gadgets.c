@@ -0,0 +1,483 @@
+/*
+ * gadgets.c - An indexed catalogue of the gadgets in an rtarget farm
+ *
+ * The first time it is run on a target, gadgets finds the farm between
+ * the start_farm and end_farm symbols, and decodes every byte sequence
+ * there that ends in a ret (0xc3) into the instructions the attack lab
+ * uses: movq and movl between registers, popq, lea of a register sum,
+ * and the nop and functional nop (andb, orb, cmpb and testb that change
+ * no register) encodings. Each sequence that decodes all the way to the
+ * ret is a gadget, filed under what it does with the nops left out. The
+ * catalogue is saved, sorted, next to the target as <target>.gadgets,
+ * and later runs look queries up in it by binary search, rebuilding it
+ * only when the target changes.
+ *
+ * Build:    gcc -O2 -Wall -o gadgets gadgets.c
+ *
+ * Usage:    ./gadgets [-r] [-i <index>] <target> [<gadget> ...]
+ *
+ *   unix> ./gadgets target240/rtarget
+ *   unix> ./gadgets target240/rtarget "movq %rax,%rdi" "popq %rax"
+ *   unix> ./gadgets target240/rtarget "movl %eax,*"
+ *
+ * With no gadgets, every one is listed. A gadget of several instructions
+ * is written with semicolons ("popq %rax; movq %rax,%rdi"), spaces in
+ * the operands don't matter, and a trailing * matches any gadget that
+ * starts with what comes before it.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <elf.h>
+#include <sys/stat.h>
+
+/* Longest gadget, in bytes before the ret, that we look for */
+#define MAX_GADGET 16
+
+/* Longest decoded gadget, and longest line of the index file */
+#define MAX_KEY 256
+#define MAX_LINE 512
+
+/* First line of an index file, with the target's size and mtime and
+   the farm's address range */
+#define INDEX_MAGIC "gadget-index 1"
+
+typedef struct {
+    char key[MAX_KEY];    /* The instructions, nops left out */
+    unsigned long addr;   /* Address of the first byte */
+    int len;              /* Bytes, not counting the ret */
+    unsigned char bytes[MAX_GADGET];
+} gadget_t;
+
+static gadget_t *gadgets = NULL;
+static int ngadgets = 0, max_gadgets = 0;
+
+static const char *reg64[8] =
+    {"%rax", "%rcx", "%rdx", "%rbx", "%rsp", "%rbp", "%rsi", "%rdi"};
+static const char *reg32[8] =
+    {"%eax", "%ecx", "%edx", "%ebx", "%esp", "%ebp", "%esi", "%edi"};
+
+/*
+ * app_error - Print a message and exit
+ */
+static void app_error(const char *msg, const char *arg)
+{
+    fprintf(stderr, "gadgets: %s%s\n", msg, arg ? arg : "");
+    exit(1);
+}
+
+static void add_gadget(const char *key, unsigned long addr,
+		       const unsigned char *bytes, int len)
+{
+    gadget_t *g;
+
+    if (ngadgets == max_gadgets) {
+	max_gadgets = max_gadgets ? 2 * max_gadgets : 256;
+	gadgets = realloc(gadgets, max_gadgets * sizeof(gadget_t));
+	if (!gadgets)
+	    app_error("out of memory", NULL);
+    }
+    g = &gadgets[ngadgets++];
+    strncpy(g->key, key, MAX_KEY - 1);
+    g->key[MAX_KEY - 1] = '\0';
+    g->addr = addr;
+    g->len = len;
+    memcpy(g->bytes, bytes, len);
+}
+
+/*
+ * decode_one - Decode the instruction at p, which must end by end.
+ *     Returns its length, with its text in buf or an empty string if it
+ *     is a nop, or 0 if it is not one the attack lab uses.
+ */
+static int decode_one(const unsigned char *p, const unsigned char *end,
+		      char *buf)
+{
+    int left = end - p, mod, reg, rm;
+
+    buf[0] = '\0';
+    if (p[0] == 0x90)                          /* nop */
+	return 1;
+    if (p[0] >= 0x58 && p[0] <= 0x5f) {        /* popq %r */
+	sprintf(buf, "popq %s", reg64[p[0] - 0x58]);
+	return 1;
+    }
+    if (left >= 2 && (p[1] >> 6) == 3) {
+	reg = (p[1] >> 3) & 7;
+	rm = p[1] & 7;
+	switch (p[0]) {
+	case 0x89:                             /* movl %r,%r */
+	    sprintf(buf, "movl %s,%s", reg32[reg], reg32[rm]);
+	    return 2;
+	case 0x38:                             /* cmpb %r,%r */
+	case 0x84:                             /* testb %r,%r */
+	    return 2;
+	case 0x20:                             /* andb %r,%r */
+	case 0x08:                             /* orb %r,%r */
+	    return reg == rm ? 2 : 0;
+	}
+    }
+    if (left < 3 || p[0] != 0x48)
+	return 0;
+    mod = p[2] >> 6;
+    reg = (p[2] >> 3) & 7;
+    rm = p[2] & 7;
+    if (p[1] == 0x89 && mod == 3) {            /* movq %r,%r */
+	sprintf(buf, "movq %s,%s", reg64[reg], reg64[rm]);
+	return 3;
+    }
+    if (p[1] == 0x8d && mod == 0 && rm == 4 && left >= 4 &&
+	(p[3] >> 6) == 0 && (p[3] & 7) != 5 && ((p[3] >> 3) & 7) != 4) {
+	sprintf(buf, "lea (%s,%s,1),%s",       /* lea (%r,%r,1),%r */
+		reg64[p[3] & 7], reg64[(p[3] >> 3) & 7], reg64[reg]);
+	return 4;
+    }
+    return 0;
+}
+
+/*
+ * decode_gadget - Decode p up to the ret at end into key. Returns 1 if
+ *     every byte is part of an instruction we know, else 0.
+ */
+static int decode_gadget(const unsigned char *p, const unsigned char *end,
+			 char *key)
+{
+    char ins[64];
+    int n;
+
+    key[0] = '\0';
+    while (p < end) {
+	if ((n = decode_one(p, end, ins)) == 0)
+	    return 0;
+	if (ins[0]) {
+	    if (strlen(key) + strlen(ins) + 3 > MAX_KEY)
+		return 0;
+	    if (key[0])
+		strcat(key, "; ");
+	    strcat(key, ins);
+	}
+	p += n;
+    }
+    if (!key[0])
+	strcpy(key, "ret");
+    return 1;
+}
+
+/*
+ * scan_farm - Catalogue every gadget in the n bytes of farm at addr
+ */
+static void scan_farm(const unsigned char *farm, long n, unsigned long addr)
+{
+    char key[MAX_KEY];
+    long ret, start;
+
+    for (ret = 0; ret < n; ret++) {
+	if (farm[ret] != 0xc3)
+	    continue;
+	for (start = ret; start >= 0 && ret - start <= MAX_GADGET; start--)
+	    if (decode_gadget(farm + start, farm + ret, key))
+		add_gadget(key, addr + start, farm + start, ret - start);
+    }
+}
+
+static int compare_gadgets(const void *a, const void *b)
+{
+    const gadget_t *x = a, *y = b;
+    int c = strcmp(x->key, y->key);
+
+    if (c)
+	return c;
+    return x->addr < y->addr ? -1 : x->addr > y->addr;
+}
+
+/*
+ * find_farm - Read the ELF file image of size bytes and find the farm
+ *     in it, from start_farm up to end_farm. Sets *farm, *n and *addr.
+ *     image[size] must be a NUL, which ends any unterminated name.
+ */
+static void find_farm(const unsigned char *image, unsigned long size,
+		      const unsigned char **farm, long *n, unsigned long *addr)
+{
+    const Elf64_Ehdr *eh = (const Elf64_Ehdr *) image;
+    const Elf64_Shdr *sh, *s;
+    unsigned long start = 0, end = 0, j;
+    int i;
+
+    if (size < sizeof(*eh) || memcmp(eh->e_ident, ELFMAG, SELFMAG) ||
+	eh->e_ident[EI_CLASS] != ELFCLASS64 ||
+	eh->e_shoff + (unsigned long) eh->e_shnum * sizeof(*sh) > size)
+	app_error("not a 64-bit ELF file", NULL);
+    sh = (const Elf64_Shdr *) (image + eh->e_shoff);
+
+    /* The farm's bounds, from the symbol table */
+    for (i = 0; i < eh->e_shnum; i++) {
+	const Elf64_Sym *sym;
+	const char *names;
+	unsigned long nsize;
+
+	if (sh[i].sh_type != SHT_SYMTAB || sh[i].sh_link >= eh->e_shnum ||
+	    sh[i].sh_offset + sh[i].sh_size > size ||
+	    sh[sh[i].sh_link].sh_offset >= size)
+	    continue;
+	sym = (const Elf64_Sym *) (image + sh[i].sh_offset);
+	names = (const char *) image + sh[sh[i].sh_link].sh_offset;
+	nsize = size - sh[sh[i].sh_link].sh_offset;
+	for (j = 0; j < sh[i].sh_size / sizeof(*sym); j++) {
+	    if (sym[j].st_name >= nsize)
+		continue;
+	    if (!strcmp(names + sym[j].st_name, "start_farm"))
+		start = sym[j].st_value;
+	    else if (!strcmp(names + sym[j].st_name, "end_farm"))
+		end = sym[j].st_value;
+	}
+    }
+    if (!start || !end || end <= start)
+	app_error("no start_farm and end_farm symbols", NULL);
+
+    /* The bytes there, from the section that holds them */
+    for (i = 0; i < eh->e_shnum; i++) {
+	s = &sh[i];
+	if (s->sh_type == SHT_PROGBITS && s->sh_addr <= start &&
+	    end <= s->sh_addr + s->sh_size && s->sh_offset + s->sh_size <= size) {
+	    *farm = image + s->sh_offset + (start - s->sh_addr);
+	    *n = end - start;
+	    *addr = start;
+	    return;
+	}
+    }
+    app_error("farm is not in a section of the file", NULL);
+}
+
+/*
+ * build_index - Catalogue the farm of target, and save the catalogue in
+ *     the index file
+ */
+static void build_index(const char *target, struct stat *st, const char *index)
+{
+    const unsigned char *farm;
+    unsigned char *image;
+    unsigned long addr;
+    char tmp[FILENAME_MAX + 16];
+    long n;
+    int i, j;
+    FILE *fp;
+
+    if (!(fp = fopen(target, "rb")))
+	app_error("can't open ", target);
+    if (!(image = malloc(st->st_size + 1)))
+	app_error("out of memory", NULL);
+    if (fread(image, 1, st->st_size, fp) != (size_t) st->st_size)
+	app_error("can't read ", target);
+    fclose(fp);
+    image[st->st_size] = '\0';	/* so no symbol name runs off the end */
+
+    find_farm(image, st->st_size, &farm, &n, &addr);
+    ngadgets = 0;
+    scan_farm(farm, n, addr);
+    qsort(gadgets, ngadgets, sizeof(gadget_t), compare_gadgets);
+
+    /* Write a new file and rename it, so no one reads half of it */
+    snprintf(tmp, sizeof(tmp), "%s.%d", index, (int) getpid());
+    if (!(fp = fopen(tmp, "w"))) {
+	fprintf(stderr, "gadgets: can't write %s, not saving the index\n", tmp);
+	free(image);
+	return;
+    }
+    fprintf(fp, "%s %ld %ld %lx %lx\n", INDEX_MAGIC, (long) st->st_size,
+	    (long) st->st_mtime, addr, addr + n);
+    for (i = 0; i < ngadgets; i++) {
+	fprintf(fp, "%s\t%lx\t", gadgets[i].key, gadgets[i].addr);
+	for (j = 0; j < gadgets[i].len; j++)
+	    fprintf(fp, "%02x", gadgets[i].bytes[j]);
+	fprintf(fp, "\n");
+    }
+    if (fclose(fp) != 0 || rename(tmp, index) != 0) {
+	fprintf(stderr, "gadgets: can't write %s, not saving the index\n", index);
+	unlink(tmp);
+    }
+    free(image);
+}
+
+/*
+ * load_index - Read the index file into gadgets. Returns 0, or -1 if
+ *     there is none or it is not of this version of target.
+ */
+static int load_index(const char *index, struct stat *st)
+{
+    char line[MAX_LINE], *tab, *hex;
+    long size, mtime;
+    unsigned long addr;
+    unsigned char bytes[MAX_GADGET];
+    int len;
+    FILE *fp;
+
+    if (!(fp = fopen(index, "r")))
+	return -1;
+    if (!fgets(line, sizeof(line), fp) ||
+	strncmp(line, INDEX_MAGIC " ", strlen(INDEX_MAGIC) + 1) ||
+	sscanf(line + strlen(INDEX_MAGIC), "%ld %ld", &size, &mtime) != 2 ||
+	size != st->st_size || mtime != st->st_mtime) {
+	fclose(fp);
+	return -1;
+    }
+
+    ngadgets = 0;
+    while (fgets(line, sizeof(line), fp)) {
+	line[strcspn(line, "\n")] = '\0';
+	if (!(tab = strchr(line, '\t')))
+	    goto bad;
+	*tab++ = '\0';
+	addr = strtoul(tab, &hex, 16);
+	if (*hex++ != '\t')
+	    goto bad;
+	for (len = 0; len < MAX_GADGET && isxdigit(hex[0]) && isxdigit(hex[1]);
+	     len++, hex += 2)
+	    sscanf(hex, "%2hhx", &bytes[len]);
+	if (*hex)
+	    goto bad;
+	add_gadget(line, addr, bytes, len);
+    }
+    fclose(fp);
+    return 0;
+
+ bad:
+    fclose(fp);
+    ngadgets = 0;
+    return -1;
+}
+
+/*
+ * normalize - Write query in the form of the index keys:
+ *     "mnemonic operands; mnemonic operands", with no spaces in the
+ *     operands. Sets *prefix if it ends in a *.
+ */
+static void normalize(const char *query, char *key, int *prefix)
+{
+    const char *p = query;
+    char *k = key, *limit = key + MAX_KEY - 4;
+
+    *prefix = 0;
+    while (*p && k < limit) {
+	while (isspace((unsigned char) *p) || *p == ';')
+	    p++;
+	if (!*p)
+	    break;
+	if (k != key) {
+	    *k++ = ';';
+	    *k++ = ' ';
+	}
+	/* The mnemonic, then the operands with no spaces */
+	while (*p && !isspace((unsigned char) *p) && *p != ';' && k < limit)
+	    *k++ = tolower((unsigned char) *p++);
+	while (isspace((unsigned char) *p))
+	    p++;
+	if (*p && *p != ';' && *p != '*')
+	    *k++ = ' ';
+	while (*p && *p != ';' && k < limit) {
+	    if (!isspace((unsigned char) *p))
+		*k++ = tolower((unsigned char) *p);
+	    p++;
+	}
+    }
+    while (k > key && (k[-1] == '*' || isspace((unsigned char) k[-1]))) {
+	*prefix |= k[-1] == '*';
+	k--;
+    }
+    *k = '\0';
+}
+
+static void print_gadget(gadget_t *g)
+{
+    int j;
+
+    printf("0x%06lx  ", g->addr);
+    for (j = 0; j < g->len; j++)
+	printf("%02x ", g->bytes[j]);
+    printf("c3%*s  %s\n", 3 * (MAX_GADGET / 2 - g->len) > 0 ?
+	   3 * (MAX_GADGET / 2 - g->len) : 0, "", g->key);
+}
+
+/*
+ * lookup - Print every gadget that is query, or starts with it if
+ *     it ends in a *. Returns how many there were.
+ */
+static int lookup(const char *query)
+{
+    char key[MAX_KEY];
+    int lo = 0, hi = ngadgets, mid, prefix, found = 0;
+    size_t len;
+
+    normalize(query, key, &prefix);
+    len = strlen(key);
+
+    /* The index is sorted, so the matches are together from the first
+       key that is not less than the query */
+    while (lo < hi) {
+	mid = (lo + hi) / 2;
+	if (strcmp(gadgets[mid].key, key) < 0)
+	    lo = mid + 1;
+	else
+	    hi = mid;
+    }
+    for (; lo < ngadgets; lo++, found++) {
+	if (prefix ? strncmp(gadgets[lo].key, key, len) != 0
+	           : strcmp(gadgets[lo].key, key) != 0)
+	    break;
+	print_gadget(&gadgets[lo]);
+    }
+    if (!found)
+	printf("%s: no gadget\n", key);
+    return found;
+}
+
+static void usage(char *cmd)
+{
+    printf("Usage: %s [-hr] [-i <index>] <target> [<gadget> ...]\n", cmd);
+    printf("  -h          Print this message\n");
+    printf("  -i <index>  Keep the catalogue in index (default <target>.gadgets)\n");
+    printf("  -r          Rebuild the catalogue even if it is up to date\n");
+    exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+    char *index = NULL, default_index[FILENAME_MAX];
+    int c, i, rebuild = 0, missing = 0;
+    struct stat st;
+
+    while ((c = getopt(argc, argv, "hi:r")) != -1) {
+	switch (c) {
+	case 'i':
+	    index = optarg;
+	    break;
+	case 'r':
+	    rebuild = 1;
+	    break;
+	default:
+	    usage(argv[0]);
+	}
+    }
+    if (optind >= argc)
+	usage(argv[0]);
+    if (!index) {
+	snprintf(default_index, sizeof(default_index), "%s.gadgets", argv[optind]);
+	index = default_index;
+    }
+
+    if (stat(argv[optind], &st) != 0)
+	app_error("can't find ", argv[optind]);
+    if (rebuild || load_index(index, &st) != 0)
+	build_index(argv[optind], &st, index);
+
+    if (optind + 1 == argc) {
+	for (i = 0; i < ngadgets; i++)
+	    print_gadget(&gadgets[i]);
+	return 0;
+    }
+    for (i = optind + 1; i < argc; i++)
+	missing += lookup(argv[i]) == 0;
+    return missing ? 1 : 0;
+}
@@ -0,0 +1,408 @@
+/*
+ * bench.c - A statistical benchmark harness (see bench.h)
+ */
+#ifdef __linux__
+#define _GNU_SOURCE
+#include <sched.h>
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "bench.h"
+#include "clock.h"
+
+#define WARMUP 2             /* runs thrown away before measuring */
+#define RUNS 15              /* runs measured */
+#define LEVEL 0.95           /* confidence level of the interval */
+#define RESAMPLES 1000       /* bootstrap resamples */
+#define BASELINE 5           /* past runs a result is compared with */
+#define BASELINE_MIN 3       /* past runs needed before comparing */
+#define RERUNS 3             /* times a regressed result is measured again */
+#define RERUN_DELAY 20000    /* microseconds to wait before each */
+
+static int warmup = WARMUP;
+static int runs = RUNS;
+static double level = LEVEL;
+static int baseline_runs = BASELINE;
+
+/* The results that bench_save will write */
+typedef struct {
+    char *name;
+    bench_result_t r;
+} record_t;
+
+static record_t *records = NULL;
+static int nrecords = 0;
+
+/* The history that bench_run_named checks runs against */
+static char *checked_history = NULL;
+static double checked_threshold;
+
+#ifdef __linux__
+/* The CPUs the thread could run on before the first bench_pin */
+static cpu_set_t unpinned;
+static int pinned = 0;
+#endif
+
+int bench_pin(int cpu)
+{
+#ifdef __linux__
+    cpu_set_t set;
+
+    if (cpu < 0 && (cpu = sched_getcpu()) < 0)
+	return -1;
+    if (!pinned && sched_getaffinity(0, sizeof(unpinned), &unpinned) < 0)
+	return -1;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    if (sched_setaffinity(0, sizeof(set), &set) < 0)
+	return -1;
+    pinned = 1;
+    return cpu;
+#else
+    return -1;
+#endif
+}
+
+void bench_unpin(void)
+{
+#ifdef __linux__
+    if (pinned && sched_setaffinity(0, sizeof(unpinned), &unpinned) == 0)
+	pinned = 0;
+#endif
+}
+
+double bench_clock(bench_func f, void *arg)
+{
+    tick_t t0 = timer_start();
+
+    f(arg);
+    return timer_secs(timer_stop() - t0);
+}
+
+static int cmp_double(const void *a, const void *b)
+{
+    double x = *(const double *)a, y = *(const double *)b;
+
+    return (x > y) - (x < y);
+}
+
+/* median - The median of the n sorted values in v */
+static double median(double *v, int n)
+{
+    return (n % 2) ? v[n/2] : (v[n/2 - 1] + v[n/2]) / 2;
+}
+
+/* 
+ * next_random - A xorshift generator for the resampling, so that the 
+ *     drivers' own rand() sequences (their test data) stay the same
+ */
+static unsigned long long next_random(unsigned long long *state)
+{
+    *state ^= *state << 13;
+    *state ^= *state >> 7;
+    *state ^= *state << 17;
+    return *state;
+}
+
+void bench_stats(double *samples, int n, bench_result_t *r)
+{
+    unsigned long long state = 0x9E3779B97F4A7C15ULL;
+    double *meds, *resample;
+    int b, i;
+
+    r->runs = n;
+    if (n == 0) {
+	r->median = r->lo = r->hi = 0;
+	return;
+    }
+    qsort(samples, n, sizeof(double), cmp_double);
+    r->median = median(samples, n);
+
+    /* The spread of the medians of resamples with replacement */
+    meds = malloc(RESAMPLES * sizeof(double));
+    resample = malloc(n * sizeof(double));
+    if (meds == NULL || resample == NULL) {
+	fprintf(stderr, "bench_stats: out of memory\n");
+	exit(1);
+    }
+    for (b = 0; b < RESAMPLES; b++) {
+	for (i = 0; i < n; i++)
+	    resample[i] = samples[next_random(&state) % n];
+	qsort(resample, n, sizeof(double), cmp_double);
+	meds[b] = median(resample, n);
+    }
+    qsort(meds, RESAMPLES, sizeof(double), cmp_double);
+    r->lo = meds[(int)((1 - level) / 2 * RESAMPLES)];
+    r->hi = meds[(int)((1 + level) / 2 * RESAMPLES) - 1];
+    free(meds);
+    free(resample);
+}
+
+void bench_run(bench_func f, void *arg, bench_timer timer, bench_result_t *r)
+{
+    double *samples = malloc(runs * sizeof(double));
+    int i;
+
+    if (samples == NULL) {
+	fprintf(stderr, "bench_run: out of memory\n");
+	exit(1);
+    }
+    for (i = 0; i < warmup; i++)
+	timer(f, arg);
+    for (i = 0; i < runs; i++)
+	samples[i] = timer(f, arg);
+    bench_stats(samples, runs, r);
+    free(samples);
+}
+
+void set_bench_warmup(int warmup_arg)
+{
+    warmup = warmup_arg;
+}
+
+void set_bench_runs(int runs_arg)
+{
+    runs = runs_arg > 0 ? runs_arg : 1;
+}
+
+void set_bench_confidence(double level_arg)
+{
+    level = level_arg;
+}
+
+void set_bench_baseline(int runs_arg)
+{
+    baseline_runs = runs_arg > 0 ? runs_arg : 1;
+}
+
+void bench_record(const char *name, bench_result_t *r)
+{
+    records = realloc(records, (nrecords + 1) * sizeof(record_t));
+    if (records == NULL || (records[nrecords].name = strdup(name)) == NULL) {
+	fprintf(stderr, "bench_record: out of memory\n");
+	exit(1);
+    }
+    records[nrecords++].r = *r;
+}
+
+/* json_escape - Quote s as a JSON string in buf, truncated to fit size */
+static void json_escape(const char *s, char *buf, int size)
+{
+    int n = 0;
+
+    buf[n++] = '"';
+    for (; *s && n < size - 4; s++) {
+	if (*s == '"' || *s == '\\')
+	    buf[n++] = '\\';
+	buf[n++] = ((unsigned char)*s < ' ') ? ' ' : *s;
+    }
+    buf[n++] = '"';
+    buf[n] = '\0';
+}
+
+/* json_host - Quote this machine's name as a JSON string in buf */
+static void json_host(char *buf, int size)
+{
+    char host[256] = "unknown";
+
+    gethostname(host, sizeof(host) - 1);
+    json_escape(host, buf, size);
+}
+
+/* 
+ * read_history - Read the whole history file into a string, or return
+ *     NULL if there is none yet
+ */
+static char *read_history(const char *filename)
+{
+    FILE *fp = fopen(filename, "r");
+    char *buf;
+    long len;
+
+    if (fp == NULL)
+	return NULL;
+    fseek(fp, 0, SEEK_END);
+    len = ftell(fp);
+    rewind(fp);
+    if ((buf = malloc(len + 1)) == NULL) {
+	fprintf(stderr, "bench_save: out of memory\n");
+	exit(1);
+    }
+    len = fread(buf, 1, len, fp);
+    buf[len] = '\0';
+    fclose(fp);
+    return buf;
+}
+
+/* 
+ * find_baseline - Summarize the result called name in the last 
+ *     baseline_runs lines of history that have one, as written by 
+ *     bench_save on this host, since another machine's timings say 
+ *     nothing about this one: the median of their medians, and an 
+ *     interval from the lowest lo to the highest hi, so that it spans
+ *     the variation from run to run as well as within each. Returns 
+ *     the number of lines found.
+ */
+static int find_baseline(char *history, const char *name, bench_result_t *r)
+{
+    char key[512], hostkey[600], *start, *end, *p, *h;
+    double *meds = malloc(baseline_runs * sizeof(double));
+    bench_result_t old;
+    int n = 0;
+
+    if (meds == NULL) {
+	fprintf(stderr, "bench_save: out of memory\n");
+	exit(1);
+    }
+    json_escape(name, key, sizeof(key) - 4);
+    strcat(key, ": {");
+    strcpy(hostkey, "\"host\": ");
+    json_host(hostkey + strlen(hostkey), sizeof(hostkey) - 12);
+    strcat(hostkey, ",");
+    for (end = history + strlen(history); end > history && n < baseline_runs; 
+	 end = start) {
+	for (start = end - 1; start > history && start[-1] != '\n'; start--)
+	    ;
+	if ((h = strstr(start, hostkey)) == NULL || h >= end ||
+	    (p = strstr(start, key)) == NULL || p >= end ||
+	    sscanf(p + strlen(key), " \"median\": %lf, \"lo\": %lf, "
+		   "\"hi\": %lf, \"runs\": %d", 
+		   &old.median, &old.lo, &old.hi, &old.runs) != 4)
+	    continue;
+	if (n == 0 || old.lo < r->lo)
+	    r->lo = old.lo;
+	if (n == 0 || old.hi > r->hi)
+	    r->hi = old.hi;
+	meds[n++] = old.median;
+    }
+    if (n > 0) {
+	qsort(meds, n, sizeof(double), cmp_double);
+	r->median = median(meds, n);
+	r->runs = n;
+    }
+    free(meds);
+    return n;
+}
+
+/* 
+ * enough_baseline - Whether a baseline from n past runs is enough to 
+ *     compare with; one or two runs miss the variation between runs
+ */
+static int enough_baseline(int n)
+{
+    return n >= (baseline_runs < BASELINE_MIN ? baseline_runs : BASELINE_MIN);
+}
+
+/* 
+ * regressed - Whether r is slower than the baseline old by more than
+ *     threshold, with old's interval below r's
+ */
+static int regressed(bench_result_t *r, bench_result_t *old, double threshold)
+{
+    return r->median > old->median * (1 + threshold) && r->lo > old->hi;
+}
+
+void bench_history(const char *filename, double threshold)
+{
+    free(checked_history);
+    checked_history = read_history(filename);
+    checked_threshold = threshold;
+}
+
+void bench_run_named(const char *name, double scale, bench_func f, void *arg,
+		     bench_timer timer, bench_result_t *r)
+{
+    bench_result_t old, now, again;
+    int i;
+
+    bench_run(f, arg, timer, r);
+    if (checked_history == NULL || name == NULL || 
+	!enough_baseline(find_baseline(checked_history, name, &old)))
+	return;
+    now = *r;
+    now.median /= scale;
+    now.lo /= scale;
+    now.hi /= scale;
+    if (!regressed(&now, &old, checked_threshold))
+	return;
+
+    /* 
+     * Measure again, in case something else on the host slowed the 
+     * first down, and keep the fastest; stop once one is back in line
+     */
+    for (i = 0; i < RERUNS; i++) {
+	usleep(RERUN_DELAY);
+	bench_run(f, arg, timer, &again);
+	if (again.median < r->median)
+	    *r = again;
+	now = *r;
+	now.median /= scale;
+	now.lo /= scale;
+	now.hi /= scale;
+	if (!regressed(&now, &old, checked_threshold))
+	    break;
+    }
+}
+
+int bench_save(const char *filename, const char *label, double threshold)
+{
+    char *history = read_history(filename);
+    char date[64];
+    time_t now = time(NULL);
+    char quoted[512];
+    bench_result_t old;
+    FILE *fp;
+    int i, compared = 0, regressions = 0, young = 0;
+
+    /* Compare with the history */
+    for (i = 0; history && i < nrecords; i++) {
+	bench_result_t *r = &records[i].r;
+
+	if (!enough_baseline(find_baseline(history, records[i].name, &old))) {
+	    young++;
+	    continue;
+	}
+	compared++;
+	if (regressed(r, &old, threshold)) {
+	    printf("Regression: %s: %.4g -> %.4g (+%.1f%%), CI [%.4g, %.4g] "
+		   "was [%.4g, %.4g] over %d runs\n", records[i].name, 
+		   old.median, r->median, 100 * (r->median / old.median - 1), 
+		   r->lo, r->hi, old.lo, old.hi, old.runs);
+	    regressions++;
+	}
+    }
+    if (history)
+	printf("%d of %d results compared with %s, %d regressed by more "
+	       "than %.0f%%\n", compared, nrecords, filename, regressions, 
+	       100 * threshold);
+    if (young)
+	printf("%d results not compared, with fewer than %d past runs\n",
+	       young, baseline_runs < BASELINE_MIN ? baseline_runs : BASELINE_MIN);
+    free(history);
+
+    /* Append this run */
+    if ((fp = fopen(filename, "a")) == NULL) {
+	fprintf(stderr, "bench_save: can't open %s\n", filename);
+	return -1;
+    }
+    strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%S", localtime(&now));
+    json_host(quoted, sizeof(quoted));
+    fprintf(fp, "{\"time\": %ld, \"date\": \"%s\", \"host\": %s, ", 
+	    (long)now, date, quoted);
+    json_escape(label, quoted, sizeof(quoted));
+    fprintf(fp, "\"label\": %s, \"results\": {", quoted);
+    for (i = 0; i < nrecords; i++) {
+	bench_result_t *r = &records[i].r;
+
+	json_escape(records[i].name, quoted, sizeof(quoted));
+	fprintf(fp, "%s%s: {\"median\": %.6g, \"lo\": %.6g, \"hi\": %.6g, "
+		"\"runs\": %d}", i ? ", " : "", quoted, 
+		r->median, r->lo, r->hi, r->runs);
+    }
+    fprintf(fp, "}}\n");
+    fclose(fp);
+    return regressions;
+}
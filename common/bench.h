@@ -0,0 +1,91 @@
+/*
+ * bench.h - A statistical benchmark harness shared by the lab drivers
+ *
+ * bench_run times a test function many times on one CPU, throws the
+ * warmup runs away, and summarizes the rest by their median and a
+ * bootstrap confidence interval of the median, which shrug off the
+ * odd run that a shared host slows down. bench_record and bench_save
+ * keep the medians in a JSON history file, one run per line, and flag
+ * those that got slower than the last few runs that measured them.
+ */
+#ifndef _BENCH_H_
+#define _BENCH_H_
+
+/* The test function, and a timer that measures one run of it */
+typedef void (*bench_func)(void *arg);
+typedef double (*bench_timer)(bench_func f, void *arg);
+
+/* Summarizes the runs of one measurement */
+typedef struct {
+    double median;   /* median of the runs, in the units of the timer */
+    double lo, hi;   /* confidence interval of the median */
+    int runs;        /* runs measured, not counting the warmup */
+} bench_result_t;
+
+/* 
+ * bench_pin - Pin the calling thread to cpu, or if cpu < 0 to the
+ *     CPU it is running on. Returns that CPU, or -1 if it can't.
+ */
+int bench_pin(int cpu);
+
+/* 
+ * bench_unpin - Let the calling thread run on the CPUs it could before
+ *     bench_pin, so that the threads it creates next can spread out
+ */
+void bench_unpin(void);
+
+/* 
+ * bench_clock - A timer that measures one run of f in seconds with 
+ *     the timer in clock.h
+ */
+double bench_clock(bench_func f, void *arg);
+
+/* 
+ * bench_run - Run f(arg) warmup times and then runs times, each timed 
+ *     with timer, and summarize those last runs in r
+ */
+void bench_run(bench_func f, void *arg, bench_timer timer, bench_result_t *r);
+
+/* 
+ * bench_history - Read the JSON history file that bench_save will 
+ *     compare with, for bench_run_named
+ */
+void bench_history(const char *filename, double threshold);
+
+/* 
+ * bench_run_named - bench_run, and if the result, divided by scale as 
+ *     it will be for bench_record(name, ...), regressed against the 
+ *     history from bench_history, run it again and keep the faster, so
+ *     that a run slowed down by the host is not reported
+ */
+void bench_run_named(const char *name, double scale, bench_func f, void *arg,
+		     bench_timer timer, bench_result_t *r);
+
+/* bench_stats - Summarize the n samples in r; sorts them in place */
+void bench_stats(double *samples, int n, bench_result_t *r);
+
+/* Set the parameters of bench_run and bench_stats */
+void set_bench_warmup(int warmup);       /* Default = 2 */
+void set_bench_runs(int runs);           /* Default = 15 */
+void set_bench_confidence(double level); /* Default = 0.95 */
+void set_bench_baseline(int runs);       /* Default = 5 */
+
+/* 
+ * bench_record - Remember the result r of the measurement called name
+ *     (a kernel, a trace) for bench_save
+ */
+void bench_record(const char *name, bench_result_t *r);
+
+/* 
+ * bench_save - Compare every recorded result with the last runs (up to
+ *     set_bench_baseline) on this host in the JSON history file that 
+ *     have one of the same name, if there are at least 3: with the median of their 
+ *     medians, and an interval spanning all their confidence intervals.
+ *     Print those whose median grew by more than threshold (0.05 = 5%)
+ *     with the interval below this run's, then append this run to the
+ *     file. Lower is better. Returns the number of regressions, or -1 
+ *     if the file can't be written.
+ */
+int bench_save(const char *filename, const char *label, double threshold);
+
+#endif /* _BENCH_H_ */
@@ -0,0 +1,256 @@
+/*
+ * clock.c - A low overhead timer shared by the lab drivers (see clock.h)
+ *
+ * The cycle counter routines at the end come from the CS:APP clock.c,
+ * Copyright (c) 2002, R. Bryant and D. O'Hallaron.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/times.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#endif
+#include "clock.h"
+
+#define CALIBRATE_ROUNDS 5       /* rounds of measuring the TSC rate */
+#define CALIBRATE_NSECS 10000000 /* nanoseconds in each round */
+
+int timer_source = TIMER_NONE;
+static double hz = 1e9;          /* ticks per second */
+
+/*
+ * has_invariant_tsc - Does the CPU have a TSC that ticks at a constant
+ *     rate whatever its frequency and sleep state? Sets *rdtscp if it
+ *     also has that instruction.
+ */
+static int has_invariant_tsc(int *rdtscp)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    unsigned a, b, c, d;
+
+    if (!__get_cpuid(0x80000001, &a, &b, &c, &d))
+	return 0;
+    *rdtscp = (d >> 27) & 1;
+    if (!__get_cpuid(0x80000007, &a, &b, &c, &d))
+	return 0;
+    return (d >> 8) & 1;
+#else
+    return 0;
+#endif
+}
+
+/*
+ * tsc_at - Read the TSC and the clock together: the clock, and the
+ *     TSC half way through reading it
+ */
+static void tsc_at(tick_t *tsc, tick_t *ns)
+{
+    tick_t before = timer_start();
+
+    *ns = timer_clock_ns();
+    *tsc = before + (timer_stop() - before) / 2;
+}
+
+/*
+ * calibrate - Measure the TSC rate against the clock, over rounds
+ *     rounds of nsecs nanoseconds each, and take their median
+ */
+static double calibrate(int rounds, tick_t nsecs)
+{
+    double rate[CALIBRATE_ROUNDS], t;
+    tick_t tsc0, ns0, tsc1, ns1;
+    int i, j;
+
+    if (rounds > CALIBRATE_ROUNDS)
+	rounds = CALIBRATE_ROUNDS;
+    for (i = 0; i < rounds; i++) {
+	tsc_at(&tsc0, &ns0);
+	do
+	    tsc_at(&tsc1, &ns1);
+	while (ns1 - ns0 < nsecs);
+	rate[i] = (double) (tsc1 - tsc0) * 1e9 / (ns1 - ns0);
+
+	/* Insertion sort */
+	for (j = i; j > 0 && rate[j-1] > rate[j]; j--) {
+	    t = rate[j-1];
+	    rate[j-1] = rate[j];
+	    rate[j] = t;
+	}
+    }
+    return rate[rounds / 2];
+}
+
+void timer_init(void)
+{
+    char *source = getenv("TIMER_SOURCE");
+    int rdtscp = 0;
+
+    if (timer_source != TIMER_NONE)
+	return;
+    if ((source && !strcmp(source, "clock")) || !has_invariant_tsc(&rdtscp)) {
+	timer_source = TIMER_CLOCK;
+	hz = 1e9;
+	return;
+    }
+    timer_source = rdtscp ? TIMER_RDTSCP : TIMER_RDTSC;
+    hz = calibrate(CALIBRATE_ROUNDS, CALIBRATE_NSECS);
+}
+
+const char *timer_name(void)
+{
+    timer_init();
+    switch (timer_source) {
+    case TIMER_RDTSCP:
+	return "rdtscp";
+    case TIMER_RDTSC:
+	return "rdtsc";
+    default:
+	return "clock";
+    }
+}
+
+double timer_hz(void)
+{
+    timer_init();
+    return hz;
+}
+
+double timer_secs(tick_t ticks)
+{
+    timer_init();
+    return ticks / hz;
+}
+
+tick_t timer_overhead(void)
+{
+    tick_t t, best = 0;
+    int i;
+
+    for (i = 0; i < 100; i++) {
+	t = timer_start();
+	t = timer_stop() - t;
+	if (i == 0 || t < best)
+	    best = t;
+    }
+    return best;
+}
+
+/*
+ * The CS:APP cycle counter routines, on top of the timer
+ */
+
+/* The timer when start_counter was last called */
+static tick_t start = 0;
+
+/* Record the current value of the cycle counter. */
+void start_counter()
+{
+    start = timer_start();
+}
+
+/* Return the number of cycles since the last call to start_counter. */
+double get_counter()
+{
+    return (double) (timer_stop() - start);
+}
+
+double ovhd()
+{
+    return (double) timer_overhead();
+}
+
+/* Estimate the clock rate: the rate of the timer */
+double mhz(int verbose)
+{
+    double rate = timer_hz() / 1e6;
+
+    if (verbose)
+	printf("Processor clock rate ~= %.1f MHz (%s)\n", rate, timer_name());
+    return rate;
+}
+
+/* Measure the rate again, while sleeping for sleeptime seconds */
+double mhz_full(int verbose, int sleeptime)
+{
+    tick_t tsc0, ns0, tsc1, ns1;
+
+    timer_init();
+    if (timer_source != TIMER_CLOCK) {
+	tsc_at(&tsc0, &ns0);
+	sleep(sleeptime);
+	tsc_at(&tsc1, &ns1);
+	hz = (double) (tsc1 - tsc0) * 1e9 / (ns1 - ns0);
+    }
+    return mhz(verbose);
+}
+
+/** Special counters that compensate for timer interrupt overhead */
+
+static double cyc_per_tick = 0.0;
+
+#define NEVENT 20
+#define THRESHOLD 10000
+#define RECORDTHRESH 3000
+
+/* Attempt to see how much time is used by timer interrupt */
+static void callibrate(int verbose)
+{
+    double oldt;
+    struct tms t;
+    clock_t oldc;
+    int e = 0;
+
+    times(&t);
+    oldc = t.tms_utime;
+    start_counter();
+    oldt = get_counter();
+    while (e <NEVENT) {
+	double newt = get_counter();
+
+	if (newt-oldt >= THRESHOLD) {
+	    clock_t newc;
+	    times(&t);
+	    newc = t.tms_utime;
+	    if (newc > oldc) {
+		double cpt = (newt-oldt)/(newc-oldc);
+		if ((cyc_per_tick == 0.0 || cyc_per_tick > cpt) && cpt > RECORDTHRESH)
+		    cyc_per_tick = cpt;
+		e++;
+		oldc = newc;
+	    }
+	    oldt = newt;
+	}
+    }
+#ifdef DEBUG
+    if (verbose)
+	printf("Setting cyc_per_tick to %f\n", cyc_per_tick);
+#endif
+}
+
+static clock_t start_tick = 0;
+
+void start_comp_counter()
+{
+    struct tms t;
+
+    if (cyc_per_tick == 0.0)
+	callibrate(1);
+    times(&t);
+    start_tick = t.tms_utime;
+    start_counter();
+}
+
+double get_comp_counter()
+{
+    double time = get_counter();
+    double ctime;
+    struct tms t;
+    clock_t ticks;
+
+    times(&t);
+    ticks = t.tms_utime - start_tick;
+    ctime = time - ticks*cyc_per_tick;
+    return ctime;
+}
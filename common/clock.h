@@ -0,0 +1,132 @@
+/*
+ * clock.h - A low overhead timer shared by the lab drivers
+ *
+ * The timer counts ticks of the x86 time stamp counter when the CPU
+ * says it runs at a constant rate in every power state (an invariant
+ * TSC), and is otherwise the monotonic clock, counting nanoseconds.
+ * With the TSC, timer_start and timer_stop fence the read so that the
+ * code timed can't move past either end; the tick rate is measured
+ * against the monotonic clock once, the first time it is needed.
+ * Setting TIMER_SOURCE=clock in the environment forces the clock.
+ *
+ * The CS:APP cycle counter routines below it (start_counter and
+ * friends) are kept for the drivers that were written against them,
+ * and now read this timer.
+ */
+#ifndef _CLOCK_H_
+#define _CLOCK_H_
+
+#include <time.h>
+
+typedef unsigned long long tick_t;
+
+/* The sources the timer can read, in timer_source */
+enum {
+    TIMER_NONE,      /* timer_init has not run yet */
+    TIMER_RDTSCP,    /* TSC, read at the end with rdtscp */
+    TIMER_RDTSC,     /* TSC, with no rdtscp */
+    TIMER_CLOCK      /* CLOCK_MONOTONIC */
+};
+extern int timer_source;
+
+/*
+ * timer_init - Choose the source, and measure the rate of the TSC.
+ *     The other timer routines call it the first time; it does
+ *     nothing after that.
+ */
+void timer_init(void);
+
+/* timer_name - The source, for reports: "rdtscp", "rdtsc" or "clock" */
+const char *timer_name(void);
+
+/* timer_hz - Ticks per second */
+double timer_hz(void);
+
+/* timer_secs - Seconds in ticks */
+double timer_secs(tick_t ticks);
+
+/* timer_clock_ns - Nanoseconds on the monotonic clock */
+static inline tick_t timer_clock_ns(void)
+{
+    struct timespec t;
+
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (tick_t) t.tv_sec * 1000000000ULL + t.tv_nsec;
+}
+
+/*
+ * timer_start - Read the timer before the code to time. Nothing that
+ *     comes before it in the program runs after the read.
+ */
+static inline tick_t timer_start(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    unsigned hi, lo;
+
+    if (timer_source == TIMER_NONE)
+	timer_init();
+    if (timer_source != TIMER_CLOCK) {
+	asm volatile("lfence; rdtsc; lfence" : "=a" (lo), "=d" (hi) : : "memory");
+	return (tick_t) hi << 32 | lo;
+    }
+#endif
+    return timer_clock_ns();
+}
+
+/*
+ * timer_stop - Read the timer after the code to time. Reads after
+ *     everything before it has run, and before anything after it.
+ */
+static inline tick_t timer_stop(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    unsigned hi, lo;
+
+    if (timer_source == TIMER_NONE)
+	timer_init();
+    if (timer_source == TIMER_RDTSCP) {
+	asm volatile("rdtscp; lfence" : "=a" (lo), "=d" (hi) : : "ecx", "memory");
+	return (tick_t) hi << 32 | lo;
+    }
+    if (timer_source == TIMER_RDTSC) {
+	asm volatile("lfence; rdtsc; lfence" : "=a" (lo), "=d" (hi) : : "memory");
+	return (tick_t) hi << 32 | lo;
+    }
+#endif
+    return timer_clock_ns();
+}
+
+/*
+ * timer_overhead - The fewest ticks between a timer_start and a
+ *     timer_stop with nothing between them
+ */
+tick_t timer_overhead(void);
+
+/*
+ * The CS:APP cycle counter routines. The "cycles" are ticks of the
+ * timer: TSC cycles at its constant rate, or with the clock
+ * nanoseconds, and mhz reports a rate to match.
+ */
+
+/* Start the counter */
+void start_counter();
+
+/* Get # cycles since counter started */
+double get_counter();
+
+/* Measure overhead for counter */
+double ovhd();
+
+/* Determine clock rate of processor (measured once, by timer_init) */
+double mhz(int verbose);
+
+/* Measure the clock rate of processor again, over sleeptime seconds */
+double mhz_full(int verbose, int sleeptime);
+
+/** Special counters that compensate for timer interrupt overhead */
+
+void start_comp_counter();
+
+double get_comp_counter();
+
+#endif /* _CLOCK_H_ */
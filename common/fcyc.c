@@ -4,8 +4,9 @@
  * Copyright (c) 2002, R. Bryant and D. O'Hallaron, All rights reserved.
  * May not be used, modified, or copied without permission.
  *
- * Uses the cycle timer routines in clock.c to estimate the
- * the time in CPU cycles for a function f.
+ * Uses the timer in clock.c to estimate the time in CPU cycles for a
+ * function f. Shared by the lab drivers, which used to carry copies
+ * of their own.
  */
 #include <stdlib.h>
 #include <sys/times.h>
@@ -21,7 +22,7 @@
 #define COMPENSATE 0         /* 1-> try to compensate for clock ticks */
 #define CLEAR_CACHE 0        /* Clear cache before running test function */
 #define CACHE_BYTES (1<<19)  /* Max cache size in bytes */
-#define CACHE_BLOCK 32       /* Cache block size in bytes */
+#define CACHE_BLOCK 64       /* Cache block size in bytes */
 
 static int kbest = K;
 static int maxsamples = MAXSAMPLES;
@@ -33,6 +34,9 @@ static int cache_block = CACHE_BLOCK;
 
 static int *cache_buf = NULL;
 
+static int perf = 0;                 /* read the performance counters too */
+static perf_counts_t best_counts;    /* counters of the best sample */
+
 static double *values = NULL;
 static int samplecount = 0;
 
@@ -97,6 +101,19 @@ static int has_converged()
 	((1 + epsilon)*values[0] >= values[kbest-1]);
 }
 
+/* 
+ * perf_sample - Read the counters of the sample that just ran, and 
+ *     keep them if it is the best one yet
+ */
+static void perf_sample(double cyc)
+{
+    perf_counts_t c;
+
+    perf_stop(&c);
+    if (samplecount == 0 || cyc < values[0])
+	best_counts = c;
+}
+
 /* 
  * clear - Code to clear cache 
  */
@@ -135,9 +152,13 @@ double fcyc(test_funct f, void *argp)
 	    double cyc;
 	    if (clear_cache)
 		clear();
+	    if (perf)
+		perf_start();
 	    start_comp_counter();
 	    f(argp);
 	    cyc = get_comp_counter();
+	    if (perf)
+		perf_sample(cyc);
 	    add_sample(cyc);
 	} while (!has_converged() && samplecount < maxsamples);
     } else {
@@ -145,9 +166,13 @@ double fcyc(test_funct f, void *argp)
 	    double cyc;
 	    if (clear_cache)
 		clear();
+	    if (perf)
+		perf_start();
 	    start_counter();
 	    f(argp);
 	    cyc = get_counter();
+	    if (perf)
+		perf_sample(cyc);
 	    add_sample(cyc);
 	} while (!has_converged() && samplecount < maxsamples);
     }
@@ -199,7 +224,7 @@ void set_fcyc_cache_size(int bytes)
 
 /* 
  * set_fcyc_cache_block - Set size of cache block 
- *     Default = 32
+ *     Default = 64
  */
 void set_fcyc_cache_block(int bytes) {
     cache_block = bytes;
@@ -245,6 +270,27 @@ void set_fcyc_epsilon(double epsilon_arg)
     epsilon = epsilon_arg;
 }
 
+/* 
+ * set_fcyc_perf - When set, will also read the performance counters
+ *     (perfctr.h) around each measurement. Returns how many counters
+ *     there are.
+ *     Default = 0
+ */
+int set_fcyc_perf(int perf_arg)
+{
+    perf = perf_arg && perf_init() > 0;
+    return perf ? perf_init() : 0;
+}
+
+/* 
+ * fcyc_perf_counts - Counters of the sample whose cycles the last 
+ *     fcyc returned
+ */
+void fcyc_perf_counts(perf_counts_t *c)
+{
+    *c = best_counts;
+}
+
 
 
 
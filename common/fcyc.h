@@ -6,6 +6,10 @@
  * May not be used, modified, or copied without permission.
  *
  */
+#ifndef _FCYC_H_
+#define _FCYC_H_
+
+#include "perfctr.h"
 
 /* The test function takes a generic pointer as input */
 typedef void (*test_funct)(void *);
@@ -32,7 +36,7 @@ void set_fcyc_cache_size(int bytes);
 
 /* 
  * set_fcyc_cache_block - Set size of cache block 
- *     Default = 32
+ *     Default = 64
  */
 void set_fcyc_cache_block(int bytes);
 
@@ -63,6 +67,18 @@ void set_fcyc_maxsamples(int maxsamples_arg);
  */
 void set_fcyc_epsilon(double epsilon_arg);
 
+/* 
+ * set_fcyc_perf - When set, will also read the performance counters
+ *     (perfctr.h) around each measurement. Returns how many counters
+ *     there are.
+ *     Default = 0
+ */
+int set_fcyc_perf(int perf);
 
+/* 
+ * fcyc_perf_counts - Counters of the sample whose cycles the last 
+ *     fcyc returned
+ */
+void fcyc_perf_counts(perf_counts_t *c);
 
-
+#endif /* _FCYC_H_ */
@@ -0,0 +1,117 @@
+/*
+ * perfctr.c - Hardware performance counters (see perfctr.h)
+ *
+ * Every counter is its own perf event rather than a member of one
+ * group: a group is scheduled all or nothing, so a group of more
+ * hardware events than the PMU has counters would count nothing, while
+ * single events are time-shared by the kernel and scaled up here by
+ * how long each of them was actually running.
+ */
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include "perfctr.h"
+
+#ifdef __linux__
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+#define CACHE_EVENT(cache, op, result) \
+    ((cache) | ((op) << 8) | ((result) << 16))
+
+static struct {
+    char *name;
+    unsigned type;
+    unsigned long long config;
+} events[PERF_NEVENTS] = {
+    { "Cycles", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+    { "Instrs", PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+    { "L1D", PERF_TYPE_HW_CACHE, 
+      CACHE_EVENT(PERF_COUNT_HW_CACHE_L1D, PERF_COUNT_HW_CACHE_OP_READ, 
+		  PERF_COUNT_HW_CACHE_RESULT_MISS) },
+    { "LLC", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES },
+    { "dTLB", PERF_TYPE_HW_CACHE, 
+      CACHE_EVENT(PERF_COUNT_HW_CACHE_DTLB, PERF_COUNT_HW_CACHE_OP_READ, 
+		  PERF_COUNT_HW_CACHE_RESULT_MISS) },
+    { "Branch", PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES },
+    { "Faults", PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS },
+};
+
+static int fds[PERF_NEVENTS];
+static int opened = -1;   /* number of counters opened, -1 before perf_init */
+
+int perf_init(void)
+{
+    struct perf_event_attr attr;
+    int i;
+
+    if (opened >= 0)
+	return opened;
+    opened = 0;
+    for (i = 0; i < PERF_NEVENTS; i++) {
+	memset(&attr, 0, sizeof(attr));
+	attr.size = sizeof(attr);
+	attr.type = events[i].type;
+	attr.config = events[i].config;
+	attr.disabled = 1;
+	attr.exclude_kernel = 1;
+	attr.exclude_hv = 1;
+	attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | 
+	    PERF_FORMAT_TOTAL_TIME_RUNNING;
+	fds[i] = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+	if (fds[i] >= 0)
+	    opened++;
+    }
+    return opened;
+}
+
+int perf_has(int i)
+{
+    return opened > 0 && fds[i] >= 0;
+}
+
+const char *perf_name(int i)
+{
+    return events[i].name;
+}
+
+void perf_start(void)
+{
+    int i;
+
+    for (i = 0; i < PERF_NEVENTS; i++)
+	if (perf_has(i)) {
+	    ioctl(fds[i], PERF_EVENT_IOC_RESET, 0);
+	    ioctl(fds[i], PERF_EVENT_IOC_ENABLE, 0);
+	}
+}
+
+void perf_stop(perf_counts_t *c)
+{
+    unsigned long long v[3]; /* value, time enabled, time running */
+    int i;
+
+    for (i = 0; i < PERF_NEVENTS; i++)
+	if (perf_has(i))
+	    ioctl(fds[i], PERF_EVENT_IOC_DISABLE, 0);
+    for (i = 0; i < PERF_NEVENTS; i++) {
+	c->count[i] = 0;
+	if (perf_has(i) && read(fds[i], v, sizeof(v)) == sizeof(v) && v[2])
+	    c->count[i] = (double)v[0] * v[1] / v[2];
+    }
+}
+
+#else /* !__linux__ */
+
+static char *names[PERF_NEVENTS] = {
+    "Cycles", "Instrs", "L1D", "LLC", "dTLB", "Branch", "Faults"
+};
+
+int perf_init(void) { return 0; }
+int perf_has(int i) { return 0; }
+const char *perf_name(int i) { return names[i]; }
+void perf_start(void) { }
+void perf_stop(perf_counts_t *c) { memset(c, 0, sizeof(*c)); }
+
+#endif
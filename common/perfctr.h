@@ -0,0 +1,46 @@
+/*
+ * perfctr.h - Hardware performance counters, read around a piece of
+ *     code next to the timer in clock.c. They come from Linux
+ *     perf_event_open, counting user mode events of the calling
+ *     thread; counters that the kernel or the machine does not offer
+ *     are left out.
+ */
+#ifndef _PERFCTR_H_
+#define _PERFCTR_H_
+
+/* The counters */
+enum {
+    PERF_CYCLES,         /* core cycles */
+    PERF_INSTRS,         /* instructions retired */
+    PERF_L1D_MISSES,     /* L1 data cache read misses */
+    PERF_LLC_MISSES,     /* last level cache misses */
+    PERF_DTLB_MISSES,    /* data TLB read misses */
+    PERF_BRANCH_MISSES,  /* mispredicted branches */
+    PERF_PAGE_FAULTS,    /* page faults (a software counter) */
+    PERF_NEVENTS
+};
+
+/* The events counted by each counter between perf_start and perf_stop */
+typedef struct {
+    double count[PERF_NEVENTS]; /* scaled up if the counter was shared */
+} perf_counts_t;
+
+/* 
+ * perf_init - Open the counters, once. Returns how many of them 
+ *     could be opened.
+ */
+int perf_init(void);
+
+/* perf_has - Was counter i opened? */
+int perf_has(int i);
+
+/* perf_name - A short name of counter i, for table headings */
+const char *perf_name(int i);
+
+/* perf_start - Reset the counters and start counting */
+void perf_start(void);
+
+/* perf_stop - Stop counting and store the counts since perf_start in c */
+void perf_stop(perf_counts_t *c);
+
+#endif /* _PERFCTR_H_ */
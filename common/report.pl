@@ -0,0 +1,474 @@
+#!/usr/bin/perl
+#######################################################################
+# report.pl - Build every lab, run its driver, and merge the results
+#     into one JSON report (run by "make bench" in the top directory)
+#
+# Each lab is copied into a scratch directory and built there with the
+# same compiler and flags, so the tree itself is left alone. Then
+#
+#     perflab    ./driver            CPEs of every rotate and smooth
+#     malloclab  ./mdriver -V -l     util and Kops of mm.c and libc
+#     threadlab  ./thread            best and median ms of each thread_N
+#     datalab    ./btest -p          cycles per call of each puzzle
+#
+# run in turn, and their tables go into one document next to the host,
+# CPU and compiler that produced them. A lab that fails to build or
+# run gets an "error" member instead of results, and the others still
+# run.
+#
+# With -m ("make matrix") that is done for every compiler of -c and
+# every build configuration named, for instance "-c gcc,clang -m all":
+#
+#     default    each lab's own Makefile flags (perflab -O0, datalab -m32)
+#     O3         -O3
+#     native     -O3 -march=native
+#     lto        -O3 -march=native -flto
+#     pgo        -O3 -march=native, built first with profiling, trained
+#                on a run of the lab's driver, and built again with the
+#                profile (gcc -fprofile-use, clang -fprofile-instr-use)
+#     pgo-lto    both
+#
+# Each run is tagged <compiler>-<configuration>: the tag is compiled in
+# as BUILD_TAG, which the drivers print as "Build: <tag>", and a table
+# of the headline number of each lab in every run ends the output.
+#######################################################################
+
+use strict 'vars';
+use Getopt::Std;
+use Cwd qw(abs_path);
+use File::Basename;
+use JSON::PP;
+use POSIX qw(strftime uname);
+
+$| = 1;      # Flush stdout each time
+
+#
+# usage - print help message and terminate
+#
+sub usage {
+    printf STDERR "$_[0]\n" if $_[0];
+    printf STDERR "Usage: $0 [-hk] [-c <ccs>] [-f <flags> | -m <configs>] [-l <labs>] [-o <file>] [-t <tag>]\n";
+    printf STDERR "Options:\n";
+    printf STDERR "  -c <ccs>     Comma separated compilers (default gcc)\n";
+    printf STDERR "  -f <flags>   Build every lab with these flags alone\n";
+    printf STDERR "  -h           Print this message\n";
+    printf STDERR "  -k           Keep the scratch directory\n";
+    printf STDERR "  -l <labs>    Comma separated labs to run (default perflab,malloclab,threadlab,datalab)\n";
+    printf STDERR "  -m <configs> Comma separated configurations, or all (default native):\n";
+    printf STDERR "               default, O3, native, lto, pgo, pgo-lto\n";
+    printf STDERR "  -o <file>    Write the report to file (default stdout)\n";
+    printf STDERR "  -t <tag>     Put this in front of the tag of every run\n";
+    die "\n";
+}
+
+#
+# Where each lab is in the tree, the optimization flags of its own
+# Makefile, the flags it needs besides those, the target that builds
+# its driver, and how to run it
+#
+my %labs = (
+    perflab   => { dir => "perflab-handout",
+		   opt => "-O0",
+		   cflags => "-Wall -g -I../common",
+		   target => "driver",
+		   run => "./driver" },
+    malloclab => { dir => "malloclab/malloclab-handout",
+		   opt => "-O3",
+		   cflags => "-Wall -I../../common",
+		   target => "mdriver",
+		   run => "./mdriver -V -l" },
+    threadlab => { dir => "threadlab/threadlab-handout",
+		   opt => "-O3",
+		   cflags => "-w -pthread -std=gnu99 -I../../common",
+		   target => "thread",
+		   run => "./thread" },
+    datalab   => { dir => "datalab-handout",
+		   opt => "-O -m32",
+		   cflags => "-Wall",
+		   target => "btest",
+		   run => "./btest -p" },
+);
+my @order = qw(perflab malloclab threadlab datalab);
+
+#
+# The build configurations of -m: flags for every lab (or with none,
+# each lab's own), and whether to build with a profile of a training
+# run of the lab's driver first
+#
+my %configs = (
+    default   => { },
+    O3        => { flags => "-O3" },
+    native    => { flags => "-O3 -march=native" },
+    lto       => { flags => "-O3 -march=native -flto" },
+    pgo       => { flags => "-O3 -march=native", pgo => 1 },
+    "pgo-lto" => { flags => "-O3 -march=native -flto", pgo => 1 },
+);
+my @config_order = qw(default O3 native lto pgo pgo-lto);
+
+#
+# parse_perflab - The CPEs of each version of rotate and smooth
+#
+sub parse_perflab {
+    my @lines = @_;
+    my %result = (rotate => [], smooth => []);
+    my ($version, @dims);
+
+    foreach my $line (@lines) {
+	if ($line =~ /^(Rotate|Smooth): Version = ([^:]*): (.*):\s*$/) {
+	    $version = { version => $2, description => $3, cpe => {} };
+	    push @{$result{lc $1}}, $version;
+	}
+	elsif ($version && $line =~ /^Dim\s+(.*)$/) {
+	    @dims = grep { $_ ne "Mean" } split(/\s+/, $1);
+	}
+	elsif ($version && $line =~ /^Your CPEs\s+(.*)$/) {
+	    my @cpes = split(/\s+/, $1);
+	    for (my $i = 0; $i < @dims && $i < @cpes; $i++) {
+		$version->{cpe}{$dims[$i]} = $cpes[$i] + 0;
+	    }
+	}
+	elsif ($version && $line =~ /^Speedup\s+(.*)$/) {
+	    my @speedups = split(/\s+/, $1);
+	    $version->{mean_speedup} = $speedups[-1] + 0;
+	}
+    }
+    return \%result;
+}
+
+#
+# parse_malloclab - The per trace table of mm.c and of libc
+#
+sub parse_malloclab {
+    my @lines = @_;
+    my %result;
+    my $table;
+
+    foreach my $line (@lines) {
+	if ($line =~ /^Results for (\S+) malloc:/) {
+	    $table = $result{$1} = { traces => [] };
+	}
+	elsif ($table && $line =~ /^\s*(\S+)\s+yes\s+(\d+)k\s+(\d+)k\s+(\d+)%\s+(\d+)\s+([\d.]+)\s+(\d+)\s*$/) {
+	    push @{$table->{traces}}, { trace => $1, valid => JSON::PP::true,
+					idealheap_kb => $2 + 0, maxheap_kb => $3 + 0,
+					util => $4 / 100, ops => $5 + 0,
+					secs => $6 + 0, kops => $7 + 0 };
+	}
+	elsif ($table && $line =~ /^\s*-\s+no\s/) {
+	    push @{$table->{traces}}, { valid => JSON::PP::false };
+	}
+	elsif ($table && $line =~ /^\s*Total\s+(\d+)%\s+(\d+)\s+([\d.]+)\s+(\d+)\s*$/) {
+	    $table->{total} = { util => $1 / 100, ops => $2 + 0,
+				secs => $3 + 0, kops => $4 + 0 };
+	}
+	elsif ($line =~ /^Processor clock rate ~= ([\d.]+) MHz \((\w+)\)/) {
+	    $result{timer} = { source => $2, mhz => $1 + 0 };
+	}
+	elsif ($line =~ /^Score = .* = (\d+)\/100/) {
+	    $result{score} = $1 + 0;
+	}
+    }
+    return \%result;
+}
+
+#
+# parse_threadlab - The best and median time of each routine
+#
+sub parse_threadlab {
+    my @lines = @_;
+    my @routines;
+    my $routine;
+
+    foreach my $line (@lines) {
+	if ($line =~ /^Running (thread_\d+):/) {
+	    $routine = { name => $1, correct => JSON::PP::true };
+	    push @routines, $routine;
+	}
+	elsif ($routine && $line =~ /^Wrong result/) {
+	    $routine->{correct} = JSON::PP::false;
+	}
+	elsif ($routine && $line =~ /^Best of (\d+) trials: ([\d.]+) ms, median ([\d.]+) ms/) {
+	    $routine->{trials} = $1 + 0;
+	    $routine->{best_ms} = $2 + 0;
+	    $routine->{median_ms} = $3 + 0;
+	}
+    }
+    return { routines => \@routines };
+}
+
+#
+# parse_datalab - The cycles per call of each puzzle
+#
+sub parse_datalab {
+    my @lines = @_;
+    my @functions;
+
+    foreach my $line (@lines) {
+	if ($line =~ /^(\w+)\s+(\d+)\s+([\d.]+)\s+([\d.]+)\s*$/) {
+	    push @functions, { name => $1, max_ops => $2 + 0,
+			       latency_cycles => $3 + 0,
+			       throughput_cycles => $4 + 0 };
+	}
+    }
+    return { functions => \@functions };
+}
+
+my %parse = (perflab => \&parse_perflab, malloclab => \&parse_malloclab,
+	     threadlab => \&parse_threadlab, datalab => \&parse_datalab);
+
+#
+# first_line - The first line a command prints, or "unknown"
+#
+sub first_line {
+    my $out = `$_[0] 2>/dev/null`;
+    return "unknown" if $? != 0 || $out eq "";
+    return (split(/\n/, $out))[0];
+}
+
+#
+# cpu_info - The CPU model and the number of CPUs, from /proc/cpuinfo
+#
+sub cpu_info {
+    my %cpu = (model => "unknown", cpus => 0);
+
+    if (open(my $fh, "<", "/proc/cpuinfo")) {
+	while (<$fh>) {
+	    $cpu{cpus}++ if /^processor\s*:/;
+	    $cpu{model} = $1 if /^model name\s*:\s*(.*?)\s*$/;
+	    $cpu{mhz} = $1 + 0 if /^cpu MHz\s*:\s*([\d.]+)/ && !$cpu{mhz};
+	    $cpu{flags} = [split(/\s+/, $1)] if /^flags\s*:\s*(.*?)\s*$/ && !$cpu{flags};
+	}
+	close($fh);
+    }
+    # Only the flags that say how the timer and the kernels can run
+    if ($cpu{flags}) {
+	my %want = map { $_ => 1 } qw(constant_tsc nonstop_tsc rdtscp sse2 sse4_2 avx avx2 avx512f);
+	$cpu{flags} = [grep { $want{$_} } @{$cpu{flags}}];
+    }
+    return \%cpu;
+}
+
+#
+# summarize - The headline number of each lab in the results of a run,
+#     to pick the fastest configuration by
+#
+sub summarize {
+    my ($labs) = @_;
+    my %summary;
+    my $l;
+
+    if (($l = $labs->{perflab}) && !$l->{error}) {
+	foreach my $kind ("rotate", "smooth") {
+	    foreach my $v (@{$l->{$kind}}) {
+		$summary{"${kind}_speedup"} = $v->{mean_speedup}
+		    if defined($v->{mean_speedup}) &&
+		       (!defined($summary{"${kind}_speedup"}) || $v->{mean_speedup} > $summary{"${kind}_speedup"});
+	    }
+	}
+    }
+    if (($l = $labs->{malloclab}) && !$l->{error} && $l->{mm}{total}) {
+	$summary{mm_kops} = $l->{mm}{total}{kops};
+	$summary{mm_score} = $l->{score};
+    }
+    if (($l = $labs->{threadlab}) && !$l->{error}) {
+	foreach my $r (@{$l->{routines}}) {
+	    $summary{thread_best_ms} = $r->{best_ms}
+		if defined($r->{best_ms}) &&
+		   (!defined($summary{thread_best_ms}) || $r->{best_ms} < $summary{thread_best_ms});
+	}
+    }
+    if (($l = $labs->{datalab}) && !$l->{error}) {
+	my $sum = 0;
+	$sum += $_->{latency_cycles} foreach @{$l->{functions}};
+	$summary{btest_latency_cycles} = $sum if @{$l->{functions}};
+    }
+    return \%summary;
+}
+
+#
+# build - Build lab in dir with cc and the flags, after a make clean,
+#     which leaves the profiles of a training run in place. Returns 1
+#     if it built.
+#
+sub build {
+    my ($lab, $dir, $cc, $flags) = @_;
+    my $l = $labs{$lab};
+
+    return system("cd '$dir' && make clean >/dev/null 2>&1; " .
+		  "make CC='$cc' CFLAGS='$flags $l->{cflags}' $l->{target} >>build.log 2>&1") == 0;
+}
+
+#
+# run_lab - Run lab's driver in dir. Returns its parsed results.
+#
+sub run_lab {
+    my ($lab, $dir) = @_;
+    my $l = $labs{$lab};
+    my @lines = `cd '$dir' && $l->{run} 2>&1`;
+    my $status = $?;
+    my $result;
+
+    chomp(@lines);
+    $result = $parse{$lab}->(@lines);
+    foreach my $line (@lines) {
+	$result->{build} = $1 if $line =~ /^Build: (.*)$/;
+    }
+    $result->{command} = $l->{run};
+    $result->{error} = "exited with status " . ($status >> 8) if $status != 0;
+    return $result;
+}
+
+##############
+# Main routine
+##############
+my %opts;
+getopts('hkc:f:l:m:o:t:', \%opts) or usage();
+usage() if $opts{h};
+
+my @ccs = $opts{c} ? split(/[,\s]+/, $opts{c}) : ("gcc");
+my @run = $opts{l} ? split(/[,\s]+/, $opts{l}) : @order;
+foreach my $lab (@run) {
+    usage("Unknown lab $lab") if !$labs{$lab};
+}
+
+# The configurations: the -f flags alone, or those named by -m
+my @configs;
+if (defined($opts{f})) {
+    $configs{custom} = { flags => $opts{f} };
+    @configs = ("custom");
+}
+else {
+    @configs = split(/[,\s]+/, $opts{m} || "native");
+    @configs = @config_order if "@configs" eq "all";
+}
+foreach my $config (@configs) {
+    usage("Unknown configuration $config") if !$configs{$config};
+}
+
+my $root = dirname(dirname(abs_path($0)));
+my $login = getlogin() || (getpwuid($<))[0] || "unknown";
+my $tmpdir = "/var/tmp/bench.$login.$$";
+
+system("mkdir", "-p", $tmpdir) == 0
+    or die "$0: Could not make scratch directory $tmpdir\n";
+system("cp", "-r", "$root/common", "$tmpdir/common") == 0
+    or die "$0: Could not copy $root/common to $tmpdir\n";
+
+my @uname = uname();
+my %report = (
+    date => strftime("%Y-%m-%dT%H:%M:%S", localtime),
+    host => { name => $uname[1], os => "$uname[0] $uname[2]", arch => $uname[4] },
+    cpu => cpu_info(),
+    commit => first_line("git -C '$root' rev-parse HEAD"),
+    runs => [],
+);
+
+foreach my $cc (@ccs) {
+    my $version = first_line("$cc --version");
+    my $clang = $version =~ /clang/;
+
+    foreach my $config (@configs) {
+	my $c = $configs{$config};
+	my $tag = join("-", grep { defined && $_ ne "" } $opts{t}, basename($cc), $config);
+	my %run = (tag => $tag, config => $config,
+		   compiler => { cc => $cc, version => $version }, labs => {});
+
+	push @{$report{runs}}, \%run;
+	if ($version eq "unknown") {
+	    $run{error} = "$cc not found";
+	    print STDERR "$tag: $cc not found, skipping\n";
+	    next;
+	}
+
+	foreach my $lab (@run) {
+	    my $l = $labs{$lab};
+	    my $dir = "$tmpdir/$tag/$l->{dir}";
+	    my $flags = defined($c->{flags}) ? $c->{flags} : $l->{opt};
+	    my $define = "-DBUILD_TAG=\\\"$tag\\\"";
+
+	    # Each build gets its own copy, with the common code next to it
+	    system("mkdir", "-p", dirname($dir)) == 0 &&
+		(-d "$tmpdir/$tag/common" || system("cp", "-r", "$root/common", "$tmpdir/$tag/common") == 0) &&
+		system("cp", "-r", "$root/$l->{dir}", $dir) == 0
+		or die "$0: Could not copy $root/$l->{dir} to $tmpdir/$tag\n";
+
+	    # With PGO, build instrumented, train on the lab's own run,
+	    # and build again with the profile
+	    if ($c->{pgo}) {
+		my ($gen, $use);
+
+		if ($clang) {
+		    $gen = "-fprofile-instr-generate";
+		    $use = "-fprofile-instr-use=$dir/pgo.profdata -Wno-profile-instr-unprofiled -Wno-profile-instr-out-of-date";
+		}
+		else {
+		    $gen = "-fprofile-generate -fprofile-update=prefer-atomic";
+		    $use = "-fprofile-use -fprofile-correction -Wno-missing-profile";
+		}
+		print STDERR "$tag: $lab: training with $cc $flags $gen\n";
+		if (!build($lab, $dir, $cc, "$flags $gen $define")) {
+		    $run{labs}{$lab} = { error => "instrumented build failed, see $dir/build.log" };
+		    $opts{k} = 1;
+		    next;
+		}
+		local $ENV{LLVM_PROFILE_FILE} = "$dir/pgo-%p.profraw";
+		system("cd '$dir' && $l->{run} >train.log 2>&1");
+		if ($clang && system("llvm-profdata merge -o '$dir/pgo.profdata' '$dir'/pgo-*.profraw >>'$dir/build.log' 2>&1") != 0) {
+		    $run{labs}{$lab} = { error => "llvm-profdata merge failed, see $dir/build.log" };
+		    $opts{k} = 1;
+		    next;
+		}
+		$flags = "$flags $use";
+	    }
+
+	    print STDERR "$tag: $lab: building with $cc $flags\n";
+	    if (!build($lab, $dir, $cc, "$flags $define")) {
+		$run{labs}{$lab} = { error => "build failed, see $dir/build.log" };
+		$opts{k} = 1;
+		next;
+	    }
+	    $run{compiler}{flags}{$lab} = $flags;
+
+	    print STDERR "$tag: $lab: running $l->{run}\n";
+	    $run{labs}{$lab} = run_lab($lab, $dir);
+	}
+	$run{summary} = summarize($run{labs});
+    }
+}
+
+my $json = JSON::PP->new->pretty->canonical->encode(\%report);
+if ($opts{o}) {
+    open(my $fh, ">", $opts{o}) or die "$0: Could not write $opts{o}\n";
+    print $fh $json;
+    close($fh);
+    print STDERR "Wrote $opts{o}\n";
+}
+else {
+    print $json;
+}
+
+# A table of the headline numbers, to compare the configurations
+printf STDERR "\n%-24s %8s %8s %9s %6s %10s %10s\n", "Configuration",
+    "rotate", "smooth", "mm Kops", "score", "thread ms", "btest cyc";
+foreach my $run (@{$report{runs}}) {
+    my $s = $run->{summary} || {};
+    printf STDERR "%-24s", $run->{tag};
+    foreach my $k (["rotate_speedup", "%9.1f"], ["smooth_speedup", "%9.1f"],
+		   ["mm_kops", "%10.0f"], ["mm_score", "%7.0f"],
+		   ["thread_best_ms", "%11.2f"], ["btest_latency_cycles", "%11.1f"]) {
+	if (defined($s->{$k->[0]})) {
+	    printf STDERR $k->[1], $s->{$k->[0]};
+	}
+	else {
+	    printf STDERR "%*s", length(sprintf($k->[1], 0)), "-";
+	}
+    }
+    printf STDERR "\n";
+}
+
+if ($opts{k}) {
+    print STDERR "The builds are in $tmpdir.\n";
+}
+else {
+    system("rm", "-rf", $tmpdir);
+}
+exit(0);
@@ -21,6 +21,8 @@
 #include <signal.h>
 #include <setjmp.h>
 #include <math.h>
+#include <sys/types.h>
+#include <sys/wait.h>
 #include "btest.h"
 
 /* Not declared in some stdlib.h files, so define here */
@@ -46,6 +48,19 @@ float strtof(const char *nptr, char **endptr);
    TEST_RANGE, thus MAX_TEST_VALS must be at least k*TEST_RANGE */
 #define MAX_TEST_VALS 13*TEST_RANGE
 
+/* With -e, functions of more than one argument are tested on every
+   combination of arguments if there are at most EXHAUST_TESTS of them,
+   and on EXHAUST_TESTS random ones otherwise */
+#define EXHAUST_TESTS (1 << 27)
+
+/* Default timeout with -e, in seconds */
+#define EXHAUST_TIMEOUT 300
+
+/* With -p, time each function on batches of PROFILE_CALLS random
+   arguments, PROFILE_RUNS times, and report the fastest batch */
+#define PROFILE_CALLS 65536
+#define PROFILE_RUNS 20
+
 /**********************************
  * Globals defined in other modules 
  **********************************/
@@ -63,6 +78,10 @@ static int grade = 0;
 
 /* Time out after this number of seconds */
 static int timeout_limit = TIMEOUT_LIMIT; /* -T */
+static int timeout_given = 0;
+
+/* Test every argument instead of samples (-e) */
+static int exhaustive = 0;
 
 /* If non-NULL, test only one function (-f) */
 static char* test_fname = NULL;  
@@ -74,6 +93,14 @@ static unsigned argval[3] = {0,0,0};
 /* Use fixed weight for rating, and if so, what should it  be? (-r) */
 static int global_rating = 0;
 
+/* Number of test processes to run at once (-j) */
+static int jobs = 1;
+
+/* Time the functions instead of testing them (-p), and also time the
+   tests.c and builtin.c versions (-P) */
+static int profile = 0;
+static int profile_all = 0;
+
 /******************
  * Helper functions
  ******************/
@@ -290,15 +317,95 @@ static int test_3_arg(funct_t f, funct_t ft,
     return error;
 }
 
+/*
+ * exhaust_function - Test a function for -e, on shard number shard of
+ * nshards slices of its arguments. One-argument functions are checked
+ * on every argument in their range by their scanner from exhaust.c,
+ * and the first mismatch it finds is confirmed with test_1_arg.
+ * Others are tested as EXHAUST_TESTS describes. Return number of errors
+ */
+static int exhaust_function(test_ptr t, int shard, int nshards)
+{
+    unsigned start[3];
+    unsigned long long size[3], total = 1, n, lo, hi, i;
+    unsigned long long rng = 0x9e3779b97f4a7c15ULL * (shard + 1);
+    unsigned x, v[3];
+    int a, args = t->args, random, errors = 0;
+    scan_rec *s;
+
+    for (a = 0; a < args; a++) {
+	int min = t->arg_ranges[a][0], max = t->arg_ranges[a][1];
+
+	if (min == 1 && max == 1) {
+	    /* Floating point puzzles: every bit pattern */
+	    start[a] = 0;
+	    size[a] = 1ULL << 32;
+	} else {
+	    start[a] = min;
+	    size[a] = (long long) max - min + 1;
+	}
+	total = total > EXHAUST_TESTS ? total : total * size[a];
+    }
+
+    if (args == 1) {
+	for (s = scan_set; s->name && strcmp(s->name, t->name); s++)
+	    ;
+	if (s->name) {
+	    lo = size[0] * shard / nshards;
+	    hi = size[0] * (shard+1) / nshards;
+	    if (!s->scan(start[0] + (unsigned) lo, hi - lo, &x))
+		return 0;
+	    errors = test_1_arg(t->solution_funct, t->test_funct, x, t->name);
+	    if (!errors && !grade)
+		printf("ERROR: Test %s(%d[0x%x]) failed only when compiled in exhaust.c...\n"
+		       "...It probably relies on undefined behavior\n", t->name, x, x);
+	    return 1;
+	}
+    }
+
+    random = total > EXHAUST_TESTS;
+    n = random ? EXHAUST_TESTS : total;
+    lo = n * shard / nshards;
+    hi = n * (shard+1) / nshards;
+    for (i = lo; i < hi; i++) {
+	unsigned long long rest = i, off;
+
+	for (a = 0; a < args; a++) {
+	    if (random) {
+		rng ^= rng << 13;
+		rng ^= rng >> 7;
+		rng ^= rng << 17;
+		off = ((rng >> 32) * size[a]) >> 32;
+	    } else {
+		off = rest % size[a];
+		rest /= size[a];
+	    }
+	    v[a] = start[a] + (unsigned) off;
+	}
+	if (args == 1)
+	    errors = test_1_arg(t->solution_funct, t->test_funct, v[0], t->name);
+	else if (args == 2)
+	    errors = test_2_arg(t->solution_funct, t->test_funct, v[0], v[1], t->name);
+	else
+	    errors = test_3_arg(t->solution_funct, t->test_funct, v[0], v[1], v[2], t->name);
+	if (errors)
+	    return errors;
+    }
+    return 0;
+}
+
 /* 
- * test_function - Test a function.  Return number of errors 
+ * test_function - Test a function on shard number shard of nshards
+ * slices of the values for its first argument.  Return number of errors 
  */
-static int test_function(test_ptr t) {
+static int test_function(test_ptr t, int shard, int nshards) {
     int test_counts[3];    /* number of test values for each arg */
     int args = t->args;    /* number of function arguments */
     int arg_test_range[3]; /* test range for each argument */
     int i, a1, a2, a3;        
+    int a1_lo, a1_hi;      /* the shard's first argument values */
     int errors = 0;
+    int exhaust = exhaustive && args > 0 && !has_arg[0] && !has_arg[1] && !has_arg[2];
 
     /* These are the test values for each arg. Declared with the
        static attribute so that the array will be allocated in bss
@@ -335,7 +442,7 @@ static int test_function(test_ptr t) {
 	arg_test_range[2] = 1;
 
     /* Create a test set for each argument */
-    for (i = 0; i < args; i++) {
+    for (i = 0; i < args && !exhaust; i++) {
 	test_counts[i] =  gen_vals(arg_test_vals[i], 
 				   t->arg_ranges[i][0], /* min */
 				   t->arg_ranges[i][1], /* max */
@@ -344,6 +451,9 @@ static int test_function(test_ptr t) {
 
     }
 
+    a1_lo = args && !exhaust ? (long long) test_counts[0] * shard / nshards : 0;
+    a1_hi = args && !exhaust ? (long long) test_counts[0] * (shard+1) / nshards : 0;
+
     /* Handle timeouts in the test code */
     if (timeout_limit > 0) {
 	int rc;
@@ -357,9 +467,14 @@ static int test_function(test_ptr t) {
 	alarm(timeout_limit);
     }
 
+    if (exhaust)
+	return exhaust_function(t, shard, nshards);
+
 
     /* Test function has no arguments */
     if (args == 0) {
+	if (shard > 0)
+	    return errors;
 	errors += test_0_arg(t->solution_funct, t->test_funct, t->name);
 	return errors;
     } 
@@ -370,7 +485,7 @@ static int test_function(test_ptr t) {
       
     /* Iterate over the values for first argument */
 
-    for (a1 = 0; a1 < test_counts[0]; a1++) {
+    for (a1 = a1_lo; a1 < a1_hi; a1++) {
 	if (args == 1) {
 	    errors += test_1_arg(t->solution_funct, 
 				 t->test_funct,
@@ -418,6 +533,291 @@ static int test_function(test_ptr t) {
     return errors;
 }
 
+/*
+ * The parallel runner (-j). Every function to test is split into
+ * jobs shards, each taking a slice of the values for the first
+ * argument (functions without arguments get one shard), and each
+ * shard runs in its own child process, at most jobs at a time. A
+ * child inherits the timeout handler and enforces timeout_limit on
+ * its shard, and sends what it prints to its own temporary file.
+ * The children all start from the parent's rand() state, so every
+ * shard of a function tests the same values, and the earliest shard
+ * with an error is the one serial testing would have stopped at.
+ */
+typedef struct {
+    int test;      /* Index in test_set */
+    int shard;     /* Which slice of the first argument's values */
+    pid_t pid;     /* Child testing it, or 0 if not yet started */
+    FILE *out;     /* Where the child prints */
+    int done;      /* Child has exited and errors and text are set */
+    int errors;    /* Errors found in this shard */
+    char *text;    /* What the child printed */
+} unit_t;
+
+static unit_t *units;
+static int nunits = 0;    /* Number of units */
+static int next_unit = 0; /* First unit not yet started */
+static int running = 0;   /* Children not yet reaped */
+
+/*
+ * unix_error - Print a message for a failed system call and exit
+ */
+static void unix_error(char *msg)
+{
+    perror(msg);
+    exit(1);
+}
+
+/*
+ * start_unit - Fork a child to test unit u
+ */
+static void start_unit(unit_t *u)
+{
+    if ((u->out = tmpfile()) == NULL)
+	unix_error("tmpfile");
+    fflush(stdout);
+    if ((u->pid = fork()) < 0)
+	unix_error("fork");
+    if (u->pid == 0) {
+	dup2(fileno(u->out), STDOUT_FILENO);
+	exit(test_function(&test_set[u->test], u->shard, jobs) ? 1 : 0);
+    }
+    running++;
+}
+
+/*
+ * reap_unit - Wait for any child, and record its errors and output
+ */
+static void reap_unit()
+{
+    int status, i;
+    long len;
+    pid_t pid;
+    unit_t *u = NULL;
+
+    if ((pid = wait(&status)) < 0)
+	unix_error("wait");
+    for (i = 0; i < nunits; i++)
+	if (units[i].pid == pid)
+	    u = &units[i];
+    if (u == NULL)
+	return;
+    running--;
+
+    fseek(u->out, 0, SEEK_END);
+    len = ftell(u->out);
+    rewind(u->out);
+    if ((u->text = malloc(len + 256)) == NULL)
+	unix_error("malloc");
+    u->text[fread(u->text, 1, len, u->out)] = '\0';
+    fclose(u->out);
+
+    if (WIFEXITED(status))
+	u->errors = WEXITSTATUS(status);
+    else {
+	/* In serial testing this would have killed btest */
+	u->errors = 1;
+	sprintf(u->text + strlen(u->text), 
+		"ERROR: Test %s failed.\n  Killed by signal %d (%s)\n",
+		test_set[u->test].name, WTERMSIG(status), strsignal(WTERMSIG(status)));
+    }
+    u->done = 1;
+}
+
+/*
+ * start_parallel - Make the units for every function to test
+ */
+static void start_parallel()
+{
+    int i, s, ntests = 0;
+
+    for (i = 0; test_set[i].solution_funct; i++)
+	ntests++;
+    if ((units = calloc(ntests * jobs, sizeof(unit_t))) == NULL)
+	unix_error("calloc");
+    for (i = 0; test_set[i].solution_funct; i++) {
+	if (!test_fname || strcmp(test_set[i].name,test_fname) == 0) {
+	    for (s = 0; s < (test_set[i].args ? jobs : 1); s++) {
+		units[nunits].test = i;
+		units[nunits].shard = s;
+		nunits++;
+	    }
+	}
+    }
+}
+
+/*
+ * parallel_result - Keep jobs children busy until every shard of
+ * test i is done, then print the output of its first failing shard
+ * (or nothing, if none failed) and return that shard's errors
+ */
+static int parallel_result(int i)
+{
+    int u, busy;
+
+    do {
+	while (running < jobs && next_unit < nunits)
+	    start_unit(&units[next_unit++]);
+	busy = 0;
+	for (u = 0; u < nunits; u++)
+	    if (units[u].test == i && !units[u].done)
+		busy = 1;
+	if (busy)
+	    reap_unit();
+    } while (busy);
+
+    for (u = 0; u < nunits; u++) {
+	if (units[u].test == i && units[u].errors) {
+	    printf("%s", units[u].text);
+	    return units[u].errors;
+	}
+    }
+    return 0;
+}
+
+/*
+ * The profiler (-p and -P). Each batch calls the function through a
+ * pointer, as btest does, on PROFILE_CALLS random arguments from its
+ * ranges, and is timed with the cycle counter. In a throughput batch
+ * the calls are independent; in a latency batch the first argument of
+ * each call depends on the result of the one before. The same batches
+ * of a function that just returns its first argument are subtracted,
+ * to leave the cycles spent in the function itself.
+ */
+static int profile_args[3][PROFILE_CALLS];
+static volatile int profile_zero = 0; /* Hides that r & zero is 0 */
+static volatile int profile_sink;     /* Keeps the results live */
+
+/*
+ * read_cycles - Read the x86 time stamp counter
+ */
+static unsigned long long read_cycles()
+{
+    unsigned hi, lo;
+
+    asm volatile("rdtsc" : "=a" (lo), "=d" (hi));
+    return (unsigned long long) hi << 32 | lo;
+}
+
+static int identity_0(void) { return 0; }
+static int identity_1(int x) { return x; }
+static int identity_2(int x, int y) { return x; }
+static int identity_3(int x, int y, int z) { return x; }
+static funct_t identity[4] = {
+    identity_0, (funct_t) identity_1, (funct_t) identity_2, (funct_t) identity_3
+};
+
+/*
+ * time_batch - Return the fewest cycles per call of f, with args
+ * arguments, over PROFILE_RUNS batches
+ */
+static double time_batch(funct_t f, int args, int latency)
+{
+    funct1_t f1 = (funct1_t) f;
+    funct2_t f2 = (funct2_t) f;
+    funct3_t f3 = (funct3_t) f;
+    int *a1 = profile_args[0], *a2 = profile_args[1], *a3 = profile_args[2];
+    int i, run, r = 0, zero = profile_zero;
+    unsigned long long start, cycles, best = 0;
+
+    for (run = 0; run < PROFILE_RUNS; run++) {
+	start = read_cycles();
+	if (args == 0)
+	    for (i = 0; i < PROFILE_CALLS; i++)
+		r += f();
+	else if (latency && args == 1)
+	    for (i = 0; i < PROFILE_CALLS; i++)
+		r = f1(a1[i] ^ (r & zero));
+	else if (args == 1)
+	    for (i = 0; i < PROFILE_CALLS; i++)
+		r += f1(a1[i]);
+	else if (latency && args == 2)
+	    for (i = 0; i < PROFILE_CALLS; i++)
+		r = f2(a1[i] ^ (r & zero), a2[i]);
+	else if (args == 2)
+	    for (i = 0; i < PROFILE_CALLS; i++)
+		r += f2(a1[i], a2[i]);
+	else if (latency)
+	    for (i = 0; i < PROFILE_CALLS; i++)
+		r = f3(a1[i] ^ (r & zero), a2[i], a3[i]);
+	else
+	    for (i = 0; i < PROFILE_CALLS; i++)
+		r += f3(a1[i], a2[i], a3[i]);
+	cycles = read_cycles() - start;
+	if (run == 0 || cycles < best)
+	    best = cycles;
+    }
+    profile_sink = r;
+    return (double) best / PROFILE_CALLS;
+}
+
+/*
+ * print_timing - Print the latency and throughput of f in cycles per
+ * call, less those of the identity function, or dashes if f is NULL
+ */
+static void print_timing(funct_t f, int args)
+{
+    double lat, thru;
+
+    if (f == NULL) {
+	printf("%8s%8s", "-", "-");
+	return;
+    }
+    lat = time_batch(f, args, 1) - time_batch(identity[args], args, 1);
+    thru = time_batch(f, args, 0) - time_batch(identity[args], args, 0);
+    printf("%8.1f%8.1f", lat > 0 ? lat : 0, thru > 0 ? thru : 0);
+}
+
+/*
+ * run_profile - Time each function to test, with -P also its reference
+ * in tests.c and any version in builtin.c
+ */
+static void run_profile()
+{
+    int i, a, j;
+    test_ptr t;
+    builtin_rec *b;
+
+    printf("Cycles per call of each function, less the call, on %d random "
+	   "arguments (best of %d)\n\n", PROFILE_CALLS, PROFILE_RUNS);
+    printf("%-16s%6s%16s", "", "Max", "bits.c");
+    if (profile_all)
+	printf("%16s%16s", "tests.c", "builtin.c");
+    printf("\n%-16s%6s%8s%8s", "Function", "ops", "latency", "thru");
+    if (profile_all)
+	printf("%8s%8s%8s%8s", "latency", "thru", "latency", "thru");
+    printf("\n");
+
+    for (i = 0; test_set[i].solution_funct; i++) {
+	t = &test_set[i];
+	if (test_fname && strcmp(t->name, test_fname) != 0)
+	    continue;
+
+	/* Random arguments from the test ranges, as in gen_vals */
+	for (a = 0; a < t->args; a++) {
+	    int min = t->arg_ranges[a][0], max = t->arg_ranges[a][1];
+	    for (j = 0; j < PROFILE_CALLS; j++) {
+		if (has_arg[a])
+		    profile_args[a][j] = argval[a];
+		else if (min == 1 && max == 1)
+		    profile_args[a][j] = (unsigned) rand() << 16 ^ rand();
+		else
+		    profile_args[a][j] = random_val(min, max);
+	    }
+	}
+
+	printf("%-16s%6d", t->name, t->op_limit);
+	print_timing(t->solution_funct, t->args);
+	if (profile_all) {
+	    for (b = builtin_set; b->name && strcmp(b->name, t->name); b++)
+		;
+	    print_timing(t->test_funct, t->args);
+	    print_timing(b->funct, t->args);
+	}
+	printf("\n");
+    }
+}
+
 /* 
  * run_tests - Run series of tests.  Return number of errors 
  */ 
@@ -428,6 +828,9 @@ static int run_tests()
     double points = 0.0;
     double max_points = 0.0;
 
+    if (jobs > 1)
+	start_parallel();
+
     printf("Score\tRating\tErrors\tFunction\n");
 
     for (i = 0; test_set[i].solution_funct; i++) {
@@ -436,7 +839,7 @@ static int run_tests()
 	double tpoints;
 	if (!test_fname || strcmp(test_set[i].name,test_fname) == 0) {
 	    int rating = global_rating ? global_rating : test_set[i].rating;
-	    terrors = test_function(&test_set[i]);
+	    terrors = jobs > 1 ? parallel_result(i) : test_function(&test_set[i], 0, 1);
 	    errors += terrors;
 	    tscore = terrors == 0 ? 1.0 : 0.0;
 	    tpoints = rating * tscore;
@@ -507,14 +910,21 @@ static int get_num_val(char *sval, unsigned *valp) {
  */
 static void usage(char *cmd) {
     printf("Usage: %s [-hg] [-r <n>] [-f <name> [-1|-2|-3 <val>]*] [-T <time limit>]\n", cmd);
+    printf("       [-j <n>] [-e] [-pP]\n");
     printf("  -1 <val>  Specify first function argument\n");
     printf("  -2 <val>  Specify second function argument\n");
     printf("  -3 <val>  Specify third function argument\n");
+    printf("  -e        Test one-argument functions on every argument, and\n");
+    printf("            others on up to %d combinations of arguments\n", EXHAUST_TESTS);
     printf("  -f <name> Test only the named function\n");
     printf("  -g        Compact output for grading (with no error msgs)\n");
     printf("  -h        Print this message\n");
+    printf("  -j <n>    Test in n processes at once, 0 for one per CPU\n");
+    printf("  -p        Time the functions in cycles per call instead of testing\n");
+    printf("  -P        Like -p, and also time the tests.c and builtin versions\n");
     printf("  -r <n>    Give uniform weight of n for all problems\n");
-    printf("  -T <lim>  Set timeout limit to lim\n");
+    printf("  -T <lim>  Set timeout limit to lim (default %d, or %d with -e)\n",
+	   TIMEOUT_LIMIT, EXHAUST_TIMEOUT);
     exit(1);
 }
 
@@ -529,7 +939,7 @@ int main(int argc, char *argv[])
     char c;
 
     /* parse command line args */
-    while ((c = getopt(argc, argv, "hgf:r:T:1:2:3:")) != -1)
+    while ((c = getopt(argc, argv, "hgf:r:T:1:2:3:j:epP")) != -1)
         switch (c) {
         case 'h': /* help */
 	    usage(argv[0]);
@@ -568,15 +978,44 @@ int main(int argc, char *argv[])
 	    break;
 	case 'T': /* Set timeout limit */
 	    timeout_limit = atoi(optarg);
+	    timeout_given = 1;
+	    break;
+	case 'e': /* Test every argument */
+	    exhaustive = 1;
+	    break;
+	case 'P': /* Time the references and builtins too */
+	    profile_all = 1;
+	    /* fall through */
+	case 'p': /* Time the functions */
+	    profile = 1;
+	    break;
+	case 'j': /* Test in parallel */
+	    jobs = atoi(optarg);
+	    if (jobs == 0)
+		jobs = sysconf(_SC_NPROCESSORS_ONLN);
+	    if (jobs < 1)
+		usage(argv[0]);
 	    break;
 	default:
 	    usage(argv[0]);
 	}
 
+    if (exhaustive && !timeout_given)
+	timeout_limit = EXHAUST_TIMEOUT;
     if (timeout_limit > 0) {
 	Signal(SIGALRM, timeout_handler);
     }
 
+#ifdef BUILD_TAG
+    /* The build configuration, from common/report.pl */
+    printf("Build: %s\n", BUILD_TAG);
+#endif
+
+    if (profile) {
+	run_profile();
+	return 0;
+    }
+
     /* test each function */
     errors = run_tests();
 
@@ -24,6 +24,26 @@ typedef struct {
 
 extern test_rec test_set[];
 
+/* Exhaustive checking of a one-argument puzzle, in exhaust.c. A scanner
+   compares the puzzle with its reference on the count arguments from
+   start up, and returns 1 with the first mismatch in *x, or 0 */
+typedef int (*scan_funct)(unsigned start, unsigned long long count, unsigned *x);
+
+typedef struct {
+    char *name;             /* Puzzle name, as in test_set */
+    scan_funct scan;
+} scan_rec;
+
+extern scan_rec scan_set[];
+
+/* The puzzles written with compiler builtins, in builtin.c, for btest -P */
+typedef struct {
+    char *name;             /* Puzzle name, as in test_set */
+    funct_t funct;
+} builtin_rec;
+
+extern builtin_rec builtin_set[];
+
 
 
 
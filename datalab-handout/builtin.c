@@ -0,0 +1,86 @@
+/*
+ * CS:APP Data Lab
+ *
+ * builtin.c - The puzzles written the easy way, with any C operator
+ *             and compiler builtins, for btest -P to time against the
+ *             solutions in bits.c. Puzzles not in this lab are unused.
+ */
+#include <stdio.h>
+#include "btest.h"
+
+static int builtin_minusOne(void)
+{
+    return -1;
+}
+
+static int builtin_isZero(int x)
+{
+    return !x;
+}
+
+static int builtin_getByte(int x, int n)
+{
+    return (x >> (n << 3)) & 0xff;
+}
+
+static int builtin_negate(int x)
+{
+    return -(unsigned) x;
+}
+
+static int builtin_addOK(int x, int y)
+{
+    int sum;
+    return !__builtin_add_overflow(x, y, &sum);
+}
+
+static int builtin_bitMask(int highbit, int lowbit)
+{
+    return highbit < lowbit ? 0 : (int) ((~0u << lowbit) & (~0u >> (31 - highbit)));
+}
+
+static int builtin_absVal(int x)
+{
+    return __builtin_abs(x);
+}
+
+static int builtin_greatestBitPos(int x)
+{
+    return x ? 1u << (31 - __builtin_clz(x)) : 0;
+}
+
+static int builtin_leastBitPos(int x)
+{
+    return x & -(unsigned) x;
+}
+
+static int builtin_bitCount(int x)
+{
+    return __builtin_popcount(x);
+}
+
+static int builtin_bitParity(int x)
+{
+    return __builtin_parity(x);
+}
+
+static int builtin_ilog2(int x)
+{
+    return 31 - __builtin_clz(x);
+}
+
+builtin_rec builtin_set[] = {
+    {"minusOne", (funct_t) builtin_minusOne},
+    {"isZero", (funct_t) builtin_isZero},
+    {"getByte", (funct_t) builtin_getByte},
+    {"negate", (funct_t) builtin_negate},
+    {"addOK", (funct_t) builtin_addOK},
+    {"bitMask", (funct_t) builtin_bitMask},
+    {"absVal", (funct_t) builtin_absVal},
+    {"greatestBitPos", (funct_t) builtin_greatestBitPos},
+    {"leastBitPos", (funct_t) builtin_leastBitPos},
+    {"bitCount", (funct_t) builtin_bitCount},
+    {"bitParity", (funct_t) builtin_bitParity},
+    {"ilog2", (funct_t) builtin_ilog2},
+    {NULL, NULL}
+};
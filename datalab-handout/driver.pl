@@ -148,7 +148,7 @@ unless (system("cp $infile $tmpdir/bits.c") == 0) {
 
 # Copy the various autograding files to the scratch directory
 if ($USE_BTEST) {
-    $driverfiles = "Makefile dlc btest.c decl.c tests.c btest.h bits.h";
+    $driverfiles = "Makefile dlc btest.c decl.c tests.c exhaust.c builtin.c btest.h bits.h";
     unless (system("cp -r $driverfiles $tmpdir") == 0) {
 	clean($tmpdir);
 	die "$0: Could not copy autogradingfiles to $tmpdir.\n";
@@ -0,0 +1,66 @@
+/*
+ * CS:APP Data Lab
+ *
+ * exhaust.c - Block scanners for btest -e, which compare each
+ *             one-argument puzzle with its reference on every argument.
+ *
+ * This file compiles a second copy of bits.c and tests.c, with every
+ * function renamed by exhaust.h (which the Makefile generates from
+ * bits.h) so that it does not clash with the ones btest links. Here
+ * each puzzle and its reference are inlined into a loop over a block
+ * of arguments, which the compiler vectorizes when the puzzle is plain
+ * bit manipulation. A counterexample found here is only a candidate:
+ * btest confirms it with the normally compiled functions.
+ */
+#include <stdio.h>
+#include "btest.h"
+
+/* Arguments checked per block before looking for the first mismatch */
+#define SCAN_BLOCK 4096
+
+#define u2f exhaust_u2f
+#define f2u exhaust_f2u
+
+#define PUZZLE(ret, name, arg)
+#include "exhaust.h"
+#include "bits.c"
+#include "tests.c"
+#undef PUZZLE
+
+/*
+ * scan_<name> - Compare name with test_name on the count arguments
+ * from start up (wrapping around), SCAN_BLOCK at a time. Set *x and
+ * return 1 on the first mismatch, else return 0
+ */
+#define PUZZLE(ret, name, arg)						\
+static int scan_##name(unsigned start, unsigned long long count, unsigned *x) \
+{									\
+    unsigned long long done;						\
+    unsigned n, j, base;						\
+									\
+    for (done = 0; done < count; done += n) {				\
+	int bad = 0;							\
+	base = start + (unsigned) done;					\
+	n = count - done < SCAN_BLOCK ? count - done : SCAN_BLOCK;	\
+	for (j = 0; j < n; j++) {					\
+	    arg a = (arg) (base + j);					\
+	    bad |= name(a) != test_##name(a);				\
+	}								\
+	if (bad) {							\
+	    for (j = 0; j < n; j++)					\
+		if (name((arg) (base + j)) != test_##name((arg) (base + j))) \
+		    break;						\
+	    *x = base + (j < n ? j : 0);				\
+	    return 1;							\
+	}								\
+    }									\
+    return 0;								\
+}
+#include "exhaust.h"
+#undef PUZZLE
+
+#define PUZZLE(ret, name, arg) {#name, scan_##name},
+scan_rec scan_set[] = {
+#include "exhaust.h"
+    {NULL, NULL}
+};
@@ -0,0 +1,516 @@
+/*
+ * capture.c - an LD_PRELOAD shim that records the malloc, calloc,
+ *     realloc and free calls of a real program as a trace that
+ *     mdriver can replay:
+ *
+ *	unix> make capture.so
+ *	unix> MM_CAPTURE=ls.rep LD_PRELOAD=./capture.so ls -l
+ *	unix> ./mdriver -a -v -f ls.rep
+ *
+ * MM_CAPTURE names the trace (capture-%p.rep if it is not set), and
+ * a name ending in .bin gets the binary format of traces/README. A %p
+ * in the name stands for the process id, so that programs which start
+ * others, which inherit LD_PRELOAD, leave one trace per process.
+ *
+ * Each thread logs its calls to a buffer of its own, stamped from one
+ * global atomic counter, and appends the buffer to a raw log when it
+ * fills up, so capture takes no locks. When the program exits the log
+ * is sorted by stamp and turned into a trace: every block gets an id,
+ * frees of blocks that were allocated before capture started are
+ * dropped, and the blocks still live at exit are freed at the end so
+ * that the trace is balanced. Requests for 0 bytes are recorded as 1
+ * byte, which mdriver can replay, and requests for more than 2GB,
+ * which a trace cannot hold, are left out. The memalign family is not
+ * interposed; frees of its blocks are dropped like any unknown free.
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dlfcn.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define CAP_RECORDS 4096    /* records in a thread's buffer */
+#define BOOT_SIZE  (1<<16)  /* bytes handed out while dlsym runs */
+#define BIN_MAGIC  "MLTRACE1"
+#define CAP_NONE   UINT64_MAX  /* the stamp of a call that was not logged */
+#define CAP_MAX_SIZE INT32_MAX /* largest request a trace can hold */
+
+/*
+ * The op types, numbered like the records of a binary trace, and then
+ * CAP_RELEASE, which a realloc logs for its old block before the call
+ */
+enum { CAP_ALLOC, CAP_FREE, CAP_REALLOC, CAP_RELEASE };
+
+/* One logged call */
+typedef struct {
+    uint64_t seq;   /* stamp: the call's place in the global order */
+    uint64_t ptr;   /* block returned, freed or released */
+    uint64_t old;   /* for a realloc, the stamp of its CAP_RELEASE */
+    uint32_t size;  /* bytes requested, UINT32_MAX if more */
+    uint32_t type;  /* CAP_ALLOC, CAP_FREE, CAP_REALLOC or CAP_RELEASE */
+} caprec_t;
+
+/* A thread's buffer of logged calls */
+typedef struct capbuf_t {
+    struct capbuf_t *next;    /* every thread's buffer, for the last flush */
+    int n;                    /* records in rec[] */
+    caprec_t rec[CAP_RECORDS];
+} capbuf_t;
+
+/* One op of the trace being written */
+typedef struct {
+    int type;
+    int id;
+    uint32_t size;
+} capop_t;
+
+/* The calls the shim wraps */
+static void *(*real_malloc)(size_t);
+static void *(*real_calloc)(size_t, size_t);
+static void *(*real_realloc)(void *, size_t);
+static void (*real_free)(void *);
+
+/* Serves dlsym's own allocations before the real calls are known */
+static char boot_buf[BOOT_SIZE] __attribute__((aligned(16)));
+static size_t boot_used;
+
+static uint64_t cap_seq;         /* next stamp */
+static capbuf_t *cap_bufs;       /* list of every thread's buffer */
+static volatile int cap_on;      /* set while calls are being logged */
+static int cap_fd = -1;          /* the raw log */
+static char cap_name[4096];      /* the trace to write */
+static char cap_raw[4200];       /* the raw log's name */
+
+static __thread capbuf_t *cap_buf __attribute__((tls_model("initial-exec")));
+static __thread int cap_busy __attribute__((tls_model("initial-exec")));
+
+static void cap_resolve(void);
+static void *boot_alloc(size_t size);
+static uint64_t cap_log(int type, void *ptr, uint64_t old, size_t size);
+static void cap_stop(void);
+static void cap_convert(void);
+static int cap_cmp(const void *a, const void *b);
+
+/*
+ * cap_start - runs when the shim is loaded: find the real calls, name
+ *     the trace and open the raw log
+ */
+__attribute__((constructor))
+static void cap_start(void)
+{
+    char *name = getenv("MM_CAPTURE");
+    char *s, *d;
+
+    cap_resolve();
+    if (name == NULL || *name == '\0')
+	name = "capture-%p.rep";
+    for (s = name, d = cap_name; *s && d < cap_name + sizeof(cap_name) - 16; s++) {
+	if (s[0] == '%' && s[1] == 'p') {
+	    d += sprintf(d, "%d", (int)getpid());
+	    s++;
+	}
+	else
+	    *d++ = *s;
+    }
+    *d = '\0';
+    sprintf(cap_raw, "%s.%d.raw", cap_name, (int)getpid());
+    cap_fd = open(cap_raw, O_RDWR | O_CREAT | O_TRUNC | O_APPEND, 0644);
+    if (cap_fd < 0) {
+	perror("capture: open");
+	return;
+    }
+    pthread_atfork(NULL, NULL, cap_stop);
+    cap_on = 1;
+}
+
+/*
+ * cap_finish - runs at exit: flush every buffer and write the trace
+ */
+__attribute__((destructor))
+static void cap_finish(void)
+{
+    capbuf_t *b;
+
+    if (!cap_on)
+	return;
+    cap_on = 0;
+    for (b = __atomic_load_n(&cap_bufs, __ATOMIC_ACQUIRE); b; b = b->next)
+	if (b->n && write(cap_fd, b->rec, b->n * sizeof(caprec_t)) < 0)
+	    perror("capture: write");
+    cap_convert();
+    close(cap_fd);
+    unlink(cap_raw);
+}
+
+/*
+ * cap_stop - a forked child that does not exec must neither log to
+ *     its parent's raw log nor write the trace at exit
+ */
+static void cap_stop(void)
+{
+    cap_on = 0;
+}
+
+/*
+ * cap_resolve - look up the real calls. dlsym may allocate, which
+ *     boot_alloc serves until they are known.
+ */
+static void cap_resolve(void)
+{
+    static int resolving;
+
+    if (real_free || resolving)
+	return;
+    resolving = 1;
+    real_malloc = dlsym(RTLD_NEXT, "malloc");
+    real_calloc = dlsym(RTLD_NEXT, "calloc");
+    real_realloc = dlsym(RTLD_NEXT, "realloc");
+    real_free = dlsym(RTLD_NEXT, "free");
+    resolving = 0;
+}
+
+/*
+ * boot_alloc - hand out zeroed memory from boot_buf; it is never freed
+ */
+static void *boot_alloc(size_t size)
+{
+    void *p;
+
+    size = (size + 15) & ~(size_t)15;
+    if (boot_used + size > BOOT_SIZE)
+	return NULL;
+    p = boot_buf + boot_used;
+    boot_used += size;
+    return p;
+}
+
+#define IS_BOOT(p) ((char *)(p) >= boot_buf && (char *)(p) < boot_buf + BOOT_SIZE)
+
+/*
+ * cap_log - stamp a call and append it to the calling thread's buffer,
+ *     writing the buffer to the raw log when it is full. Returns the
+ *     stamp, or CAP_NONE if the call was not logged. A malloc is stamped
+ *     after the real call returns and a free before, so a block is never
+ *     stamped as allocated again before it was freed.
+ */
+static uint64_t cap_log(int type, void *ptr, uint64_t old, size_t size)
+{
+    capbuf_t *b;
+    caprec_t *r;
+
+    if (!cap_on || cap_busy)
+	return CAP_NONE;
+    if ((b = cap_buf) == NULL) {
+	b = mmap(NULL, sizeof(capbuf_t), PROT_READ | PROT_WRITE,
+		 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (b == MAP_FAILED)
+	    return CAP_NONE;
+	b->n = 0;
+	b->next = __atomic_load_n(&cap_bufs, __ATOMIC_RELAXED);
+	while (!__atomic_compare_exchange_n(&cap_bufs, &b->next, b, 1,
+					    __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+	    ;
+	cap_buf = b;
+    }
+    r = &b->rec[b->n];
+    r->seq = __atomic_fetch_add(&cap_seq, 1, __ATOMIC_RELAXED);
+    r->ptr = (uintptr_t)ptr;
+    r->old = old;
+    r->size = size > UINT32_MAX ? UINT32_MAX : size;
+    r->type = type;
+    if (++b->n == CAP_RECORDS) {
+	cap_busy = 1;
+	if (write(cap_fd, b->rec, sizeof(b->rec)) < 0)
+	    perror("capture: write");
+	cap_busy = 0;
+	b->n = 0;
+    }
+    return r->seq;
+}
+
+void *malloc(size_t size)
+{
+    void *p;
+
+    if (real_malloc == NULL) {
+	cap_resolve();
+	if (real_malloc == NULL)
+	    return boot_alloc(size);
+    }
+    p = real_malloc(size);
+    cap_log(CAP_ALLOC, p, 0, size);
+    return p;
+}
+
+void *calloc(size_t nmemb, size_t size)
+{
+    void *p;
+
+    if (real_calloc == NULL) {
+	cap_resolve();
+	if (real_calloc == NULL)
+	    return boot_alloc(nmemb * size);
+    }
+    p = real_calloc(nmemb, size);
+    cap_log(CAP_ALLOC, p, 0, nmemb * size);
+    return p;
+}
+
+/*
+ * realloc - the old block is released before the real call, since
+ *     another thread may be handed its address as soon as it is freed,
+ *     and the result is stamped after, like a malloc
+ */
+void *realloc(void *ptr, size_t size)
+{
+    void *p;
+    uint64_t seq;
+
+    if (real_realloc == NULL) {
+	cap_resolve();
+	if (real_realloc == NULL)
+	    return NULL;
+    }
+    if (IS_BOOT(ptr)) {
+	if ((p = malloc(size)) != NULL)
+	    memcpy(p, ptr, size < (size_t)(boot_buf + BOOT_SIZE - (char *)ptr) ?
+		   size : (size_t)(boot_buf + BOOT_SIZE - (char *)ptr));
+	return p;
+    }
+    if (ptr == NULL)
+	return malloc(size);
+    seq = cap_log(CAP_RELEASE, ptr, 0, 0);
+    p = real_realloc(ptr, size);
+    if (seq != CAP_NONE)
+	cap_log(CAP_REALLOC, p, seq, size);
+    return p;
+}
+
+void free(void *ptr)
+{
+    if (ptr == NULL || IS_BOOT(ptr))
+	return;
+    if (real_free == NULL)
+	cap_resolve();
+    cap_log(CAP_FREE, ptr, 0, 0);
+    real_free(ptr);
+}
+
+/*
+ * The blocks that are live while the log is converted, as an open
+ * addressing hash table from address to id
+ */
+static uint64_t *live_key;
+static int *live_id;
+static size_t live_mask;
+#define LIVE_EMPTY 0
+#define LIVE_GONE  1    /* a removed entry; no block lives at address 1 */
+
+static size_t live_slot(uint64_t ptr)
+{
+    size_t h = (ptr >> 4) * 0x9E3779B97F4A7C15ull;
+    size_t gone = (size_t)-1;
+
+    for (h &= live_mask; live_key[h] != LIVE_EMPTY; h = (h + 1) & live_mask) {
+	if (live_key[h] == ptr)
+	    return h;
+	if (live_key[h] == LIVE_GONE && gone == (size_t)-1)
+	    gone = h;
+    }
+    return gone != (size_t)-1 ? gone : h;
+}
+
+/*
+ * cap_convert - sort the raw log by stamp and write it out as a trace
+ */
+static void cap_convert(void)
+{
+    struct stat st;
+    caprec_t *rec, key;
+    capop_t *ops = NULL;
+    uint32_t *cur = NULL;
+    size_t i, n, nops = 0, h, g, dropped = 0;
+    int nids = 0, id, bin, len;
+    double live = 0, peak = 0;
+    FILE *fp;
+
+    if (fstat(cap_fd, &st) < 0 || (n = st.st_size / sizeof(caprec_t)) == 0)
+	return;
+    rec = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, cap_fd, 0);
+    if (rec == MAP_FAILED) {
+	perror("capture: mmap");
+	return;
+    }
+    qsort(rec, n, sizeof(caprec_t), cap_cmp);
+
+    for (live_mask = 1; live_mask < 2 * n; live_mask <<= 1)
+	;
+    live_key = calloc(live_mask, sizeof(uint64_t));
+    live_id = malloc(live_mask * sizeof(int));
+    live_mask--;
+    ops = malloc(2 * n * sizeof(capop_t));
+    cur = malloc(n * sizeof(uint32_t));
+    if (!live_key || !live_id || !ops || !cur) {
+	fprintf(stderr, "capture: out of memory converting %s\n", cap_raw);
+	goto done;
+    }
+
+#define EMIT(t, i, s) (ops[nops].type = (t), ops[nops].id = (i), \
+		       ops[nops++].size = (s))
+    for (i = 0; i < n; i++) {
+	caprec_t *r = &rec[i], *rel = NULL;
+	uint32_t size = r->size ? r->size : 1;
+
+	/* 
+	 * A release takes the old block out of the table, and keeps its
+	 * id + 1 (0 if unknown) in old for the realloc that completes it
+	 */
+	if (r->type == CAP_RELEASE) {
+	    h = live_slot(r->ptr);
+	    r->old = 0;
+	    if (live_key[h] > LIVE_GONE) {
+		r->old = live_id[h] + 1;
+		live_key[h] = LIVE_GONE;
+	    }
+	    continue;
+	}
+
+	id = -1;
+	if (r->type == CAP_REALLOC) {
+	    key.seq = r->old;
+	    if ((rel = bsearch(&key, rec, i, sizeof(caprec_t), cap_cmp)) != NULL) {
+		id = (int)rel->old - 1;
+		rel->old = 0;
+	    }
+	    if (r->ptr == 0) {
+		if (id < 0)
+		    continue;
+		if (r->size == 0) {
+		    /* realloc(p, 0) freed the block */
+		    EMIT(CAP_FREE, id, 0);
+		    live -= cur[id];
+		}
+		else {
+		    /* the call failed and the old block is still there */
+		    g = live_slot(rel->ptr);
+		    live_key[g] = rel->ptr;
+		    live_id[g] = id;
+		}
+		continue;
+	    }
+	}
+	else if (r->type == CAP_FREE) {
+	    h = live_slot(r->ptr);
+	    if (live_key[h] > LIVE_GONE) {
+		EMIT(CAP_FREE, live_id[h], 0);
+		live -= cur[live_id[h]];
+		live_key[h] = LIVE_GONE;
+	    }
+	    continue;
+	}
+	else if (r->ptr == 0)
+	    continue; /* the call failed */
+
+	/* A trace cannot hold the request, so the block is left out */
+	if (r->size > CAP_MAX_SIZE) {
+	    if (id >= 0) {
+		EMIT(CAP_FREE, id, 0);
+		live -= cur[id];
+	    }
+	    dropped++;
+	    continue;
+	}
+
+	/* A block at this address that looks live lost its free to a race */
+	g = live_slot(r->ptr);
+	if (live_key[g] > LIVE_GONE) {
+	    EMIT(CAP_FREE, live_id[g], 0);
+	    live -= cur[live_id[g]];
+	}
+	if (id < 0) {
+	    id = nids++;
+	    EMIT(CAP_ALLOC, id, size);
+	    cur[id] = 0;
+	}
+	else
+	    EMIT(CAP_REALLOC, id, size);
+	live += (double)size - cur[id];
+	cur[id] = size;
+	if (live > peak)
+	    peak = live;
+	live_key[g] = r->ptr;
+	live_id[g] = id;
+    }
+
+    /* 
+     * Free what is still live, and what was released by a realloc that
+     * had not returned when the log ended, so that the trace is balanced
+     */
+    for (h = 0; h <= live_mask; h++)
+	if (live_key[h] > LIVE_GONE)
+	    EMIT(CAP_FREE, live_id[h], 0);
+    for (i = 0; i < n; i++)
+	if (rec[i].type == CAP_RELEASE && rec[i].old)
+	    EMIT(CAP_FREE, (int)rec[i].old - 1, 0);
+#undef EMIT
+
+    len = strlen(cap_name);
+    bin = len > 4 && !strcmp(cap_name + len - 4, ".bin");
+    if ((fp = fopen(cap_name, bin ? "wb" : "w")) == NULL) {
+	perror("capture: fopen");
+	goto done;
+    }
+    if (peak > INT32_MAX)
+	peak = INT32_MAX;  /* the header holds 32 bits, and mdriver ignores it */
+    if (bin) {
+	int32_t hdr[4] = { (int32_t)peak, nids, nops, 1 };
+
+	fwrite(BIN_MAGIC, 1, strlen(BIN_MAGIC), fp);
+	fwrite(hdr, sizeof(hdr), 1, fp);
+	for (i = 0; i < nops; i++) {
+	    int32_t op[3] = { ops[i].type, ops[i].id, ops[i].size };
+	    fwrite(op, sizeof(op), 1, fp);
+	}
+    }
+    else {
+	fprintf(fp, "%.0f\n%d\n%lu\n1\n", peak, nids, (unsigned long)nops);
+	for (i = 0; i < nops; i++) {
+	    if (ops[i].type == CAP_FREE)
+		fprintf(fp, "f %d\n", ops[i].id);
+	    else
+		fprintf(fp, "%c %d %u\n", ops[i].type == CAP_ALLOC ? 'a' : 'r',
+			ops[i].id, ops[i].size);
+	}
+    }
+    fclose(fp);
+    fprintf(stderr, "capture: wrote %lu ops on %d blocks to %s\n",
+	    (unsigned long)nops, nids, cap_name);
+    if (dropped)
+	fprintf(stderr, "capture: left out %lu requests of more than %d bytes\n",
+		(unsigned long)dropped, CAP_MAX_SIZE);
+
+ done:
+    munmap(rec, st.st_size);
+    free(live_key);
+    free(live_id);
+    free(ops);
+    free(cur);
+    live_key = NULL;
+    live_id = NULL;
+}
+
+/*
+ * cap_cmp - qsort comparison that orders records by stamp
+ */
+static int cap_cmp(const void *a, const void *b)
+{
+    uint64_t x = ((const caprec_t *)a)->seq, y = ((const caprec_t *)b)->seq;
+
+    return x < y ? -1 : x > y;
+}
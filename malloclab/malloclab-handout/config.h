@@ -60,11 +60,24 @@
  */
 #define MAX_HEAP (2000*(1<<20))  /* 2000 MB */
 
+/*
+ * Set MEM_USE_MMAP to "1" to model the heap with reserved address
+ * space whose pages memlib.c commits as the heap grows and gives back
+ * to the system when it shrinks, or to "0" for one malloc'd block
+ * whose pages stay resident when the brk moves down. Giving pages back
+ * means the next run faults them in again, which the throughput
+ * numbers include. MEM_HUGEPAGES asks for transparent huge pages for
+ * the mmap'd heap.
+ */
+#define MEM_USE_MMAP     0
+#define MEM_HUGEPAGES    0
+#define MEM_COMMIT_SIZE  (1<<20)  /* pages are committed in steps this big */
+
 /*****************************************************************************
  * Set exactly one of these USE_xxx constants to "1" to select a timing method
  *****************************************************************************/
-#define USE_FCYC   0   /* cycle counter w/K-best scheme (x86 & Alpha only) */
+#define USE_FCYC   1   /* common/clock.c timer w/K-best scheme (any box) */
 #define USE_ITIMER 0   /* interval timer (any Unix box) */
-#define USE_GETTOD 1   /* gettimeofday (any Unix box) */
+#define USE_GETTOD 0   /* gettimeofday (any Unix box) */
 
 #endif /* __CONFIG_H */
@@ -10,6 +10,11 @@
 
 static double Mhz;  /* estimated CPU clock frequency */
 
+#define FTIMER_RUNS 10      /* runs of f that the ftimer versions average */
+
+static int perf = 0;        /* read the performance counters too */
+static perf_counts_t counts;/* counters of one run of f in the last fsecs */
+
 extern int verbose; /* -v option in mdriver.c */
 
 /*
@@ -21,7 +26,7 @@ void init_fsecs(void)
 
 #if USE_FCYC
     if (verbose)
-	printf("Measuring performance with a cycle counter.\n");
+	printf("Measuring performance with a cycle counter (%s).\n", timer_name());
 
     /* set key parameters for the fcyc package */
     set_fcyc_maxsamples(20); 
@@ -39,6 +44,21 @@ void init_fsecs(void)
 #endif
 }
 
+/*
+ * init_fsecs_perf - also read the performance counters (perfctr.h)
+ *     whenever fsecs times a function. Returns how many counters
+ *     there are.
+ */
+int init_fsecs_perf(void)
+{
+#if USE_FCYC
+    perf = set_fcyc_perf(1);
+#else
+    perf = perf_init();
+#endif
+    return perf;
+}
+
 /*
  * fsecs - Return the running time of a function f (in seconds)
  */
@@ -46,12 +66,36 @@ double fsecs(fsecs_test_funct f, void *argp)
 {
 #if USE_FCYC
     double cycles = fcyc(f, argp);
+    if (perf)
+	fcyc_perf_counts(&counts);
     return cycles/(Mhz*1e6);
-#elif USE_ITIMER
-    return ftimer_itimer(f, argp, 10);
+#else
+    double secs;
+    int i;
+
+    if (perf)
+	perf_start();
+#if USE_ITIMER
+    secs = ftimer_itimer(f, argp, FTIMER_RUNS);
 #elif USE_GETTOD
-    return ftimer_gettod(f, argp, 10);
+    secs = ftimer_gettod(f, argp, FTIMER_RUNS);
 #endif 
+    if (perf) {
+	perf_stop(&counts);
+	for (i = 0; i < PERF_NEVENTS; i++)
+	    counts.count[i] /= FTIMER_RUNS;
+    }
+    return secs;
+#endif
+}
+
+/*
+ * fsecs_perf_counts - the counters of one run of f in the last fsecs,
+ *     if init_fsecs_perf found any
+ */
+void fsecs_perf_counts(perf_counts_t *c)
+{
+    *c = counts;
 }
 
 
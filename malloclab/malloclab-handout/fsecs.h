@@ -1,4 +1,8 @@
+#include "perfctr.h"
+
 typedef void (*fsecs_test_funct)(void *);
 
 void init_fsecs(void);
 double fsecs(fsecs_test_funct f, void *argp);
+int init_fsecs_perf(void);
+void fsecs_perf_counts(perf_counts_t *c);
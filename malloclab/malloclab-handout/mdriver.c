@@ -9,6 +9,7 @@
  */
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
 #include <unistd.h>
 #include <errno.h>
 #include <string.h>
@@ -16,9 +17,15 @@
 #include <float.h>
 #include <time.h>
 #include <ctype.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include "mm.h"
 #include "memlib.h"
 #include "fsecs.h"
+#include "bench.h"
+#include "clock.h"
 #include "config.h"
 
 /**********************
@@ -29,6 +36,8 @@
 #define MAXLINE     1024 /* max string size */
 #define HDRLINES       4 /* number of header lines in a trace file */
 #define LINENUM(i) (i+5) /* cnvt trace request nums to linenums (origin 1) */
+#define BIN_MAGIC  "MLTRACE1" /* first bytes of a binary trace file */
+#define BIN_MAGIC_LEN       8
 
 /* Returns true if p is ALIGNMENT-byte aligned */
 #define IS_ALIGNED(p)  ((((unsigned int)(p)) % ALIGNMENT) == 0)
@@ -36,15 +45,37 @@
 //Heap size is allowed to be 65536 for free, since this is paltry
 #define FREE_HEAP 65536
 
+/* Multithreaded replay (-T) */
+#define MAX_THREADS  64  /* most threads -T accepts */
+#define SCALE_REPS    3  /* each replay is timed this many times; best is kept */
+
+/* Per-op latency histograms (-L): each power of two of cycles is split
+   into 1<<LAT_SUB_BITS equal buckets, so a bucket is within 12.5% */
+#define LAT_SUB_BITS  3
+#define LAT_BUCKETS   (64 << LAT_SUB_BITS)
+#define NUM_OPTYPES   3  /* ALLOC, FREE, REALLOC */
+
+/* Trace profiles (-P) */
+#define PROF_BUCKETS 32  /* power-of-two buckets for sizes and lifetimes */
+#define PROF_POINTS  16  /* samples of the live bytes curve */
+#define PROF_CLASSES  6  /* size classes to suggest, as many as mm.c has */
+#define PROF_BAR     40  /* width of the live bytes bar at the peak */
+
 /****************************** 
  * The key compound data types 
  *****************************/
 
-/* Records the extent of each block's payload */
+/* 
+ * Records the extent of each block's payload. The ranges form a treap:
+ * a binary search tree on lo that is also a max-heap on the random prio,
+ * which keeps it balanced, so checks and updates cost O(log n). 
+ */
 typedef struct range_t {
     char *lo;              /* low payload address */
     char *hi;              /* high payload address */
-    struct range_t *next;  /* next list element */
+    unsigned prio;         /* random heap priority */
+    struct range_t *left;  /* ranges below lo */
+    struct range_t *right; /* ranges above hi */
 } range_t;
 
 /* Characterizes a single trace operation (allocator request) */
@@ -63,8 +94,23 @@ typedef struct {
     traceop_t *ops;      /* array of requests */
     char **blocks;       /* array of ptrs returned by malloc/realloc... */
     size_t *block_sizes; /* ... and a corresponding array of payload sizes */
+    void *map;           /* mapping ops points into, for binary traces */
+    size_t map_size;     /* its length in bytes */
 } trace_t;
 
+/* 
+ * Header of a binary trace file (see traces/README), made by 
+ * traces/rep2bin.pl. It is followed by num_ops packed traceop_t 
+ * records, which read_trace maps in place of parsing them.
+ */
+typedef struct {
+    char magic[BIN_MAGIC_LEN]; /* BIN_MAGIC */
+    int sugg_heapsize;
+    int num_ids;
+    int num_ops;
+    int weight;
+} binhdr_t;
+
 /* 
  * Holds the params to the xxx_speed functions, which are timed by fcyc. 
  * This struct is necessary because fcyc accepts only a pointer array
@@ -75,6 +121,30 @@ typedef struct {
     range_t *ranges;
 } speed_t;
 
+/* Holds the params of one thread of a multithreaded replay (-T) */
+typedef struct {
+    trace_t trace;             /* shares ops[] but has its own blocks[] */
+    int use_mm;                /* replay with mm.c (1) or libc (0) */
+    pthread_barrier_t *start;  /* released when every thread is ready */
+    tick_t t0, t1;             /* when this thread's replay started and ended */
+} replay_t;
+
+/* Summarizes a multithreaded replay of every trace at one thread count */
+typedef struct {
+    int threads;     /* number of threads, each replaying every trace */
+    double ops;      /* ops summed over threads and traces */
+    double secs;     /* wall clock secs summed over traces */
+    double lat;      /* mean secs per op of the average thread */
+    double max_lat;  /* mean secs per op of the slowest thread */
+} scale_t;
+
+/* Counts how many ops of one type took how many cycles */
+typedef struct {
+    double count;                 /* number of ops recorded */
+    double max;                   /* slowest op (cycles) */
+    unsigned buckets[LAT_BUCKETS];
+} hist_t;
+
 /* Summarizes the important stats for some malloc function on some trace */
 typedef struct {
     char* filename;
@@ -88,6 +158,9 @@ typedef struct {
 
     /* defined only for the student malloc package */
     double util;     /* space utilization for this trace (always 0 for libc) */
+    hist_t *lat;     /* per op type latencies, if measured (-L) */
+    perf_counts_t perf; /* counters of one run of the trace, if read (-c) */
+    bench_result_t stats; /* median secs and their CI, if timed so (-S) */
 
     /* Note: secs and util are only defined if valid is true */
 } stats_t; 
@@ -96,12 +169,17 @@ typedef struct {
  * Global variables
  *******************/
 int verbose = 0;        /* global flag for verbose output */
+static int run_stats = 0; /* time with the harness in bench.h (-S) */
+static int run_perf = 0;  /* read the performance counters (-c) */
 static int errors = 0;  /* number of errs found when running student malloc */
 char msg[MAXLINE];      /* for whenever we need to compose an error message */
 
 /* Directory where default tracefiles are found */
 static char tracedir[MAXLINE] = TRACEDIR;
 
+/* Names of the op types, indexed like traceop_t's type, for -L / -o */
+static char *optype_names[NUM_OPTYPES] = { "malloc", "free", "realloc" };
+
 /* The filenames of the default tracefiles */
 static char *default_tracefiles[] = {  
     DEFAULT_TRACEFILES, NULL
@@ -112,14 +190,17 @@ static char *default_tracefiles[] = {
  * Function prototypes 
  *********************/
 
-/* these functions manipulate range lists */
+/* these functions manipulate range trees */
 static int add_range(range_t **ranges, char *lo, int size, 
 		     int tracenum, int opnum);
 static void remove_range(range_t **ranges, char *lo);
 static void clear_ranges(range_t **ranges);
+static range_t *insert_range(range_t *root, range_t *p);
+static range_t *merge_ranges(range_t *left, range_t *right);
 
 /* These functions read, allocate, and free storage for traces */
 static trace_t *read_trace(char *tracedir, char *filename);
+static void map_trace(trace_t *trace, FILE *tracefile, char *path);
 static void free_trace(trace_t *trace);
 
 /* Routines for evaluating the correctness and speed of libc malloc */
@@ -131,9 +212,36 @@ static void eval_libc_speed(void *ptr);
 static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges);
 static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges, int* ideal_m, int* m);
 static void eval_mm_speed(void *ptr);
+static void replay_mm(trace_t *trace);
+static hist_t *eval_mm_lat(trace_t *trace);
+
+/* These functions build and summarize latency histograms */
+static void hist_add(hist_t *hist, double cycles);
+static double hist_percentile(hist_t *hist, double p);
+
+/* Routines for the multithreaded replay of both packages (-T) */
+static void *replay_thread(void *ptr);
+static double eval_threads(trace_t *trace, int threads, int use_mm, 
+			   double *lat, double *max_lat);
+static void eval_scaling(char **tracefiles, int n, int max_threads, 
+			 int use_mm);
+
+/* Routines for profiling a trace without running it (-P) */
+static void profile_trace(trace_t *trace, char *filename);
+static int suggest_classes(int *reqs, int nreqs, int *bound);
+static int log2_bucket(unsigned n);
+static int intcmp(const void *a, const void *b);
 
 /* Various helper routines */
 static void printresults(int n, stats_t *stats);
+static void printscaling(int n, scale_t *scale);
+static void printlatency(int n, stats_t *stats);
+static void printcounters(int n, stats_t *stats);
+static double time_trace(char *kind, fsecs_test_funct f, speed_t *params, 
+			 stats_t *stats);
+static void stats_name(char *name, char *kind, stats_t *stats);
+static void record_stats(char *kind, int n, stats_t *stats);
+static void writelatency(char *filename, int n, stats_t *stats);
 static void usage(void);
 static void unix_error(char *msg);
 static void malloc_error(int tracenum, int opnum, char *msg);
@@ -157,6 +265,13 @@ int main(int argc, char **argv)
     int team_check = 1;  /* If set, check team structure (reset by -a) */
     int run_libc = 0;    /* If set, run libc malloc (set by -l) */
     int autograder = 0;  /* If set, emit summary info for autograder (-g) */
+    int max_threads = 0; /* If set, replay on up to this many threads (-T) */
+    int run_lat = 0;     /* If set, measure per-op latencies (set by -L) */
+    char *lat_file = NULL; /* If set, write the latencies here (-o) */
+    int run_profile = 0; /* If set, profile the traces instead (-P) */
+    int calibrate = 0;   /* If set, compare with libc on this machine (-B) */
+    char *history_file = NULL; /* If set, compare with and add to it (-H) */
+    double threshold = 5;  /* regression threshold in percent (-R) */
 
     /* temporaries used to compute the performance index */
     double secs, ops, util, avg_mm_util, avg_mm_throughput, perfindex;//, p1, p2;
@@ -165,7 +280,7 @@ int main(int argc, char **argv)
     /* 
      * Read and interpret the command line arguments 
      */
-    while ((c = getopt(argc, argv, "f:t:hvVgal")) != EOF) {
+    while ((c = getopt(argc, argv, "f:t:hvVgalT:Lo:PcSBH:R:")) != EOF) {
         switch (c) {
 	case 'g': /* Generate summary info for the autograder */
 	    autograder = 1;
@@ -191,6 +306,40 @@ int main(int argc, char **argv)
         case 'l': /* Run libc malloc */
             run_libc = 1;
             break;
+        case 'T': /* Multithreaded replay on 1 up to optarg threads */
+            max_threads = atoi(optarg);
+            if (max_threads < 1 || max_threads > MAX_THREADS) {
+                printf("ERROR: -T takes 1 to %d threads\n", MAX_THREADS);
+                exit(1);
+            }
+            break;
+        case 'L': /* Measure per-op latencies */
+            run_lat = 1;
+            break;
+        case 'o': /* Write the latencies as CSV, or JSON for *.json */
+            run_lat = 1;
+            lat_file = strdup(optarg);
+            break;
+        case 'P': /* Profile the traces instead of running them */
+            run_profile = 1;
+            break;
+        case 'c': /* Read the performance counters while timing */
+            run_perf = 1;
+            break;
+        case 'S': /* Time the traces with the statistical harness */
+            run_stats = 1;
+            break;
+        case 'B': /* Measure libc on this machine for a baseline */
+            calibrate = 1;
+            run_libc = 1;
+            break;
+        case 'H': /* History file to compare with and append to */
+            history_file = strdup(optarg);
+            run_stats = 1;
+            break;
+        case 'R': /* Regression threshold in percent */
+            threshold = atof(optarg);
+            break;
         case 'v': /* Print per-trace performance breakdown */
             verbose = 1;
             break;
@@ -245,6 +394,11 @@ int main(int argc, char **argv)
 	//    printf("Member 2 :%s:%s\n", team.name2, team.id2);
     }
 
+#ifdef BUILD_TAG
+    /* The build configuration, from common/report.pl */
+    printf("Build: %s\n", BUILD_TAG);
+#endif
+
     /* 
      * If no -f command line arg, then use the entire set of tracefiles 
      * defined in default_traces[]
@@ -255,8 +409,26 @@ int main(int argc, char **argv)
 	//printf("Using default tracefiles in %s\n", tracedir);
     }
 
+    /* Profile the traces instead of running them */
+    if (run_profile) {
+	for (i = 0; i < num_tracefiles; i++) {
+	    trace = read_trace(tracedir, tracefiles[i]);
+	    profile_trace(trace, tracefiles[i]);
+	    free_trace(trace);
+	}
+	exit(0);
+    }
+
     /* Initialize the timing package */
     init_fsecs();
+    if (run_perf && init_fsecs_perf() == 0) {
+	printf("No performance counters available, ignoring -c\n");
+	run_perf = 0;
+    }
+    if (run_stats && bench_pin(-1) < 0)
+	printf("Could not pin to a CPU, timing unpinned\n");
+    if (history_file)
+	bench_history(history_file, threshold/100);
 
     /*
      * Optionally run and evaluate the libc malloc package 
@@ -282,7 +454,8 @@ int main(int argc, char **argv)
 		speed_params.trace = trace;
 		if (verbose > 1)
 		    printf("and performance.\n");
-		libc_stats[i].secs = fsecs(eval_libc_speed, &speed_params);
+		libc_stats[i].secs = time_trace("libc", eval_libc_speed, 
+						&speed_params, &libc_stats[i]);
 	    }
 	    free_trace(trace);
 	}
@@ -292,6 +465,10 @@ int main(int argc, char **argv)
 	    printf("\nResults for libc malloc:\n");
 	    printresults(num_tracefiles, libc_stats);
 	}
+	if (run_perf) {
+	    printf("\nCounters for libc malloc (per op):\n");
+	    printcounters(num_tracefiles, libc_stats);
+	}
     }
 
     /*
@@ -328,7 +505,13 @@ int main(int argc, char **argv)
 	    speed_params.ranges = ranges;
 	    if (verbose > 1)
 		printf("and performance.\n");
-	    mm_stats[i].secs = fsecs(eval_mm_speed, &speed_params);
+	    mm_stats[i].secs = time_trace("mm", eval_mm_speed, &speed_params, 
+					  &mm_stats[i]);
+	    if (run_lat) {
+		if (verbose > 1)
+		    printf("Measuring per-op latencies.\n");
+		mm_stats[i].lat = eval_mm_lat(trace);
+	    }
 	}
 	free_trace(trace);
     }
@@ -340,6 +523,22 @@ int main(int argc, char **argv)
 	printf("\n");
     }
 
+    /* Display the performance counters */
+    if (run_perf) {
+	printf("Counters for mm malloc (per op):\n");
+	printcounters(num_tracefiles, mm_stats);
+	printf("\n");
+    }
+
+    /* Display and save the per-op latencies */
+    if (run_lat) {
+	printf("Latencies for mm malloc (cycles):\n");
+	printlatency(num_tracefiles, mm_stats);
+	printf("\n");
+	if (lat_file)
+	    writelatency(lat_file, num_tracefiles, mm_stats);
+    }
+
     /* 
      * Accumulate the aggregate statistics for the student's mm package 
      */
@@ -395,25 +594,66 @@ int main(int argc, char **argv)
 	printf("perfidx:%.0f\n", perfindex);
     }
 
+    /* Compare the throughput with libc's on this machine */
+    if (calibrate && errors == 0) {
+	double libc_secs = 0, libc_ops = 0;
+
+	for (i = 0; i < num_tracefiles; i++) {
+	    if (!libc_stats[i].valid)
+		continue;
+	    libc_secs += libc_stats[i].secs;
+	    libc_ops += libc_stats[i].ops;
+	}
+	if (libc_secs > 0)
+	    printf("Throughput = %.0f Kops (mm) / %.0f Kops (libc on this "
+		   "machine) = %.2f\n", ops/1000/secs, libc_ops/1000/libc_secs,
+		   (ops/secs) / (libc_ops/libc_secs));
+    }
+
+    /* Compare with the history, and fail on a regression */
+    if (history_file) {
+	if (run_libc)
+	    record_stats("libc", num_tracefiles, libc_stats);
+	record_stats("mm", num_tracefiles, mm_stats);
+	if (bench_save(history_file, "malloclab mdriver", threshold/100) != 0)
+	    exit(1);
+    }
+
+    /*
+     * Optionally measure how throughput scales with the number of threads
+     */
+    if (max_threads && errors == 0) {
+	bench_unpin();  /* the replay threads inherit the pin of -S */
+	if (run_libc)
+	    eval_scaling(tracefiles, num_tracefiles, max_threads, 0);
+#ifdef MM_THREADS
+	eval_scaling(tracefiles, num_tracefiles, max_threads, 1);
+#else
+	printf("\nmm.c was built without MM_THREADS; "
+	       "use mdriver-mt to replay mm malloc on several threads\n");
+#endif
+    }
+
     exit(0);
 }
 
 
 /*****************************************************************
- * The following routines manipulate the range list, which keeps 
+ * The following routines manipulate the range tree, which keeps 
  * track of the extent of every allocated block payload. We use the 
- * range list to detect any overlapping allocated blocks.
+ * range tree to detect any overlapping allocated blocks.
  ****************************************************************/
 
 /*
  * add_range - As directed by request opnum in trace tracenum,
  *     we've just called the student's mm_malloc to allocate a block of 
  *     size bytes at addr lo. After checking the block for correctness,
- *     we create a range struct for this block and add it to the range list. 
+ *     we create a range struct for this block and add it to the range tree. 
  */
 static int add_range(range_t **ranges, char *lo, int size, 
 		     int tracenum, int opnum)
 {
+    static unsigned seed = 1; /* for the treap priorities */
     char *hi = lo + size - 1;
     range_t *p;
     char msg[MAXLINE];
@@ -428,19 +668,28 @@ static int add_range(range_t **ranges, char *lo, int size,
         return 0;
     }
 
-    /* The payload must lie within the extent of the heap */
-    if ((lo < (char *)mem_heap_lo()) || (lo > (char *)mem_heap_hi()) || 
-	(hi < (char *)mem_heap_lo()) || (hi > (char *)mem_heap_hi())) {
-	sprintf(msg, "Payload (%p:%p) lies outside heap (%p:%p)",
+    /* The payload must lie within the extent of the heap, or within
+       a region the allocator got from mem_map */
+    if (((lo < (char *)mem_heap_lo()) || (lo > (char *)mem_heap_hi()) || 
+	 (hi < (char *)mem_heap_lo()) || (hi > (char *)mem_heap_hi())) &&
+	!mem_is_mapped(lo, hi)) {
+	sprintf(msg, "Payload (%p:%p) lies outside heap (%p:%p) and mapped regions",
 		lo, hi, mem_heap_lo(), mem_heap_hi());
 	malloc_error(tracenum, opnum, msg);
         return 0;
     }
 
-    /* The payload must not overlap any other payloads */
-    for (p = *ranges;  p != NULL;  p = p->next) {
-        if ((lo >= p->lo && lo <= p-> hi) ||
-            (hi >= p->lo && hi <= p->hi)) {
+    /* 
+     * The payload must not overlap any other payloads. The ranges in 
+     * the tree are disjoint, so any one that overlaps [lo,hi] lies on 
+     * the search path for it.
+     */
+    for (p = *ranges;  p != NULL; ) {
+	if (hi < p->lo)
+	    p = p->left;
+	else if (lo > p->hi)
+	    p = p->right;
+	else {
 	    sprintf(msg, "Payload (%p:%p) overlaps another payload (%p:%p)\n",
 		    lo, hi, p->lo, p->hi);
 	    malloc_error(tracenum, opnum, msg);
@@ -450,17 +699,68 @@ static int add_range(range_t **ranges, char *lo, int size,
 
     /* 
      * Everything looks OK, so remember the extent of this block 
-     * by creating a range struct and adding it the range list.
+     * by creating a range struct and adding it the range tree.
      */
     if ((p = (range_t *)malloc(sizeof(range_t))) == NULL)
 	unix_error("malloc error in add_range");
-    p->next = *ranges;
     p->lo = lo;
     p->hi = hi;
-    *ranges = p;
+    seed = seed * 1103515245 + 12345;
+    p->prio = seed;
+    p->left = p->right = NULL;
+    *ranges = insert_range(*ranges, p);
     return 1;
 }
 
+/*
+ * insert_range - Insert p into the tree at root as a leaf, rotating it 
+ *     up while its priority beats its parent's; return the new root
+ */
+static range_t *insert_range(range_t *root, range_t *p)
+{
+    range_t *q;
+
+    if (root == NULL)
+	return p;
+    if (p->lo < root->lo) {
+	root->left = insert_range(root->left, p);
+	if (root->left->prio > root->prio) { /* rotate right */
+	    q = root->left;
+	    root->left = q->right;
+	    q->right = root;
+	    root = q;
+	}
+    }
+    else {
+	root->right = insert_range(root->right, p);
+	if (root->right->prio > root->prio) { /* rotate left */
+	    q = root->right;
+	    root->right = q->left;
+	    q->left = root;
+	    root = q;
+	}
+    }
+    return root;
+}
+
+/*
+ * merge_ranges - Join two trees whose ranges all lie below (left) and 
+ *     above (right) each other; return the root of the result
+ */
+static range_t *merge_ranges(range_t *left, range_t *right)
+{
+    if (left == NULL)
+	return right;
+    if (right == NULL)
+	return left;
+    if (left->prio > right->prio) {
+	left->right = merge_ranges(left->right, right);
+	return left;
+    }
+    right->left = merge_ranges(left, right->left);
+    return right;
+}
+
 /* 
  * remove_range - Free the range record of block whose payload starts at lo 
  */
@@ -468,16 +768,12 @@ static void remove_range(range_t **ranges, char *lo)
 {
     range_t *p;
     range_t **prevpp = ranges;
-    //int size;
 
-    for (p = *ranges;  p != NULL; p = p->next) {
-        if (p->lo == lo) {
-	    *prevpp = p->next;
-            //size = p->hi - p->lo + 1;
-            free(p);
-            break;
-        }
-        prevpp = &(p->next);
+    for (p = *ranges;  p != NULL && p->lo != lo; p = *prevpp)
+	prevpp = (lo < p->lo) ? &p->left : &p->right;
+    if (p != NULL) {
+	*prevpp = merge_ranges(p->left, p->right);
+	free(p);
     }
 }
 
@@ -486,13 +782,13 @@ static void remove_range(range_t **ranges, char *lo)
  */
 static void clear_ranges(range_t **ranges)
 {
-    range_t *p;
-    range_t *pnext;
+    range_t *p = *ranges;
 
-    for (p = *ranges;  p != NULL;  p = pnext) {
-        pnext = p->next;
-        free(p);
-    }
+    if (p == NULL)
+	return;
+    clear_ranges(&p->left);
+    clear_ranges(&p->right);
+    free(p);
     *ranges = NULL;
 }
 
@@ -528,6 +824,16 @@ static trace_t *read_trace(char *tracedir, char *filename)
 	sprintf(msg, "Could not open %s in read_trace", path);
 	unix_error(msg);
     }
+    /* Binary traces are mapped rather than parsed */
+    trace->map = NULL;
+    if (fread(type, 1, BIN_MAGIC_LEN, tracefile) == BIN_MAGIC_LEN &&
+	!memcmp(type, BIN_MAGIC, BIN_MAGIC_LEN)) {
+	map_trace(trace, tracefile, path);
+	fclose(tracefile);
+	return trace;
+    }
+    rewind(tracefile);
+
     fscanf(tracefile, "%d", &(trace->sugg_heapsize)); /* not used */
     fscanf(tracefile, "%d", &(trace->num_ids));     
     fscanf(tracefile, "%d", &(trace->num_ops));     
@@ -587,13 +893,70 @@ static trace_t *read_trace(char *tracedir, char *filename)
     return trace;
 }
 
+/*
+ * map_trace - Map the binary trace in tracefile, whose ops array is 
+ *     then used in place, and allocate the blocks arrays for it
+ */
+static void map_trace(trace_t *trace, FILE *tracefile, char *path)
+{
+    struct stat st;
+    binhdr_t *hdr;
+    int i;
+
+    assert(sizeof(traceop_t) == 3 * sizeof(int));
+    if (fstat(fileno(tracefile), &st) < 0 || (size_t)st.st_size < sizeof(binhdr_t)) {
+	sprintf(msg, "Truncated binary trace %s", path);
+	app_error(msg);
+    }
+    trace->map_size = st.st_size;
+    trace->map = mmap(NULL, trace->map_size, PROT_READ, MAP_PRIVATE, 
+		      fileno(tracefile), 0);
+    if (trace->map == MAP_FAILED) {
+	sprintf(msg, "Could not mmap %s in read_trace", path);
+	unix_error(msg);
+    }
+    hdr = (binhdr_t *)trace->map;
+    trace->sugg_heapsize = hdr->sugg_heapsize; /* not used */
+    trace->num_ids = hdr->num_ids;
+    trace->num_ops = hdr->num_ops;
+    trace->weight = hdr->weight;               /* not used */
+    trace->ops = (traceop_t *)(hdr + 1);
+    if (trace->num_ids <= 0 || trace->num_ops < 0 || 
+	trace->map_size != sizeof(binhdr_t) + 
+	(size_t)trace->num_ops * sizeof(traceop_t)) {
+	sprintf(msg, "Bad header in binary trace %s", path);
+	app_error(msg);
+    }
+
+    /* Check every request, since nothing parsed them */
+    for (i = 0; i < trace->num_ops; i++) {
+	if ((unsigned)trace->ops[i].type > REALLOC || 
+	    trace->ops[i].index < 0 || trace->ops[i].index >= trace->num_ids ||
+	    trace->ops[i].size < 0) {
+	    printf("Bogus request %d in binary trace %s\n", i, path);
+	    exit(1);
+	}
+    }
+
+    if ((trace->blocks = 
+	 (char **)malloc(trace->num_ids * sizeof(char *))) == NULL)
+	unix_error("malloc 3 failed in read_trace");
+    if ((trace->block_sizes = 
+	 (size_t *)malloc(trace->num_ids * sizeof(size_t))) == NULL)
+	unix_error("malloc 4 failed in read_trace");
+}
+
 /*
  * free_trace - Free the trace record and the three arrays it points
- *              to, all of which were allocated in read_trace().
+ *              to, all of which were allocated (or, for ops[], mapped)
+ *              in read_trace().
  */
 void free_trace(trace_t *trace)
 {
-    free(trace->ops);         /* free the three arrays... */
+    if (trace->map)           /* free the three arrays... */
+	munmap(trace->map, trace->map_size);
+    else
+	free(trace->ops);
     free(trace->blocks);      
     free(trace->block_sizes);
     free(trace);              /* and the trace record itself... */
@@ -617,7 +980,7 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
     char *oldp;
     char *p;
     
-    /* Reset the heap and free any records in the range list */
+    /* Reset the heap and free any records in the range tree */
     mem_reset_brk();
     clear_ranges(ranges);
 
@@ -644,7 +1007,7 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
 	    
 	    /* 
 	     * Test the range of the new block for correctness and add it 
-	     * to the range list if OK. The block must be  be aligned properly,
+	     * to the range tree if OK. The block must be  be aligned properly,
 	     * and must not overlap any currently allocated block. 
 	     */ 
 	    if (add_range(ranges, p, size, tracenum, i) == 0)
@@ -671,10 +1034,10 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
 		return 0;
 	    }
 	    
-	    /* Remove the old region from the range list */
+	    /* Remove the old region from the range tree */
 	    remove_range(ranges, oldp);
 	    
-	    /* Check new block for correctness and add it to range list */
+	    /* Check new block for correctness and add it to range tree */
 	    if (add_range(ranges, newp, size, tracenum, i) == 0)
 		return 0;
 	    
@@ -686,7 +1049,7 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
 	    oldsize = trace->block_sizes[index];
 	    if (size < oldsize) oldsize = size;
 	    for (j = 0; j < oldsize; j++) {
-	      if (newp[j] != (index & 0xFF)) {
+	      if ((unsigned char)newp[j] != (index & 0xFF)) {
 		malloc_error(tracenum, i, "mm_realloc did not preserve the "
 			     "data from old block");
 		return 0;
@@ -701,7 +1064,7 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
 
         case FREE: /* mm_free */
 	    
-	    /* Remove region from list and call student's free function */
+	    /* Remove region from tree and call student's free function */
 	    p = trace->blocks[index];
 	    remove_range(ranges, p);
 	    mm_free(p);
@@ -722,10 +1085,10 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
  *   The idea is to remember the high water mark "hwm" of the heap for 
  *   an optimal allocator, i.e., no gaps and no internal fragmentation.
  *   Utilization is the ratio hwm/heapsize, where heapsize is the 
- *   size of the heap in bytes after running the student's malloc 
- *   package on the trace. Note that our implementation of mem_sbrk() 
- *   doesn't allow the students to decrement the brk pointer, so brk
- *   is always the high water mark of the heap. 
+ *   largest size of the heap in bytes while running the student's 
+ *   malloc package on the trace. mem_sbrk() lets the package shrink 
+ *   the heap, so we ask memlib for its high water mark rather than 
+ *   for its size at the end.
  *   
  */
 static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges, int* ideal_max_heap, int* max_heap)
@@ -807,7 +1170,7 @@ static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges, int*
         }
     }
     
-    *max_heap = mem_heapsize() > FREE_HEAP ? mem_heapsize() : FREE_HEAP;
+    *max_heap = mem_heap_peak() > FREE_HEAP ? mem_heap_peak() : FREE_HEAP;
     *ideal_max_heap = max_total_size;
     return ((double) *ideal_max_heap/ (double)*max_heap);
 }
@@ -819,14 +1182,22 @@ static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges, int*
  */
 static void eval_mm_speed(void *ptr)
 {
-    int i, index, size, newsize;
-    char *p, *newp, *oldp, *block;
     trace_t *trace = ((speed_t *)ptr)->trace;
 
     /* Reset the heap and initialize the mm package */
     mem_reset_brk();
     if (mm_init() < 0) 
 	app_error("mm_init failed in eval_mm_speed");
+    replay_mm(trace);
+}
+
+/*
+ * replay_mm - Interpret each trace request with the mm malloc package
+ */
+static void replay_mm(trace_t *trace)
+{
+    int i, index, size, newsize;
+    char *p, *newp, *oldp, *block;
 
     /* Interpret each trace request */
     for (i = 0;  i < trace->num_ops;  i++)
@@ -860,6 +1231,117 @@ static void eval_mm_speed(void *ptr)
         }
 }
 
+/*
+ * eval_mm_lat - Replay the trace once more, reading the cycle counter 
+ *     around every mm_malloc, mm_free and mm_realloc call, and return 
+ *     one latency histogram per op type
+ */
+static hist_t *eval_mm_lat(trace_t *trace)
+{
+    int i, index, size, newsize;
+    char *p, *newp, *oldp, *block;
+    double cycles;
+    hist_t *hist;
+
+    if ((hist = (hist_t *)calloc(NUM_OPTYPES, sizeof(hist_t))) == NULL)
+	unix_error("calloc failed in eval_mm_lat");
+
+    /* Reset the heap and initialize the mm package */
+    mem_reset_brk();
+    if (mm_init() < 0) 
+	app_error("mm_init failed in eval_mm_lat");
+
+    for (i = 0;  i < trace->num_ops;  i++) {
+        switch (trace->ops[i].type) {
+
+        case ALLOC: /* mm_malloc */
+            index = trace->ops[i].index;
+            size = trace->ops[i].size;
+	    start_counter();
+            p = mm_malloc(size);
+	    cycles = get_counter();
+            if (p == NULL)
+		app_error("mm_malloc error in eval_mm_lat");
+            trace->blocks[index] = p;
+            break;
+
+	case REALLOC: /* mm_realloc */
+	    index = trace->ops[i].index;
+            newsize = trace->ops[i].size;
+	    oldp = trace->blocks[index];
+	    start_counter();
+            newp = mm_realloc(oldp,newsize);
+	    cycles = get_counter();
+            if (newp == NULL)
+		app_error("mm_realloc error in eval_mm_lat");
+            trace->blocks[index] = newp;
+            break;
+
+        case FREE: /* mm_free */
+            index = trace->ops[i].index;
+            block = trace->blocks[index];
+	    start_counter();
+            mm_free(block);
+	    cycles = get_counter();
+            break;
+
+	default:
+	    app_error("Nonexistent request type in eval_mm_lat");
+        }
+	hist_add(&hist[trace->ops[i].type], cycles);
+    }
+    return hist;
+}
+
+/*
+ * hist_add - Record one op that took cycles cycles. Values below 
+ *     1<<LAT_SUB_BITS get a bucket each; above that, bucket b covers 
+ *     one of the 1<<LAT_SUB_BITS slices of a power of two.
+ */
+static void hist_add(hist_t *hist, double cycles)
+{
+    unsigned long long c = (cycles > 0) ? (unsigned long long)cycles : 0;
+    int msb, b;
+
+    if (c < (1 << LAT_SUB_BITS))
+	b = c;
+    else {
+	msb = 63 - __builtin_clzll(c);
+	b = ((msb - LAT_SUB_BITS + 1) << LAT_SUB_BITS) +
+	    ((c >> (msb - LAT_SUB_BITS)) & ((1 << LAT_SUB_BITS) - 1));
+    }
+    hist->buckets[b]++;
+    hist->count++;
+    if (cycles > hist->max)
+	hist->max = cycles;
+}
+
+/*
+ * hist_percentile - Return the cycles that fraction p of the recorded 
+ *     ops did not exceed: the top of the bucket holding that op, but 
+ *     never more than the slowest op
+ */
+static double hist_percentile(hist_t *hist, double p)
+{
+    double seen = 0, top;
+    int b, sh;
+
+    if (hist->count == 0)
+	return 0;
+    for (b = 0; b < LAT_BUCKETS - 1; b++) {
+	seen += hist->buckets[b];
+	if (seen >= p * hist->count)
+	    break;
+    }
+    if (b < (1 << LAT_SUB_BITS))
+	top = b;
+    else {
+	sh = (b >> LAT_SUB_BITS) - 1;
+	top = (double)(((1ULL << LAT_SUB_BITS) + (b & ((1 << LAT_SUB_BITS) - 1)) + 1) << sh) - 1;
+    }
+    return (top < hist->max) ? top : hist->max;
+}
+
 /*
  * eval_libc_valid - We run this function to make sure that the
  *    libc malloc can run to completion on the set of traces.
@@ -945,6 +1427,442 @@ static void eval_libc_speed(void *ptr)
     }
 }
 
+/**********************************************************************
+ * The following functions replay the traces on several threads at
+ * once, to see how each malloc package copes with contention (-T).
+ **********************************************************************/
+
+/*
+ * replay_thread - Body of one replay thread: wait for the others, then
+ *     replay the whole trace into this thread's own blocks[] and time it
+ */
+static void *replay_thread(void *ptr)
+{
+    replay_t *r = (replay_t *)ptr;
+    speed_t speed_params;
+
+    speed_params.trace = &r->trace;
+    speed_params.ranges = NULL;
+    pthread_barrier_wait(r->start);
+    r->t0 = timer_start();
+    if (r->use_mm)
+	replay_mm(&r->trace);
+    else
+	eval_libc_speed(&speed_params);
+    r->t1 = timer_stop();
+    return NULL;
+}
+
+/*
+ * eval_threads - Replay trace on threads threads at the same time, each
+ *     with its own copy of the blocks[] index space, and return the best
+ *     wall clock time (first start to last finish) of SCALE_REPS runs. 
+ *     The mean and the worst per-op latency of the threads in that run 
+ *     go to *lat and *max_lat.
+ */
+static double eval_threads(trace_t *trace, int threads, int use_mm, 
+			   double *lat, double *max_lat)
+{
+    pthread_t tid[MAX_THREADS];
+    replay_t r[MAX_THREADS];
+    pthread_barrier_t start;
+    double secs, best = DBL_MAX, sum, max, lo, hi, t;
+    int i, rep;
+
+    *lat = *max_lat = 0;
+    for (i = 0; i < threads; i++) {
+	r[i].trace = *trace;
+	if ((r[i].trace.blocks = 
+	     (char **)malloc(trace->num_ids * sizeof(char *))) == NULL)
+	    unix_error("malloc failed in eval_threads");
+	r[i].use_mm = use_mm;
+	r[i].start = &start;
+    }
+
+    for (rep = 0; rep < SCALE_REPS; rep++) {
+	if (use_mm) {
+	    mem_reset_brk();
+	    if (mm_init() < 0)
+		app_error("mm_init failed in eval_threads");
+	}
+	pthread_barrier_init(&start, NULL, threads + 1);
+	for (i = 0; i < threads; i++)
+	    if (pthread_create(&tid[i], NULL, replay_thread, &r[i]) != 0)
+		unix_error("pthread_create failed in eval_threads");
+	pthread_barrier_wait(&start);
+	for (i = 0; i < threads; i++)
+	    pthread_join(tid[i], NULL);
+	pthread_barrier_destroy(&start);
+
+	lo = DBL_MAX;
+	hi = sum = max = 0;
+	for (i = 0; i < threads; i++) {
+	    t = timer_secs(r[i].t0);
+	    lo = (t < lo) ? t : lo;
+	    secs = timer_secs(r[i].t1);
+	    hi = (secs > hi) ? secs : hi;
+	    secs -= t;
+	    sum += secs;
+	    max = (secs > max) ? secs : max;
+	}
+	if (hi - lo < best) {
+	    best = hi - lo;
+	    *lat = sum / threads / trace->num_ops;
+	    *max_lat = max / trace->num_ops;
+	}
+    }
+
+    for (i = 0; i < threads; i++)
+	free(r[i].trace.blocks);
+    return best;
+}
+
+/*
+ * eval_scaling - Replay every trace on 1, 2, 4, ... up to max_threads 
+ *     threads and print the resulting scaling curve
+ */
+static void eval_scaling(char **tracefiles, int n, int max_threads, 
+			 int use_mm)
+{
+    scale_t scale[MAX_THREADS];
+    trace_t *trace;
+    double lat, max_lat;
+    int i, t, rows = 0;
+
+    if (verbose > 1)
+	printf("\nTesting %s malloc on up to %d threads\n", 
+	       use_mm ? "mm" : "libc", max_threads);
+    for (t = 1; ; t = (2*t < max_threads) ? 2*t : max_threads) {
+	scale[rows].threads = t;
+	scale[rows].ops = scale[rows].secs = 0;
+	scale[rows].lat = scale[rows].max_lat = 0;
+	rows++;
+	if (t == max_threads)
+	    break;
+    }
+
+    for (i = 0; i < n; i++) {
+	trace = read_trace(tracedir, tracefiles[i]);
+	for (t = 0; t < rows; t++) {
+	    scale[t].secs += eval_threads(trace, scale[t].threads, use_mm, 
+					  &lat, &max_lat);
+	    scale[t].ops += (double)trace->num_ops * scale[t].threads;
+	    scale[t].lat += lat / n;
+	    scale[t].max_lat += max_lat / n;
+	}
+	free_trace(trace);
+    }
+
+    printf("\nScaling for %s malloc (each thread replays every trace):\n",
+	   use_mm ? "mm" : "libc");
+    printscaling(rows, scale);
+}
+
+/**********************************************************************
+ * The following functions profile a trace instead of running it (-P):
+ * the sizes it asks for, how long its blocks live, how its live bytes
+ * evolve and how its reallocs grow, followed by the size classes and
+ * CHUNKSIZE that would suit it. 
+ **********************************************************************/
+
+/*
+ * profile_trace - Print the profile of one trace
+ */
+static void profile_trace(trace_t *trace, char *filename)
+{
+    int i, b, k, n = trace->num_ops;
+    int index, size, oldsize, incr;
+    int nreqs = 0, nlives = 0, never = 0, mallocs = 0, frees = 0;
+    int reallocs = 0, grows = 0, shrinks = 0, same_incr = 0, geometric = 0;
+    int realloced = 0, max_chain = 0, nbounds;
+    size_t chunk, p90;
+    int bound[PROF_CLASSES];
+    double cnt[PROF_BUCKETS], bytes[PROF_BUCKETS], lifecnt[PROF_BUCKETS];
+    double curve[PROF_POINTS], curve_ids[PROF_POINTS];
+    double live = 0, live_ids = 0, peak = 0, total = 0;
+    double ratio = 0, step = 0, waste = 0, pow2_waste = 0;
+    int peak_op = 0;
+    int *born, *cur, *chain, *last_incr, *reqs, *lives;
+
+    born = (int *)calloc(trace->num_ids, sizeof(int));
+    cur = (int *)calloc(trace->num_ids, sizeof(int));
+    chain = (int *)calloc(trace->num_ids, sizeof(int));
+    last_incr = (int *)calloc(trace->num_ids, sizeof(int));
+    reqs = (int *)malloc(n * sizeof(int));
+    lives = (int *)malloc(n * sizeof(int));
+    if (!born || !cur || !chain || !last_incr || !reqs || !lives)
+	unix_error("calloc in profile_trace failed");
+    for (i = 0; i < trace->num_ids; i++)
+	cur[i] = -1; /* not live */
+    memset(cnt, 0, sizeof(cnt));
+    memset(bytes, 0, sizeof(bytes));
+    memset(lifecnt, 0, sizeof(lifecnt));
+
+    /* One pass over the ops collects everything */
+    for (i = 0, k = 0; i < n; i++) {
+	index = trace->ops[i].index;
+	size = trace->ops[i].size;
+	switch (trace->ops[i].type) {
+	case ALLOC:
+	    mallocs++;
+	    born[index] = i;
+	    cur[index] = size;
+	    reqs[nreqs++] = size;
+	    live += size;
+	    live_ids++;
+	    break;
+	case REALLOC:
+	    reallocs++;
+	    oldsize = cur[index] < 0 ? 0 : cur[index];
+	    incr = size - oldsize;
+	    if (incr > 0) {
+		grows++;
+		ratio += (double)size / (oldsize ? oldsize : 1);
+		step += incr;
+		if (incr == last_incr[index])
+		    same_incr++;
+		if (size >= oldsize + oldsize / 2)
+		    geometric++;
+		last_incr[index] = incr;
+	    }
+	    else if (incr < 0)
+		shrinks++;
+	    if (chain[index]++ == 0)
+		realloced++;
+	    if (chain[index] > max_chain)
+		max_chain = chain[index];
+	    cur[index] = size;
+	    reqs[nreqs++] = size;
+	    live += incr;
+	    break;
+	case FREE:
+	    frees++;
+	    lives[nlives++] = i - born[index];
+	    lifecnt[log2_bucket(i - born[index])]++;
+	    live -= cur[index];
+	    live_ids--;
+	    cur[index] = -1;
+	    break;
+	}
+	if (live > peak) {
+	    peak = live;
+	    peak_op = i;
+	}
+	while (k < PROF_POINTS && i == (long)(k + 1) * n / PROF_POINTS - 1) {
+	    curve[k] = live;
+	    curve_ids[k++] = live_ids;
+	}
+    }
+    for (i = 0; i < trace->num_ids; i++)
+	if (cur[i] >= 0)
+	    never++;
+    for (i = 0; i < nreqs; i++) {
+	b = log2_bucket(reqs[i]);
+	cnt[b]++;
+	bytes[b] += reqs[i];
+	total += reqs[i];
+    }
+
+    printf("\nProfile of %s: %d ops, %d blocks (%d mallocs, %d reallocs, "
+	   "%d frees)\n", filename, n, trace->num_ids, mallocs, reallocs, frees);
+
+    /* Size distribution */
+    qsort(reqs, nreqs, sizeof(int), intcmp);
+    printf("\nRequest sizes (malloc and realloc):\n");
+    printf("%12s%10s%8s%12s%8s\n", "size", "count", "%count", "bytes", "%bytes");
+    for (b = 0; b < PROF_BUCKETS; b++)
+	if (cnt[b])
+	    printf("%4s%8u%10.0f%7.1f%%%12.0f%7.1f%%\n", "<=", 1u << b, 
+		   cnt[b], 100.0 * cnt[b] / nreqs, 
+		   bytes[b], 100.0 * bytes[b] / total);
+    if (nreqs)
+	printf("  p50 %d, p90 %d, p99 %d, max %d bytes\n",
+	       reqs[nreqs / 2], reqs[(int)(nreqs * 0.9)], 
+	       reqs[(int)(nreqs * 0.99)], reqs[nreqs - 1]);
+
+    /* Lifetimes */
+    qsort(lives, nlives, sizeof(int), intcmp);
+    printf("\nLifetimes (ops from malloc to free):\n");
+    printf("%12s%10s%8s\n", "ops", "count", "%count");
+    for (b = 0; b < PROF_BUCKETS; b++)
+	if (lifecnt[b])
+	    printf("%4s%8u%10.0f%7.1f%%\n", "<=", 1u << b, 
+		   lifecnt[b], 100.0 * lifecnt[b] / nlives);
+    if (nlives)
+	printf("  p50 %d, p90 %d, max %d ops; ", lives[nlives / 2], 
+	       lives[(int)(nlives * 0.9)], lives[nlives - 1]);
+    printf("%d blocks never freed\n", never);
+
+    /* Live bytes curve */
+    printf("\nLive payload over the trace:\n");
+    printf("%10s%12s%8s\n", "op", "bytes", "blocks");
+    for (k = 0; k < PROF_POINTS && k < n; k++) {
+	printf("%10ld%12.0f%8.0f  ", (long)(k + 1) * n / PROF_POINTS,
+	       curve[k], curve_ids[k]);
+	for (b = 0; peak > 0 && b < curve[k] * PROF_BAR / peak; b++)
+	    putchar('#');
+	putchar('\n');
+    }
+    printf("  ideal peak heap %.0f bytes (%.0fk) at op %d\n", 
+	   peak, peak / 1024.0, peak_op);
+
+    /* Realloc growth */
+    if (reallocs) {
+	printf("\nReallocs: %d on %d blocks, longest chain %d; "
+	       "%d grow, %d shrink, %d keep their size\n", reallocs, realloced, 
+	       max_chain, grows, shrinks, reallocs - grows - shrinks);
+	if (grows)
+	    printf("  mean growth %.0f bytes (x%.3f); %.0f%% grow by the same step as "
+		   "before (linear), %.0f%% by x1.5 or more (geometric)\n",
+		   step / grows, ratio / grows, 100.0 * same_incr / grows, 
+		   100.0 * geometric / grows);
+    }
+
+    /* 
+     * Suggest size classes, and compare how much rounding every request 
+     * up to its class would waste against power-of-two classes.
+     */
+    if (nreqs) {
+	for (i = 0; i < nreqs; i++)
+	    reqs[i] = (reqs[i] + ALIGNMENT - 1) / ALIGNMENT * ALIGNMENT;
+	nbounds = suggest_classes(reqs, nreqs, bound);
+	for (i = 0, k = 0; i < nreqs; i++) {
+	    while (reqs[i] > bound[k])
+		k++;
+	    waste += bound[k] - reqs[i];
+	    pow2_waste += (1u << log2_bucket(reqs[i])) - reqs[i];
+	}
+	printf("\nSuggested size classes (least rounding waste):\n ");
+	for (k = 0; k < nbounds; k++)
+	    printf(" (%d, %d]", k ? bound[k - 1] : 0, bound[k]);
+	printf("\n  rounding up to these wastes %.1f%% of the requested bytes, "
+	       "power-of-two classes %.1f%%\n", 
+	       100.0 * waste / total, 100.0 * pow2_waste / total);
+
+	/* 
+	 * An eighth of the peak keeps what the last chunk wastes at the
+	 * end of the heap small, yet a chunk should still hold the 
+	 * larger requests. Both loops stop at SIZE_MAX/2, so that doubling
+	 * chunk can't wrap around however big the trace is.
+	 */
+	p90 = (size_t)(unsigned)reqs[(int)(nreqs * 0.9)];
+	for (chunk = 4096; chunk <= SIZE_MAX / 2 && chunk * 2 <= peak / 8; chunk *= 2)
+	    ;
+	while (chunk <= SIZE_MAX / 2 && chunk < p90)
+	    chunk *= 2;
+	printf("Suggested CHUNKSIZE: %zu (about 1/8 of the ideal peak, "
+	       "and at least the p90 request)\n", chunk);
+    }
+
+    free(born);
+    free(cur);
+    free(chain);
+    free(last_incr);
+    free(reqs);
+    free(lives);
+}
+
+/*
+ * suggest_classes - Choose up to PROF_CLASSES class bounds for the 
+ *     sorted, aligned request sizes reqs[], the last one being the 
+ *     largest request, so that rounding each request up to its class 
+ *     bound wastes the fewest bytes. Dynamic programming over the 
+ *     distinct sizes: best[k][i] is the least waste of covering the 
+ *     first i of them with k classes. Returns the number of bounds.
+ */
+static int suggest_classes(int *reqs, int nreqs, int *bound)
+{
+    int i, j, k, d, nd = 0, nbounds;
+    int *vals, *from;
+    double *cnt, *sum, *best, cost;
+
+    vals = (int *)malloc(nreqs * sizeof(int));
+    cnt = (double *)calloc(nreqs + 1, sizeof(double));
+    sum = (double *)calloc(nreqs + 1, sizeof(double));
+    if (!vals || !cnt || !sum)
+	unix_error("malloc in suggest_classes failed");
+
+    /* cnt[i] and sum[i] count and add up the requests for vals[0..i-1] */
+    for (i = 0; i < nreqs; i++) {
+	if (nd == 0 || reqs[i] != vals[nd - 1]) {
+	    vals[nd] = reqs[i];
+	    cnt[nd + 1] = cnt[nd];
+	    sum[nd + 1] = sum[nd];
+	    nd++;
+	}
+	cnt[nd]++;
+	sum[nd] += reqs[i];
+    }
+
+    best = (double *)malloc((PROF_CLASSES + 1) * (nd + 1) * sizeof(double));
+    from = (int *)malloc((PROF_CLASSES + 1) * (nd + 1) * sizeof(int));
+    if (!best || !from)
+	unix_error("malloc in suggest_classes failed");
+#define BEST(k, i) best[(k) * (nd + 1) + (i)]
+#define FROM(k, i) from[(k) * (nd + 1) + (i)]
+    for (i = 1; i <= nd; i++) {
+	BEST(1, i) = vals[i - 1] * cnt[i] - sum[i];
+	FROM(1, i) = 0;
+    }
+    for (k = 2; k <= PROF_CLASSES; k++) {
+	for (i = 1; i <= nd; i++) {
+	    BEST(k, i) = BEST(k - 1, i);
+	    FROM(k, i) = -1; /* no use for another class */
+	    for (j = k - 1; j < i; j++) {
+		cost = BEST(k - 1, j) + 
+		    vals[i - 1] * (cnt[i] - cnt[j]) - (sum[i] - sum[j]);
+		if (cost < BEST(k, i)) {
+		    BEST(k, i) = cost;
+		    FROM(k, i) = j;
+		}
+	    }
+	}
+    }
+
+    /* Walk back from the largest size to recover the bounds */
+    nbounds = 0;
+    for (k = PROF_CLASSES, i = nd; i > 0; k--) {
+	if ((d = FROM(k, i)) < 0)
+	    continue;
+	bound[nbounds++] = vals[i - 1];
+	i = d;
+    }
+#undef BEST
+#undef FROM
+    for (i = 0; i < nbounds / 2; i++) {
+	d = bound[i];
+	bound[i] = bound[nbounds - 1 - i];
+	bound[nbounds - 1 - i] = d;
+    }
+
+    free(vals);
+    free(cnt);
+    free(sum);
+    free(best);
+    free(from);
+    return nbounds;
+}
+
+/*
+ * log2_bucket - The power-of-two bucket b, holding (2^(b-1), 2^b], of n
+ */
+static int log2_bucket(unsigned n)
+{
+    int b = 0;
+
+    while (b < PROF_BUCKETS - 1 && (1u << b) < n)
+	b++;
+    return b;
+}
+
+/*
+ * intcmp - qsort comparison for ascending ints
+ */
+static int intcmp(const void *a, const void *b)
+{
+    return *(const int *)a - *(const int *)b;
+}
+
 /*************************************
  * Some miscellaneous helper routines
  ************************************/
@@ -1010,6 +1928,183 @@ static void printresults(int n, stats_t *stats)
 
 }
 
+/*
+ * printscaling - prints the scaling curve of a multithreaded replay
+ */
+static void printscaling(int n, scale_t *scale) 
+{
+    int i;
+
+    printf("%8s%10s%10s%8s%8s%10s%10s\n", 
+	   "threads", "ops", "secs", "Kops", "speedup", "ns/op", "max ns/op");
+    for (i = 0; i < n; i++) {
+	printf("%8d%10.0f%10.6f%8.0f%7.2fx%10.1f%10.1f\n",
+	       scale[i].threads,
+	       scale[i].ops,
+	       scale[i].secs,
+	       (scale[i].ops/1e3)/scale[i].secs,
+	       (scale[i].ops/scale[i].secs) / (scale[0].ops/scale[0].secs),
+	       scale[i].lat*1e9,
+	       scale[i].max_lat*1e9);
+    }
+}
+
+/*
+ * printlatency - prints the latency percentiles of each op type per trace
+ */
+static void printlatency(int n, stats_t *stats) 
+{
+    int i, t;
+    hist_t *h;
+
+    printf("%35s%8s%9s%8s%8s%8s%10s\n", 
+	   "trace", "op", "count", "p50", "p99", "p99.9", "max");
+    for (i = 0; i < n; i++) {
+	if (stats[i].lat == NULL)
+	    continue;
+	for (t = 0; t < NUM_OPTYPES; t++) {
+	    h = &stats[i].lat[t];
+	    if (h->count == 0)
+		continue;
+	    printf("%35s%8s%9.0f%8.0f%8.0f%8.0f%10.0f\n", 
+		   stats[i].filename, optype_names[t], h->count,
+		   hist_percentile(h, 0.5), hist_percentile(h, 0.99),
+		   hist_percentile(h, 0.999), h->max);
+	}
+    }
+}
+
+/*
+ * time_trace - returns the secs that f takes to run the trace in
+ *     params: fsecs, or with -S the median of bench_run, whose
+ *     confidence interval goes to stats, timed again if it regressed
+ *     against the history (-H). Also reads the counters (-c).
+ */
+static double time_trace(char *kind, fsecs_test_funct f, speed_t *params, 
+			 stats_t *stats)
+{
+    char name[MAXLINE];
+
+    if (!run_stats) {
+	double secs = fsecs(f, params);
+
+	if (run_perf)
+	    fsecs_perf_counts(&stats->perf);
+	return secs;
+    }
+    stats_name(name, kind, stats);
+    bench_run_named(name, 1, f, params, bench_clock, &stats->stats);
+    if (run_perf) {
+	perf_start();
+	f(params);
+	perf_stop(&stats->perf);
+    }
+    return stats->stats.median;
+}
+
+/*
+ * stats_name - the name that the history file (-H) keeps the secs of
+ *     a kind of malloc on the trace of stats under
+ */
+static void stats_name(char *name, char *kind, stats_t *stats)
+{
+    snprintf(name, MAXLINE, "%s %s", kind, stats->filename);
+}
+
+/*
+ * record_stats - records the median secs of every trace that ran for
+ *     the history file (-H)
+ */
+static void record_stats(char *kind, int n, stats_t *stats)
+{
+    char name[MAXLINE];
+    int i;
+
+    for (i = 0; i < n; i++) {
+	if (!stats[i].valid)
+	    continue;
+	stats_name(name, kind, &stats[i]);
+	bench_record(name, &stats[i].stats);
+    }
+}
+
+/*
+ * printcounters - prints the instructions per cycle and the events per
+ *     op of each counter there is, for every trace that ran
+ */
+static void printcounters(int n, stats_t *stats) 
+{
+    int i, e;
+    double *c;
+
+    printf("%35s%8s", "trace", "IPC");
+    for (e = PERF_INSTRS; e < PERF_NEVENTS; e++)
+	if (perf_has(e))
+	    printf("%9s", perf_name(e));
+    printf("\n");
+    for (i = 0; i < n; i++) {
+	if (!stats[i].valid)
+	    continue;
+	c = stats[i].perf.count;
+	printf("%35s", stats[i].filename);
+	if (c[PERF_CYCLES] > 0)
+	    printf("%8.2f", c[PERF_INSTRS] / c[PERF_CYCLES]);
+	else
+	    printf("%8s", "-");
+	for (e = PERF_INSTRS; e < PERF_NEVENTS; e++)
+	    if (perf_has(e))
+		printf("%9.3f", c[e] / stats[i].ops);
+	printf("\n");
+    }
+}
+
+/*
+ * writelatency - writes the latency percentiles to filename, as JSON if 
+ *     its name ends in .json and as CSV otherwise
+ */
+static void writelatency(char *filename, int n, stats_t *stats) 
+{
+    FILE *fp;
+    int i, t, json, first = 1;
+    size_t len = strlen(filename);
+    hist_t *h;
+
+    json = (len >= 5 && !strcmp(filename + len - 5, ".json"));
+    if ((fp = fopen(filename, "w")) == NULL) {
+	sprintf(msg, "Could not open %s in writelatency", filename);
+	unix_error(msg);
+    }
+    if (json)
+	fprintf(fp, "[\n");
+    else
+	fprintf(fp, "trace,op,count,p50,p99,p999,max\n");
+    for (i = 0; i < n; i++) {
+	if (stats[i].lat == NULL)
+	    continue;
+	for (t = 0; t < NUM_OPTYPES; t++) {
+	    h = &stats[i].lat[t];
+	    if (h->count == 0)
+		continue;
+	    if (json) {
+		fprintf(fp, "%s  {\"trace\": \"%s\", \"op\": \"%s\", \"count\": %.0f, "
+			"\"p50\": %.0f, \"p99\": %.0f, \"p999\": %.0f, \"max\": %.0f}",
+			first ? "" : ",\n", stats[i].filename, optype_names[t], 
+			h->count, hist_percentile(h, 0.5), hist_percentile(h, 0.99),
+			hist_percentile(h, 0.999), h->max);
+		first = 0;
+	    }
+	    else
+		fprintf(fp, "%s,%s,%.0f,%.0f,%.0f,%.0f,%.0f\n", 
+			stats[i].filename, optype_names[t], h->count,
+			hist_percentile(h, 0.5), hist_percentile(h, 0.99),
+			hist_percentile(h, 0.999), h->max);
+	}
+    }
+    if (json)
+	fprintf(fp, "\n]\n");
+    fclose(fp);
+}
+
 /* 
  * app_error - Report an arbitrary application error
  */
@@ -1042,14 +2137,25 @@ void malloc_error(int tracenum, int opnum, char *msg)
  */
 static void usage(void) 
 {
-    fprintf(stderr, "Usage: mdriver [-hvVal] [-f <file>] [-t <dir>]\n");
+    fprintf(stderr, "Usage: mdriver [-hvValLPcSB] [-f <file>] [-t <dir>] [-T <n>] [-o <file>]\n");
+    fprintf(stderr, "               [-H <file>] [-R <percent>]\n");
     fprintf(stderr, "Options\n");
     fprintf(stderr, "\t-a         Don't check the team structure.\n");
+    fprintf(stderr, "\t-B         Compare the throughput with libc's on this machine.\n");
+    fprintf(stderr, "\t-c         Print performance counters per op while timing.\n");
     //fprintf(stderr, "\t-f <file>  Use <file> as the trace file.\n");
     fprintf(stderr, "\t-g         Generate summary info for autograder.\n");
     fprintf(stderr, "\t-h         Print this message.\n");
+    fprintf(stderr, "\t-H <file>  Implies -S; compare the times with the last 5 runs in the\n");
+    fprintf(stderr, "\t           JSON history <file>, then add this run. Exit 1 if any regressed.\n");
     fprintf(stderr, "\t-l         Run libc malloc as well.\n");
+    fprintf(stderr, "\t-L         Print per-op latency percentiles (cycles).\n");
+    fprintf(stderr, "\t-o <file>  Write the latencies to <file> (CSV, or JSON if *.json).\n");
+    fprintf(stderr, "\t-P         Profile the traces instead of running them.\n");
+    fprintf(stderr, "\t-R <pct>   Regression threshold for -H (default 5).\n");
+    fprintf(stderr, "\t-S         Pin to a CPU and time each trace by the median of 15 runs.\n");
     fprintf(stderr, "\t-t <dir>   Directory to find default traces.\n");
+    fprintf(stderr, "\t-T <n>     Also replay the traces on 1 up to <n> threads.\n");
     fprintf(stderr, "\t-v         Print per-trace performance breakdowns.\n");
     fprintf(stderr, "\t-V         Print additional debug info.\n");
 }
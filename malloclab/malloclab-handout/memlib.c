@@ -3,6 +3,7 @@
  *            allows us to interleave calls from the student's malloc package 
  *            with the system's malloc package in libc.
  */
+#define _GNU_SOURCE          /* for mremap */
 #include <stdio.h>
 #include <stdlib.h>
 #include <assert.h>
@@ -14,24 +15,61 @@
 #include "memlib.h"
 #include "config.h"
 
+#include <pthread.h>
+
+/* Records one region handed out by mem_map */
+typedef struct map_t {
+    char *lo;              /* first byte of the region */
+    size_t size;           /* its length in bytes */
+    struct map_t *next;    /* next list element */
+} map_t;
+
 /* private variables */
 static char *mem_start_brk;  /* points to first byte of heap */
-static char *mem_brk;        /* points to last byte of heap */
+static char *volatile mem_brk; /* points to last byte of heap */
 static char *mem_max_addr;   /* largest legal heap address */ 
+static size_t mem_peak;      /* largest footprint since mem_reset_brk */
+static map_t *mem_maps;      /* regions handed out by mem_map */
+static size_t mem_mapped;    /* total bytes in those regions */
+static pthread_mutex_t mem_map_lock = PTHREAD_MUTEX_INITIALIZER;
+#if MEM_USE_MMAP
+static char *mem_commit_brk; /* end of the pages that are accessible */
+static pthread_mutex_t mem_commit_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void mem_commit(char *brk);
+static void mem_release(char *brk);
+#endif
+static void mem_note_peak(void);
 
 /* 
- * mem_init - initialize the memory system model
+ * mem_init - initialize the memory system model. With MEM_USE_MMAP the
+ *    heap's address space is only reserved (PROT_NONE), and mem_sbrk
+ *    commits pages as the heap grows; otherwise it is one big malloc.
  */
 void mem_init(void)
 {
     /* allocate the storage we will use to model the available VM */
+#if MEM_USE_MMAP
+    mem_start_brk = mmap(NULL, MAX_HEAP, PROT_NONE, 
+			 MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (mem_start_brk == MAP_FAILED) {
+	fprintf(stderr, "mem_init_vm: mmap error\n");
+	exit(1);
+    }
+#if MEM_HUGEPAGES && defined(MADV_HUGEPAGE)
+    madvise(mem_start_brk, MAX_HEAP, MADV_HUGEPAGE);
+#endif
+    mem_commit_brk = mem_start_brk;
+#else
     if ((mem_start_brk = (char *)malloc(MAX_HEAP)) == NULL) {
 	fprintf(stderr, "mem_init_vm: malloc error\n");
 	exit(1);
     }
+#endif
 
     mem_max_addr = mem_start_brk + MAX_HEAP;  /* max legal heap address */
     mem_brk = mem_start_brk;                  /* heap is empty initially */
+    mem_peak = 0;
 }
 
 /* 
@@ -39,33 +77,242 @@ void mem_init(void)
  */
 void mem_deinit(void)
 {
+#if MEM_USE_MMAP
+    munmap(mem_start_brk, MAX_HEAP);
+#else
     free(mem_start_brk);
+#endif
 }
 
 /*
- * mem_reset_brk - reset the simulated brk pointer to make an empty heap
+ * mem_reset_brk - reset the simulated brk pointer to make an empty heap,
+ *    and unmap any regions left over from mem_map. Committed heap pages
+ *    stay committed, so the next run does not fault them all in again.
  */
 void mem_reset_brk()
 {
+    map_t *m, *mnext;
+
+    for (m = mem_maps; m != NULL; m = mnext) {
+	mnext = m->next;
+	munmap(m->lo, m->size);
+	free(m);
+    }
+    mem_maps = NULL;
+    mem_mapped = 0;
     mem_brk = mem_start_brk;
+    mem_peak = 0;
 }
 
 /* 
  * mem_sbrk - simple model of the sbrk function. Extends the heap 
- *    by incr bytes and returns the start address of the new area. In
- *    this model, the heap cannot be shrunk.
+ *    by incr bytes and returns the start address of the new area, or
+ *    shrinks it when incr is negative. With MEM_USE_MMAP a shrink gives
+ *    the pages past the new brk back to the system. The brk pointer is 
+ *    moved with a compare and swap, so threads can carve pieces off the 
+ *    heap concurrently and each gets a distinct one; shrinking is only 
+ *    safe while no other thread is growing the heap.
  */
 void *mem_sbrk(int incr) 
 {
-    char *old_brk = mem_brk;
+    char *old_brk, *new_brk;
+
+    old_brk = __atomic_load_n(&mem_brk, __ATOMIC_RELAXED);
+    do {
+	new_brk = old_brk + incr;
+	if ((new_brk < mem_start_brk) || (new_brk > mem_max_addr)) {
+	    errno = ENOMEM;
+	    fprintf(stderr, "ERROR: mem_sbrk failed. Ran out of memory...\n");
+	    return (void *)-1;
+	}
+    } while (!__atomic_compare_exchange_n(&mem_brk, &old_brk, new_brk, 1,
+					  __ATOMIC_SEQ_CST, __ATOMIC_RELAXED));
+#if MEM_USE_MMAP
+    if (new_brk > mem_commit_brk)
+	mem_commit(new_brk);
+    else if (incr < 0 && mem_commit_brk - new_brk > MEM_COMMIT_SIZE)
+	mem_release(new_brk);
+#endif
+    if (incr > 0)
+	mem_note_peak();
+    return (void *)old_brk;
+}
+
+#if MEM_USE_MMAP
+/*
+ * mem_commit - make the heap accessible up to at least brk, in steps 
+ *    of MEM_COMMIT_SIZE so that most calls to mem_sbrk make no syscall
+ */
+static void mem_commit(char *brk)
+{
+    char *end;
+
+    pthread_mutex_lock(&mem_commit_lock);
+    if (brk > mem_commit_brk) {
+	end = mem_start_brk + (brk - mem_start_brk + MEM_COMMIT_SIZE - 1) /
+	    MEM_COMMIT_SIZE * MEM_COMMIT_SIZE;
+	if (end > mem_max_addr)
+	    end = mem_max_addr;
+	if (mprotect(mem_commit_brk, end - mem_commit_brk, 
+		     PROT_READ | PROT_WRITE) < 0) {
+	    fprintf(stderr, "ERROR: mem_sbrk failed to commit memory\n");
+	    exit(1);
+	}
+	mem_commit_brk = end;
+    }
+    pthread_mutex_unlock(&mem_commit_lock);
+}
 
-    if ( (incr < 0) || ((mem_brk + incr) > mem_max_addr)) {
-	errno = ENOMEM;
-	fprintf(stderr, "ERROR: mem_sbrk failed. Ran out of memory...\n");
+/*
+ * mem_release - give the committed pages past brk, rounded up to a 
+ *    MEM_COMMIT_SIZE step, back to the system
+ */
+static void mem_release(char *brk)
+{
+    char *end;
+
+    pthread_mutex_lock(&mem_commit_lock);
+    end = mem_start_brk + (brk - mem_start_brk + MEM_COMMIT_SIZE - 1) /
+	MEM_COMMIT_SIZE * MEM_COMMIT_SIZE;
+    if (end < mem_commit_brk) {
+	madvise(end, mem_commit_brk - end, MADV_DONTNEED);
+	mprotect(end, mem_commit_brk - end, PROT_NONE);
+	mem_commit_brk = end;
+    }
+    pthread_mutex_unlock(&mem_commit_lock);
+}
+#endif
+
+/*
+ * mem_map - model mmap: hand out a fresh region of size bytes outside 
+ *    the heap, or (void *)-1 if there is none. The region counts 
+ *    towards the footprint until it is unmapped.
+ */
+void *mem_map(size_t size)
+{
+    map_t *m;
+    char *p;
+
+    p = mmap(NULL, size, PROT_READ | PROT_WRITE, 
+	     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED)
 	return (void *)-1;
+    if ((m = (map_t *)malloc(sizeof(map_t))) == NULL) {
+	fprintf(stderr, "mem_map: malloc error\n");
+	exit(1);
     }
-    mem_brk += incr;
-    return (void *)old_brk;
+    m->lo = p;
+    m->size = size;
+    pthread_mutex_lock(&mem_map_lock);
+    m->next = mem_maps;
+    mem_maps = m;
+    __atomic_fetch_add(&mem_mapped, size, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&mem_map_lock);
+    mem_note_peak();
+    return p;
+}
+
+/*
+ * mem_unmap - give back the region at p that mem_map returned
+ */
+void mem_unmap(void *p)
+{
+    map_t *m, **prevpp;
+
+    pthread_mutex_lock(&mem_map_lock);
+    for (prevpp = &mem_maps; (m = *prevpp) != NULL; prevpp = &m->next) {
+	if (m->lo == p) {
+	    *prevpp = m->next;
+	    __atomic_fetch_sub(&mem_mapped, m->size, __ATOMIC_RELAXED);
+	    break;
+	}
+    }
+    pthread_mutex_unlock(&mem_map_lock);
+    if (m == NULL) {
+	fprintf(stderr, "ERROR: mem_unmap of unknown region %p\n", p);
+	exit(1);
+    }
+    munmap(m->lo, m->size);
+    free(m);
+}
+
+/*
+ * mem_remap - model mremap: resize the region at p to size bytes, 
+ *    moving it if need be, without copying its contents. Returns the 
+ *    new address, or (void *)-1 with the region left as it was.
+ */
+void *mem_remap(void *p, size_t size)
+{
+    map_t *m;
+    char *newp;
+
+    pthread_mutex_lock(&mem_map_lock);
+    for (m = mem_maps; m != NULL && m->lo != p; m = m->next)
+	;
+    pthread_mutex_unlock(&mem_map_lock);
+    if (m == NULL) {
+	fprintf(stderr, "ERROR: mem_remap of unknown region %p\n", p);
+	exit(1);
+    }
+    newp = mremap(m->lo, m->size, size, MREMAP_MAYMOVE);
+    if (newp == MAP_FAILED)
+	return (void *)-1;
+    pthread_mutex_lock(&mem_map_lock);
+    __atomic_fetch_add(&mem_mapped, size - m->size, __ATOMIC_RELAXED);
+    m->lo = newp;
+    m->size = size;
+    pthread_mutex_unlock(&mem_map_lock);
+    mem_note_peak();
+    return newp;
+}
+
+/*
+ * mem_is_mapped - return 1 if the bytes lo through hi lie inside a 
+ *    single region handed out by mem_map, and 0 otherwise
+ */
+int mem_is_mapped(void *lo, void *hi)
+{
+    map_t *m;
+    int found = 0;
+
+    pthread_mutex_lock(&mem_map_lock);
+    for (m = mem_maps; m != NULL; m = m->next) {
+	if ((char *)lo >= m->lo && (char *)hi < m->lo + m->size) {
+	    found = 1;
+	    break;
+	}
+    }
+    pthread_mutex_unlock(&mem_map_lock);
+    return found;
+}
+
+/*
+ * mem_note_peak - remember the footprint (heap plus mapped regions) 
+ *    if it is the largest since mem_reset_brk. Every arena calls this,
+ *    so the maximum is raised with a compare and swap, and a larger
+ *    footprint noted by another thread meanwhile is never overwritten.
+ */
+static void mem_note_peak(void)
+{
+    char *brk = __atomic_load_n(&mem_brk, __ATOMIC_RELAXED);
+    size_t now = (size_t)(brk - mem_start_brk) + 
+	__atomic_load_n(&mem_mapped, __ATOMIC_RELAXED);
+    size_t peak = __atomic_load_n(&mem_peak, __ATOMIC_RELAXED);
+
+    while (now > peak &&
+	   !__atomic_compare_exchange_n(&mem_peak, &peak, now, 1,
+					__ATOMIC_RELAXED, __ATOMIC_RELAXED))
+	;
+}
+
+/*
+ * mem_heap_peak - return the largest footprint in bytes, counting the 
+ *    heap and the regions from mem_map, since mem_reset_brk. That is 
+ *    what a heap that shrinks, or that maps large blocks, has cost.
+ */
+size_t mem_heap_peak()
+{
+    return __atomic_load_n(&mem_peak, __ATOMIC_RELAXED);
 }
 
 /*
@@ -2,15 +2,20 @@
  * mm.c -  Simple allocator based on implicit free lists, 
  *         first fit placement, and boundary tag coalescing. 
  *
- * Each block has header and footer of the form:
+ * Each block has a header of the form:
  * 
  *      31                     3  2  1  0 
  *      -----------------------------------
- *     | s  s  s  s  ... s  s  s  0  0  a/f
+ *     | s  s  s  s  ... s  s  s  m pa a/f
  *      ----------------------------------- 
  * 
- * where s are the meaningful size bits and a/f is set 
- * iff the block is allocated. The list has the following form:
+ * where s are the meaningful size bits, a/f is set iff the block
+ * is allocated, pa is set iff the previous block is allocated and m
+ * is set iff the block is a mem_map region of its own.
+ * Only free blocks carry a footer (a copy of the header), so an
+ * allocated block costs a single word of overhead; coalesce learns
+ * whether its left neighbour is free from the pa bit instead of from
+ * that neighbour's footer. The list has the following form:
  *
  * begin                                                          end
  * heap                                                           heap  
@@ -24,7 +29,13 @@
  * eliminate edge conditions during coalescing.
  *
  * 
- * My implementation consists of an explicit free list with a first fit implementation using a doubly linked list to keep track of the free list. My mm_init function does almost the exact same thing as the textbook implicit implementation does, which is initializes the prologue header and footer and the epilogue header in order to avoid traversing out of bounds. Also, my mm_malloc acts very similar to that of the implicit free list as it uses first fit to traverse the free list and finds the first block capable of completing the request and splices the block if it's too large.In order to impement this explicit list, I created a pointer to the free list called free_listp and a function called edit_free_list that would add or remove a block from the free list depending on the integer value provided when calling this function.  */
+ * My implementation consists of an explicit free list with a first fit implementation using a doubly linked list to keep track of the free list. My mm_init function does almost the exact same thing as the textbook implicit implementation does, which is initializes the prologue header and footer and the epilogue header in order to avoid traversing out of bounds. Also, my mm_malloc acts very similar to that of the implicit free list as it uses first fit to traverse the free list and finds the first block capable of completing the request and splices the block if it's too large.In order to impement this explicit list, I created a function called edit_free_list that would add or remove a block from the free list depending on the integer value provided when calling this function.
+ *
+ * The free blocks are kept on segregated lists: seg_listp[] holds one list head per power-of-two size class, and edit_free_list files a block under the class its size falls in. find_fit only looks at classes that can satisfy the request, so a malloc no longer walks every free block in the heap. Free blocks above LARGE_MIN bytes are indexed instead by a two-level bitmap (TLSF style) of finer size ranges, which gives a best fit for large requests that only walks one short list. The free block at the end of a heap piece is kept apart on tail_listp and only used when nothing else fits, so carving requests off it does not move it between lists.
+ *
+ * All of those lists belong to an arena. Compiled with -DMM_THREADS (make mdriver-mt), the allocator is thread-safe: threads are spread over NUM_ARENAS arenas with one lock each, every arena carves its own ARENA_CHUNK sized pieces off the heap with their own prologue and epilogue, and a table maps each chunk to its arena so a block freed by another thread goes back where it came from. Small freed blocks first go to a per-thread cache that the next malloc of the same size takes them from without any locking.
+ *
+ * Blocks of MMAP_THRESHOLD bytes or more never touch the heap: each gets a region of its own from mem_map, marked by the m bit in its header, which mm_free unmaps and mm_realloc resizes with mem_remap.  */
 #include <stdio.h>
 #include <unistd.h>
 #include <string.h>
@@ -46,12 +57,22 @@ team_t team = {
 #define WSIZE       4       /* word size (bytes) */  
 #define DSIZE       8       /* doubleword size (bytes) */
 #define CHUNKSIZE  (1<<16)  /* initial heap size (bytes) */
-#define OVERHEAD    8       /* overhead of header and footer (bytes) */
+#define EXTEND_MIN (1<<14)  /* smallest heap extension (bytes) */
+#define OVERHEAD    4       /* overhead of an allocated block's header (bytes) */
+#define MIN_BLOCK  24       /* hdr + next + prev + ftr of a free block (bytes) */
+#define REALLOC_SLACK 4     /* growing reallocs reserve asize>>REALLOC_SLACK extra bytes */
+#define TRIM_THRESHOLD (1<<18) /* free space at the heap's end that gets trimmed (bytes) */
+#ifndef MMAP_THRESHOLD
+#define MMAP_THRESHOLD (1<<20) /* blocks this big get their own mem_map region (bytes) */
+#endif
+#define MAP_MAX     (UINT32_MAX & ~0x7) /* largest region a header can hold the size of (bytes) */
 
 #define MAX(x, y) ((x) > (y)? (x) : (y))  
 
-/* Pack a size and allocated bit into a word */
+/* Pack a size and allocated bits into a word */
 #define PACK(size, alloc)  ((size) | (alloc))
+#define PREV_ALLOC  0x2     /* header bit: the previous block is allocated */
+#define MMAPPED     0x4     /* header bit: the block is a mem_map region of its own */
 
 /* Read and write a word at address p */
 #define GET(p)       (*(uint32_t *)(p))
@@ -60,12 +81,19 @@ team_t team = {
 /* Read the size and allocated fields from address p */
 #define GET_SIZE(p)  (GET(p) & ~0x7)
 #define GET_ALLOC(p) (GET(p) & 0x1)
+#define GET_PREV_ALLOC(p) (GET(p) & PREV_ALLOC)
+#define GET_MMAPPED(p) (GET(p) & MMAPPED)
 
-/* Given block ptr bp, compute address of its header and footer */
+/* Set or clear the previous-allocated bit in the header at address p */
+#define SET_PREV_ALLOC(p) PUT(p, GET(p) | PREV_ALLOC)
+#define CLR_PREV_ALLOC(p) PUT(p, GET(p) & ~PREV_ALLOC)
+
+/* Given block ptr bp, compute address of its header and footer (free blocks only) */
 #define HDRP(bp)       ((char *)(bp) - WSIZE)  
 #define FTRP(bp)       ((char *)(bp) + GET_SIZE(HDRP(bp)) - DSIZE)
 
-/* Given block ptr bp, compute address of next and previous blocks */
+/* Given block ptr bp, compute address of next and previous blocks
+   (PREV_BLKP only when the previous block is free) */
 #define NEXT_BLKP(bp)  ((char *)(bp) + GET_SIZE(((char *)(bp) - WSIZE)))
 #define PREV_BLKP(bp)  ((char *)(bp) - GET_SIZE(((char *)(bp) - DSIZE)))
 /* $end mallocmacros */
@@ -74,9 +102,85 @@ team_t team = {
 
 #define SET_NEXT(bp, qp) (GET_NEXT(bp) = qp) 
 #define SET_PREV(bp, qp) (GET_PREV(bp) = qp) 
+
+/* 
+ * Segregated free lists: class i holds free blocks whose size lies in
+ * (MINCLASS << (i-1), MINCLASS << i], up to LARGE_MIN bytes. 
+ */
+#define NUM_CLASSES 6       /* number of small size classes */
+#define MINCLASS_SHIFT 5    /* log2 of MINCLASS */
+#define MINCLASS    (1<<MINCLASS_SHIFT) /* upper bound of the smallest class (bytes) */
+#define LARGE_MIN   (MINCLASS << (NUM_CLASSES-1)) /* largest small block (bytes) */
+
+/*
+ * Free blocks above LARGE_MIN go into a two-level (TLSF style) index:
+ * the first level splits sizes by power of two, the second splits each
+ * power of two into SL_COUNT equal ranges. fl_bitmap / sl_bitmap[] mark
+ * the non-empty lists, so a search is a couple of bit scans. Bits are
+ * set when a block goes onto an empty list and cleared when its last
+ * block comes off.
+ */
+#define FL_SHIFT    (MINCLASS_SHIFT + NUM_CLASSES - 1) /* log2 of LARGE_MIN */
+#define FL_COUNT    (32 - FL_SHIFT) /* first-level ranges */
+#define SL_SHIFT    3       /* log2 of SL_COUNT */
+#define SL_COUNT    (1<<SL_SHIFT)   /* second-level ranges per first level */
+/*
+ * The free structures live in an arena. Without MM_THREADS there is one
+ * arena and nothing is locked. Built with -DMM_THREADS, the heap is
+ * shared by NUM_ARENAS arenas, each with its own lock and free lists,
+ * that take ARENA_CHUNK sized pieces from mem_sbrk; chunk_owner[] maps
+ * each piece back to its arena so any thread can free any block. Each
+ * thread also keeps a small cache (tcache) of the blocks it freed, per
+ * exact block size, so a malloc/free pair usually takes no lock at all.
+ */
+#ifdef MM_THREADS
+#include <pthread.h>
+#define NUM_ARENAS  8       /* number of arenas */
+#define ARENA_CHUNK (1<<20) /* arenas grow the heap by multiples of this (bytes) */
+#define MAX_CHUNKS  4096    /* heap pieces chunk_owner[] can map */
+#define TCACHE_MAX  512     /* largest block size kept in a thread cache (bytes) */
+#define TCACHE_BINS ((TCACHE_MAX - MIN_BLOCK) / DSIZE + 1) /* one bin per block size */
+#define TCACHE_FILL 16      /* most blocks kept per thread cache bin */
+#else
+#define NUM_ARENAS  1
+#endif
+
+typedef struct {
+    char *seg_listp[NUM_CLASSES]; /* heads of the size class lists */
+    char *large_listp[FL_COUNT][SL_COUNT]; /* heads of the large block lists */
+    uint32_t fl_bitmap;           /* bit f set if some large_listp[f][] is non-empty */
+    uint32_t sl_bitmap[FL_COUNT]; /* bit s set if large_listp[f][s] is non-empty */
+    char *tail_listp;             /* free blocks that end a heap piece */
+    char *end;                    /* end of the arena's last heap piece */
+#ifdef MM_THREADS
+    pthread_mutex_t lock;
+#endif
+} arena_t;
+
 /* Global variables */
 static char *heap_listp = 0;  /* pointer to first block */  
-static char *free_listp = 0; 
+static arena_t arenas[NUM_ARENAS];
+#ifdef MM_THREADS
+typedef struct {
+    char *bins[TCACHE_BINS];      /* singly linked through the payloads */
+    int count[TCACHE_BINS];
+    unsigned generation;          /* mm_init call the blocks came from */
+} tcache_t;
+
+static __thread arena_t *arena;      /* arena the calling thread works in */
+static __thread arena_t *home_arena; /* arena the calling thread allocates from */
+static __thread tcache_t tcache;     /* the calling thread's freed blocks */
+static __thread int tcache_registered;
+static arena_t *chunk_owner[MAX_CHUNKS]; /* arena of each ARENA_CHUNK of the heap */
+static unsigned next_arena;          /* round robin counter for home_arena */
+static unsigned mm_generation;       /* bumped by mm_init to drop stale tcaches */
+static pthread_key_t tcache_key;     /* flushes a thread's tcache when it exits */
+static pthread_once_t tcache_once = PTHREAD_ONCE_INIT;
+#else
+#define arena (&arenas[0])           /* the only arena */
+#define arena_lock(bp)
+#define arena_unlock()
+#endif
 /* function prototypes for internal helper routines */
 static void *extend_heap(size_t words);
 static void place(void *bp, size_t asize);
@@ -85,37 +189,63 @@ static void *coalesce(void *bp);
 static void printblock(void *bp); 
 static void checkblock(void *bp);
 static void edit_free_list(void *bp, int i); 
-//initializes the alignment padding, proglogue header/footer, epilogue header, and sets up the freelist pointer and the heaplist pointer. It also extends the heap by the CHUNKSIZE/WSIZE
+static char **free_list_head(size_t size);
+static int size_class(size_t asize);
+static void large_index(size_t asize, int *fi, int *si);
+static void *find_large_fit(size_t asize);
+static size_t adjust_size(size_t size);
+static void split_block(void *bp, size_t asize);
+static void *arena_malloc(size_t asize);
+static void arena_free(void *bp);
+static void *resize_in_place(void *ptr, size_t asize, size_t wsize);
+static void *map_block(size_t asize);
+static void *remap_block(void *ptr, size_t size);
+#ifndef MM_THREADS
+static void trim_heap(void *bp);
+#else
+#define trim_heap(bp)   /* arenas share the heap's end, so it stays put */
+static void arena_lock(void *bp);
+static void arena_unlock(void);
+static void *tcache_get(size_t asize);
+static int tcache_put(void *bp);
+static void tcache_flush(void *tc);
+static void tcache_key_init(void);
+#endif
+//resets every arena's free lists. In the single arena mode it also lays down the first heap piece (padding, prologue, a free block and the epilogue in CHUNKSIZE bytes); arenas of the multithreaded mode get theirs on their first malloc.
 /* 
  * mm_init - Initialize the memory manager 
  */
 /* $begin mminit */
 int mm_init(void) 
 {
-    /* create the initial empty heap */
-    if ((heap_listp = mem_sbrk(4*WSIZE)) == NULL)
-	return -1;
-    PUT(heap_listp, 0);                        /* alignment padding */
-    PUT(heap_listp+WSIZE, PACK(OVERHEAD, 1));  /* prologue header */ 
-    PUT(heap_listp+DSIZE, PACK(OVERHEAD, 1));  /* prologue footer */ 
-    PUT(heap_listp+WSIZE+DSIZE, PACK(0, 1));   /* epilogue header */
-    free_listp = NULL;
+    int i;
 
+    for (i = 0; i < NUM_ARENAS; i++) {
+	memset(&arenas[i], 0, sizeof(arenas[i]));
+#ifdef MM_THREADS
+	pthread_mutex_init(&arenas[i].lock, NULL);
+#endif
+    }
+    heap_listp = mem_heap_lo();
+#ifdef MM_THREADS
+    memset(chunk_owner, 0, sizeof(chunk_owner));
+    mm_generation++;
+#else
     /* Extend the empty heap with a free block of CHUNKSIZE bytes */
     if (extend_heap(CHUNKSIZE/WSIZE) == NULL)
 	return -1;
+#endif
     return 0;
 }
 /* $end mminit */
-//my mm_malloc acts very similar to that of the implicit free list as it uses first fit to traverse the free list and finds the first block capable of completing the request and splices the block if it's too large.
+//mm_malloc gives requests of MMAP_THRESHOLD bytes or more a region of their own, so they neither bloat nor fragment the heap. Smaller ones get a block from the calling thread's cache if it has one of the right size, and otherwise searches its arena the way the implicit free list allocator did: find a fit, split it if it is too large, and extend the heap when nothing fits.
 /* 
  * mm_malloc - Allocate a block with at least size bytes of payload 
  */
 /* $begin mmmalloc */
 void *mm_malloc(size_t size) 
 {
-    uint32_t asize;      /* adjusted block size */
-    uint32_t extendsize; /* amount to extend heap if no fit */
+    size_t asize;      /* adjusted block size */
     char *bp;      
     if(!heap_listp)
         mm_init();
@@ -124,82 +254,105 @@ void *mm_malloc(size_t size)
 	return NULL;
 
     /* Adjust block size to include overhead and alignment reqs. */
-    if (size <= DSIZE)
-	asize = DSIZE + OVERHEAD;
-    else
-	asize = DSIZE * ((size + (OVERHEAD) + (DSIZE-1)) / DSIZE);
-    
-    /* Search the free list for a fit */
-    if ((bp = find_fit(asize)) != NULL) {
-	place(bp, asize);
+    asize = adjust_size(size);
+    if (asize >= MMAP_THRESHOLD)
+	return map_block(asize);
+#ifdef MM_THREADS
+    if ((bp = tcache_get(asize)) != NULL)
 	return bp;
-    }
-
-    /* No fit found. Get more memory and place the block */
-    extendsize = MAX(asize,CHUNKSIZE);
-    if ((bp = extend_heap(extendsize/WSIZE)) == NULL)
-	return NULL;
-    place(bp, asize);
-   // mm_checkheap(1); 
+#endif
+    arena_lock(NULL);
+    bp = arena_malloc(asize);
+    arena_unlock();
     return bp;
 } 
 /* $end mmmalloc */
-//mm_free updates the header and footer of the new freed block by changing its allocated bit and the free block is placed at the beginning of the free list using the coaleace function. 
+//mm_free unmaps a block that has a region of its own right away and keeps small blocks in the calling thread's cache while it has room; other blocks go back to the arena that owns them, whichever thread allocated them, where arena_free coalesces them into its free lists.
 /* 
  * mm_free - Free a block 
  */
 /* $begin mmfree */
 void mm_free(void *bp)
 {
-    uint32_t size = GET_SIZE(HDRP(bp));
     if(bp == NULL)
 	return; 
     if(!heap_listp) mm_init();  
-    PUT(HDRP(bp), PACK(size, 0)); 
-    PUT(FTRP(bp), PACK(size, 0));
-   // printf("before coalescing"); 
-   // printblock(bp);    
-    coalesce(bp);
-   // printf("after coalescing"); 
-   // mm_checkheap(2); 
+    if (GET_MMAPPED(HDRP(bp))) {
+	mem_unmap((char *)bp - DSIZE);
+	return;
+    }
+#ifdef MM_THREADS
+    if (tcache_put(bp))
+	return;
+#endif
+    arena_lock(bp);
+    arena_free(bp);
+    arena_unlock();
 }
 
 /* $end mmfree */
 
+//mm_realloc resizes in place whenever resize_in_place can, under the lock of the arena that owns the block; blocks with a region of their own go to remap_block instead. Growing reallocs reserve REALLOC_SLACK extra so a buffer that keeps growing stays in place most of the time, and only when that does not work does it fall back to malloc, copy and free.
 /*
- * mm_realloc - naive implementation of mm_realloc
+ * mm_realloc - Resize a block, in place if at all possible
  */
 void *mm_realloc(void *ptr, size_t size)
 {
     void *newp;
-    size_t copySize;
+    size_t asize;    /* adjusted block size needed for size bytes */
+    size_t wsize;    /* asize plus the reserved slack */
+    size_t csize;    /* current block size */
+
+    if (ptr == NULL)
+	return mm_malloc(size);
+    if (size == 0) {
+	mm_free(ptr);
+	return NULL;
+    }
+    if (GET_MMAPPED(HDRP(ptr)))
+	return remap_block(ptr, size);
+    asize = adjust_size(size);
+    wsize = asize + DSIZE * ((asize >> REALLOC_SLACK) / DSIZE);
+    arena_lock(ptr);
+    csize = GET_SIZE(HDRP(ptr));
+    /* a block that grows past MMAP_THRESHOLD moves to a region of its own */
+    newp = (asize < MMAP_THRESHOLD || asize <= csize) ?
+	resize_in_place(ptr, asize, wsize) : NULL;
+    arena_unlock();
+    if (newp != NULL)
+	return newp;
 
-    if ((newp = mm_malloc(size)) == NULL) {
+    /* No room in place: move the payload to a new block */
+    if ((newp = mm_malloc(wsize - OVERHEAD)) == NULL) {
 	printf("ERROR: mm_malloc failed in mm_realloc\n");
 	exit(1);
     }
-    copySize = GET_SIZE(HDRP(ptr));
-    if (size < copySize)
-      copySize = size;
-    memcpy(newp, ptr, copySize);
+    memcpy(newp, ptr, csize - OVERHEAD);
     mm_free(ptr);
     return newp;
 }
-//this is my checkheap function and what each line does is explained in the line by line comments. 
+//this is my checkheap function and what each line does is explained in the line by line comments. It walks every heap piece from its prologue to its epilogue and then every arena's free lists; blocks sitting in a thread cache count as allocated.
 /* 
  * mm_checkheap - Check the heap for consistency 
  */
 void mm_checkheap(int verbose) 
 {
-    printf("##############: /n");
     int heap_counter = 0, list_counter = 0;
-    char *bp, *cp; 
-    char *go = free_listp+ DSIZE;
+    char *bp, *cp, *go; 
+    char *piece; /* start of the current heap piece */
+    int a, c, fi, si, bfi, bsi;
+    uint32_t prev_alloc;
+    arena_t *ar;
 
+    if (verbose)
+	printf("##############:\n");
     if((heap_listp) != mem_heap_lo()){
 	printf("not correctly started");
 	exit(1);  
 } //checks if the heap list starts at the lowest heap address
+    for (piece = heap_listp; piece < (char *)mem_heap_hi(); piece = bp) {
+    go = piece + DSIZE; /* prologue block */
+    prev_alloc = 1;
     if ((GET_SIZE(HDRP(go)) != DSIZE) || !GET_ALLOC(HDRP(go))){
 	printf("bad prologue HDR"); 
 	exit(1); 
@@ -209,24 +362,104 @@ void mm_checkheap(int verbose)
 	exit(1); 
 } // checks prologue ftr to be 8/1
     checkblock(go);
-	printf(" Walk through heap\n");
+    if (verbose)
+	printf(" Walk through heap piece %p\n", piece);
     for (bp = NEXT_BLKP(go); GET_SIZE(HDRP(bp)) > 0; bp = NEXT_BLKP(bp)) {
 	if (!GET_ALLOC(HDRP(bp))) 
 		heap_counter++;
-	printblock(bp);  
+	if (verbose)
+		printblock(bp);  
 	checkblock(bp);
-    } //goes through heap and checks how many items are on the heap
- 	cp = free_listp; 
-	while(cp != NULL){
-	checkblock(cp);
-	list_counter++;
-	cp = GET_NEXT(cp);
-	printblock(cp); 
-} //goes through free list and counts how many item are on the free list and also checks each block while printing it, which was very useful while debugging 
-	if ((GET_SIZE(HDRP(bp)) != 0) || (!GET_ALLOC(HDRP(bp)))){
+	if (!GET_PREV_ALLOC(HDRP(bp)) != !prev_alloc) {
+		printf("prev alloc bit wrong at %p\n", bp);
+		exit(1);
+	}
+	if (!prev_alloc && !GET_ALLOC(HDRP(bp))) {
+		printf("uncoalesced free blocks at %p\n", bp);
+		exit(1);
+	}
+	prev_alloc = GET_ALLOC(HDRP(bp));
+    } //goes through heap and checks how many items are on the heap, and that every header's prev alloc bit matches the block before it
+	if ((GET_SIZE(HDRP(bp)) != 0) || (!GET_ALLOC(HDRP(bp))) ||
+	    (!GET_PREV_ALLOC(HDRP(bp)) != !prev_alloc)){
 	printf("epilogue");
 	exit(1);
 }    //checks epilogue header 
+    }
+    for (a = 0; a < NUM_ARENAS; a++) {
+    ar = &arenas[a];
+    for (c = 0; c < NUM_CLASSES; c++) {
+	for (cp = ar->seg_listp[c]; cp != NULL; cp = GET_NEXT(cp)) {
+	checkblock(cp);
+	if (GET_ALLOC(HDRP(cp))) {
+		printf("allocated block on free list %d\n", c);
+		exit(1);
+	}
+	if (size_class(GET_SIZE(HDRP(cp))) != c) {
+		printf("block of size %u on wrong class list %d\n", GET_SIZE(HDRP(cp)), c);
+		exit(1);
+	}
+	if (GET_NEXT(cp) && GET_PREV(GET_NEXT(cp)) != cp) {
+		printf("broken prev link on class list %d\n", c);
+		exit(1);
+	}
+#ifdef MM_THREADS
+	if (chunk_owner[(cp - heap_listp) / ARENA_CHUNK] != ar) {
+		printf("block %p on the lists of arena %d it does not belong to\n", cp, a);
+		exit(1);
+	}
+#endif
+	list_counter++;
+	if (verbose)
+		printblock(cp); 
+	}
+    } //goes through every size class list and counts how many item are on the lists and also checks each block is free, belongs to that class and is doubly linked properly, which was very useful while debugging 
+    for (c = 0; c < FL_COUNT * SL_COUNT; c++) {
+	fi = c / SL_COUNT;
+	si = c % SL_COUNT;
+	if ((ar->large_listp[fi][si] != NULL) != !!(ar->sl_bitmap[fi] & (1U << si)) ||
+	    (ar->sl_bitmap[fi] != 0) != !!(ar->fl_bitmap & (1U << fi))) {
+		printf("bitmap out of sync for large list %d/%d\n", fi, si);
+		exit(1);
+	}
+	for (cp = ar->large_listp[fi][si]; cp != NULL; cp = GET_NEXT(cp)) {
+	checkblock(cp);
+	large_index(GET_SIZE(HDRP(cp)), &bfi, &bsi);
+	if (GET_ALLOC(HDRP(cp)) || GET_SIZE(HDRP(cp)) <= LARGE_MIN ||
+	    bfi != fi || bsi != si) {
+		printf("block of size %u on wrong large list %d/%d\n", GET_SIZE(HDRP(cp)), fi, si);
+		exit(1);
+	}
+	if (GET_NEXT(cp) && GET_PREV(GET_NEXT(cp)) != cp) {
+		printf("broken prev link on large list %d/%d\n", fi, si);
+		exit(1);
+	}
+#ifdef MM_THREADS
+	if (chunk_owner[(cp - heap_listp) / ARENA_CHUNK] != ar) {
+		printf("block %p on the lists of arena %d it does not belong to\n", cp, a);
+		exit(1);
+	}
+#endif
+	list_counter++;
+	if (verbose)
+		printblock(cp); 
+	}
+    } //does the same for the large block lists and checks that the bitmaps mark every non-empty list
+    for (cp = ar->tail_listp; cp != NULL; cp = GET_NEXT(cp)) {
+	checkblock(cp);
+	if (GET_ALLOC(HDRP(cp)) || GET_SIZE(HDRP(NEXT_BLKP(cp))) != 0) {
+		printf("block %p on the tail list is not a free block before an epilogue\n", cp);
+		exit(1);
+	}
+	if (GET_NEXT(cp) && GET_PREV(GET_NEXT(cp)) != cp) {
+		printf("broken prev link on the tail list\n");
+		exit(1);
+	}
+	list_counter++;
+	if (verbose)
+		printblock(cp); 
+    } //and that the tail list holds only the free blocks at the end of a heap piece
+    }
 	if(heap_counter != list_counter){
 	printf("counter !=\n");
 	exit(1); 
@@ -234,7 +467,7 @@ void mm_checkheap(int verbose)
 }
 
 /* The remaining routines are internal helper routines */
-//extends the heap by a double word size aligned value by invoking the mem_sbrk function 
+//extends the heap by a double word size aligned value by invoking the mem_sbrk function. If the new memory does not directly follow the arena's last piece (the first extension, or another arena grew the heap in between) it gets its own padding, prologue and epilogue, so coalescing never crosses into memory of another arena. The multithreaded mode only takes whole ARENA_CHUNKs, which is what keeps chunk_owner[] exact.
 /* 
  * extend_heap - Extend heap with free block and return its block pointer
  */
@@ -242,18 +475,44 @@ void mm_checkheap(int verbose)
 static void *extend_heap(size_t words) 
 {
     char *bp;
-    uint32_t size;
+    uint32_t size, prev;
+#ifdef MM_THREADS
+    uint32_t off;
+#endif
 	
     /* Allocate an even number of words to maintain alignment */
     size = (words % 2) ? (words+1) * WSIZE : words * WSIZE;
-    if(size < 24) 
-       size = 24; 
+    if(size < MIN_BLOCK) 
+       size = MIN_BLOCK; 
+#ifdef MM_THREADS
+    /* leave room for a new prologue and epilogue, in whole chunks */
+    size = (size + 2*DSIZE + ARENA_CHUNK - 1) & ~(ARENA_CHUNK - 1);
+#endif
     if ((bp = mem_sbrk(size)) == (void *)-1) 
 	return NULL;
+#ifdef MM_THREADS
+    if ((bp - heap_listp + size) / ARENA_CHUNK > MAX_CHUNKS) {
+	printf("ERROR: heap larger than MAX_CHUNKS arena chunks\n");
+	exit(1);
+    }
+    for (off = 0; off < size; off += ARENA_CHUNK)
+	chunk_owner[(bp - heap_listp + off) / ARENA_CHUNK] = arena;
+#endif
+    if (bp != arena->end) {
+	PUT(bp, 0);                                /* alignment padding */
+	PUT(bp+WSIZE, PACK(DSIZE, 1|PREV_ALLOC));  /* prologue header */ 
+	PUT(bp+DSIZE, PACK(DSIZE, 1|PREV_ALLOC));  /* prologue footer */ 
+	bp += 2*DSIZE;
+	size -= 2*DSIZE;
+	PUT(HDRP(bp), PACK(0, 1|PREV_ALLOC));      /* stands in for an old epilogue */
+    }
+    arena->end = bp + size;
 
-    /* Initialize free block header/footer and the epilogue header */
-    PUT(HDRP(bp), PACK(size, 0));         /* free block header */
-    PUT(FTRP(bp), PACK(size, 0));         /* free block footer */
+    /* Initialize free block header/footer and the epilogue header;
+       the old epilogue header knows whether the last block is allocated */
+    prev = GET_PREV_ALLOC(HDRP(bp));
+    PUT(HDRP(bp), PACK(size, prev));      /* free block header */
+    PUT(FTRP(bp), PACK(size, prev));      /* free block footer */
     PUT(HDRP(NEXT_BLKP(bp)), PACK(0, 1)); /* new epilogue header */ 
     /* Coalesce if the previous block was free */
     return coalesce(bp);
@@ -270,59 +529,101 @@ static void place(void *bp, size_t asize)
 /* $end mmplace-proto */
 {
     uint32_t csize = GET_SIZE(HDRP(bp));    
+    uint32_t prev = GET_PREV_ALLOC(HDRP(bp));
     edit_free_list(bp, 0); 	
-    if ((csize - asize) >= (DSIZE*3)) { 
-	PUT(HDRP(bp), PACK(asize, 1));
-	PUT(FTRP(bp), PACK(asize, 1));	 
+    if ((csize - asize) >= MIN_BLOCK) { 
+	PUT(HDRP(bp), PACK(asize, 1|prev));
 	bp = NEXT_BLKP(bp);
-	PUT(HDRP(bp), PACK(csize - asize, 0));
-	PUT(FTRP(bp), PACK(csize - asize, 0));
+	PUT(HDRP(bp), PACK(csize - asize, PREV_ALLOC));
+	PUT(FTRP(bp), PACK(csize - asize, PREV_ALLOC));
 	edit_free_list(bp,1);  
     }
     else { 
-	PUT(HDRP(bp), PACK(csize, 1));
-	PUT(FTRP(bp), PACK(csize, 1));  	 
+	PUT(HDRP(bp), PACK(csize, 1|prev));
+	SET_PREV_ALLOC(HDRP(NEXT_BLKP(bp)));
     }
   
 }
 /* $end mmplace */
-//this find fit simply traverses the free list and seeks the first free block that is able to accomodate for the requested asize, but in order to increase the kpops for the binary files, which repeatedly request the same size, I created this conditional that just requests for a heap extension once the requested hasn't been fulfilled more than 40 times. 
+//find_fit walks the small size class that asize falls in, since blocks there may still be too small, and then takes the head of the first non-empty larger class, where every block is big enough. Requests above LARGE_MIN, and small ones that found nothing, go to the two-level index, and only then to the blocks at the end of the heap pieces, so they stay whole for as long as possible. The old trick of extending the heap after 40 identical requests in a row is gone: with segregated lists those requests no longer walk a long list, and the tiny blocks it appended at the end of the heap kept realloc from growing the last block in place.
 /* 
  * find_fit - Find a fit for a block with asize bytes 
  */
 static void *find_fit(size_t asize)
 { 
-    /* first fit search */
-    void *fp = free_listp; 
-    static int size = 0;
-    static int count = 0;
-  if( size == (int)asize){
-      if(count>40){  
-        int extendsize = MAX(asize, 4 * WSIZE);
-        fp = extend_heap(extendsize/4);
-        return fp;
-      }
-      else
-        count++;
-  }
-  else
-    count = 0;
-    while(fp){
-	if(asize <= GET_SIZE(HDRP(fp))){ 
-		size = asize; 
+    int c;
+    void *fp;
+
+    if (asize <= LARGE_MIN) {
+	c = size_class(asize);
+	/* first fit search within asize's own class */
+	for (fp = arena->seg_listp[c]; fp != NULL; fp = GET_NEXT(fp)) {
+	    if (asize <= GET_SIZE(HDRP(fp)))
 		return fp;
-}
-	fp = GET_NEXT(fp); 
-}
+	}
+	/* any block in a larger class fits */
+	for (c++; c < NUM_CLASSES; c++) {
+	    if (arena->seg_listp[c] != NULL)
+		return arena->seg_listp[c];
+	}
+    }
+    if ((fp = find_large_fit(asize)) != NULL)
+	return fp;
+    /* last, the end of a heap piece, one block per piece */
+    for (fp = arena->tail_listp; fp != NULL; fp = GET_NEXT(fp)) {
+	if (asize <= GET_SIZE(HDRP(fp)))
+	    return fp;
+    }
     return NULL; /* no fit */
 }
+//find_large_fit looks for the best fit on asize's own second-level list, whose blocks may still be too small, and stops early at an exact fit. Every list after that one holds only blocks that fit, so the bitmaps jump straight to the smallest non-empty one and its head is taken.
+/*
+ * find_large_fit - Find a fit for asize bytes in the large block index
+ */
+static void *find_large_fit(size_t asize)
+{
+    int fi = 0, si = 0;
+    uint32_t map;
+    char *fp, *best = NULL;
+    size_t size, bsize = 0;
+
+    if (asize > LARGE_MIN) {
+	large_index(asize, &fi, &si);
+	for (fp = arena->large_listp[fi][si]; fp != NULL; fp = GET_NEXT(fp)) {
+	    size = GET_SIZE(HDRP(fp));
+	    if (size == asize)
+		return fp;
+	    if (asize < size && (best == NULL || size < bsize)) {
+		best = fp;
+		bsize = size;
+	    }
+	}
+	if (best != NULL)
+	    return best;
+	if (++si == SL_COUNT) {
+	    si = 0;
+	    if (++fi == FL_COUNT)
+		return NULL;
+	}
+    }
+
+    map = arena->sl_bitmap[fi] & (~0U << si);
+    if (map == 0) {
+	map = arena->fl_bitmap & (~0U << (fi + 1));
+	if (map == 0)
+	    return NULL; /* no fit */
+	fi = __builtin_ctz(map);
+	map = arena->sl_bitmap[fi];
+    }
+    return arena->large_listp[fi][__builtin_ctz(map)];
+}
 //the coalesce function plays a huge role in utilization as it allows for consecutive free blocks to be combined and it is called when ever a block is freed in order to provide maximum utilization 
 /*
  * coalesce - boundary tag coalescing. Return ptr to coalesced block
  */
 static void *coalesce(void *bp) 
 {
-    uint32_t prev_alloc = GET_ALLOC(FTRP(PREV_BLKP(bp))) || PREV_BLKP(bp) == bp;
+    uint32_t prev_alloc = GET_PREV_ALLOC(HDRP(bp));
     uint32_t next_alloc = GET_ALLOC(HDRP(NEXT_BLKP(bp)));
     uint32_t size = GET_SIZE(HDRP(bp));
     if(prev_alloc && next_alloc){
@@ -331,26 +632,27 @@ static void *coalesce(void *bp)
  else  if (prev_alloc && !next_alloc) {      /* Case 2 */
 	size += GET_SIZE(HDRP(NEXT_BLKP(bp)));
 	edit_free_list(NEXT_BLKP(bp), 0); 
-	PUT(HDRP(bp), PACK(size, 0));
-	PUT(FTRP(bp), PACK(size,0));
+	PUT(HDRP(bp), PACK(size, PREV_ALLOC));
+	PUT(FTRP(bp), PACK(size, PREV_ALLOC));
     }
 
     else if (!prev_alloc && next_alloc) {      /* Case 3 */
 	size += GET_SIZE(HDRP(PREV_BLKP(bp)));
 	bp = PREV_BLKP(bp);
-	PUT(HDRP(bp), PACK(size, 0));
-        PUT(FTRP(bp), PACK(size, 0));
-        edit_free_list(bp,0); 
+        edit_free_list(bp,0); /* unlink while the old size picks its class */
+	PUT(HDRP(bp), PACK(size, PREV_ALLOC));
+        PUT(FTRP(bp), PACK(size, PREV_ALLOC));
     }
     else if(!prev_alloc && !next_alloc)  {      /* Case 4 */
 	size += GET_SIZE(HDRP(PREV_BLKP(bp))) + GET_SIZE(FTRP(NEXT_BLKP(bp))); 
 	edit_free_list(NEXT_BLKP(bp), 0); 	
-        PUT(HDRP(PREV_BLKP(bp)), PACK(size, 0));
-        PUT(FTRP(PREV_BLKP(bp)), PACK(size, 0));
         bp = PREV_BLKP(bp);
 	edit_free_list(bp, 0); 
+        PUT(HDRP(bp), PACK(size, PREV_ALLOC));
+        PUT(FTRP(bp), PACK(size, PREV_ALLOC));
     }
     
+    CLR_PREV_ALLOC(HDRP(NEXT_BLKP(bp)));
     edit_free_list(bp, 1); 
     return bp;
 }
@@ -362,19 +664,24 @@ static void printblock(void *bp)
 
     hsize = GET_SIZE(HDRP(bp));
     halloc = GET_ALLOC(HDRP(bp));  
-    fsize = GET_SIZE(FTRP(bp));
-    falloc = GET_ALLOC(FTRP(bp));  
     
     if (hsize == 0) {
 	printf("%p: EOL\n", bp);
 	return;
     }
+    if (halloc) {
+	printf("%p: header: [%d:a:%c]\n", bp, hsize,
+	       (GET_PREV_ALLOC(HDRP(bp)) ? 'a' : 'f'));
+	return;
+    }
+    fsize = GET_SIZE(FTRP(bp));
+    falloc = GET_ALLOC(FTRP(bp));  
 
     printf("%p: header: [%d:%c] footer: [%d:%c]\n", bp, 
 	   hsize, (halloc ? 'a' : 'f'), 
 	   fsize, (falloc ? 'a' : 'f')); 
 }
-//checks if the block is in the heap, if the block has been linked/coalesced properly, and if the header is equal to the footer and  and if it is aligned 
+//checks if the block is in the heap, if the block has been linked/coalesced properly, and if a free block's header is equal to its footer and  and if it is aligned 
 static void checkblock(void *bp) {
     if (!(bp <= mem_heap_hi() && bp >= mem_heap_lo())){
 	printf("Not in heap\n");
@@ -384,28 +691,326 @@ static void checkblock(void *bp) {
 	printf("Not in alignment");
     	exit(1);
 	}
-   if(GET(HDRP(bp)) != GET(FTRP(bp))){
+   if(!GET_ALLOC(HDRP(bp)) && GET(HDRP(bp)) != GET(FTRP(bp))){
 	printf("header not equal to foot");
 	exit(1);
 }
 }
-//this function is used to add or remove from the free list and if the input for the in is 0, the requested item will be removed and for any other integer, the requested item will be added to the free list
+//adjusts a payload size to a block size that includes the header overhead, is double word aligned and can hold a free block once it is freed
+static size_t adjust_size(size_t size)
+{
+    return MAX(MIN_BLOCK, DSIZE * ((size + (OVERHEAD) + (DSIZE-1)) / DSIZE));
+}
+//shrinks the allocated block bp to asize bytes if the leftover is at least the minimum block size, and frees the leftover so it can coalesce with whatever follows it
+static void split_block(void *bp, size_t asize)
+{
+    size_t csize = GET_SIZE(HDRP(bp));
+
+    if (csize < asize + MIN_BLOCK)
+	return;
+    PUT(HDRP(bp), PACK(asize, 1|GET_PREV_ALLOC(HDRP(bp))));
+    bp = NEXT_BLKP(bp);
+    PUT(HDRP(bp), PACK(csize - asize, PREV_ALLOC));
+    PUT(FTRP(bp), PACK(csize - asize, PREV_ALLOC));
+    coalesce(bp);
+}
+//returns the index of the size class list that a block of asize bytes belongs on
+static int size_class(size_t asize)
+{
+    int c;
+
+    if (asize <= MINCLASS)
+	return 0;
+    /* ceil(log2(asize)) - log2(MINCLASS), clamped to the last class */
+    c = 32 - __builtin_clz((uint32_t)asize - 1) - MINCLASS_SHIFT;
+    return (c < NUM_CLASSES) ? c : NUM_CLASSES - 1;
+}
+//returns the first- and second-level index of the large block list that a block of asize (> LARGE_MIN) bytes belongs on
+static void large_index(size_t asize, int *fi, int *si)
+{
+    int fl = 31 - __builtin_clz((uint32_t)asize); /* floor(log2(asize)) */
+
+    *fi = fl - FL_SHIFT;
+    *si = (asize >> (fl - SL_SHIFT)) & (SL_COUNT - 1);
+}
+//returns the head of the free list that a block of size bytes belongs on
+static char **free_list_head(size_t size)
+{
+    int fi, si;
+
+    if (size <= LARGE_MIN)
+	return &arena->seg_listp[size_class(size)];
+    large_index(size, &fi, &si);
+    return &arena->large_listp[fi][si];
+}
+//this function is used to add or remove from the free lists and if the input for the in is 0, the requested item will be removed and for any other integer, the requested item will be added to the front of the list for its size class. Large blocks go on their two-level list, whose bitmap bits are set here when it stops being empty and cleared when it becomes empty. A block followed by an epilogue goes on tail_listp instead; it may stop being last while it is free (extend_heap writes the next block over the epilogue before coalescing), so a block is found to be on tail_listp when it is removed by being its head, and otherwise only its neighbours are relinked.
 static void edit_free_list(void *bp, int i){
+	char **headp;
+	int li;
+	if (i != 0 ? GET_SIZE(HDRP(NEXT_BLKP(bp))) == 0 : arena->tail_listp == bp)
+		headp = &arena->tail_listp;
+	else
+		headp = free_list_head(GET_SIZE(HDRP(bp)));
+	li = headp - &arena->large_listp[0][0]; /* large list number, if it is one */
 	if(i != 0){
-	if(free_listp){
-        SET_PREV(free_listp, bp);
-        SET_NEXT(bp, free_listp);
-} else 
-	SET_NEXT(bp, NULL); 
+	SET_NEXT(bp, *headp);
 	SET_PREV(bp, NULL);
-	free_listp = bp; 
+	if(*headp)
+		SET_PREV(*headp, bp);
+	*headp = bp; 
 
 } else{  
 	if(GET_PREV(bp)) 
 		SET_NEXT(GET_PREV(bp), GET_NEXT(bp)); 
 	else
-		free_listp = GET_NEXT(bp); 
+		*headp = GET_NEXT(bp); 
 	if(GET_NEXT(bp)) 
 		SET_PREV(GET_NEXT(bp), GET_PREV(bp)); 	
 }
+	if (li >= 0 && li < FL_COUNT * SL_COUNT) {
+		if (i != 0) {
+			arena->sl_bitmap[li >> SL_SHIFT] |= 1U << (li & (SL_COUNT-1));
+			arena->fl_bitmap |= 1U << (li >> SL_SHIFT);
+		} else if (*headp == NULL) {
+			arena->sl_bitmap[li >> SL_SHIFT] &= ~(1U << (li & (SL_COUNT-1)));
+			if (arena->sl_bitmap[li >> SL_SHIFT] == 0)
+				arena->fl_bitmap &= ~(1U << (li >> SL_SHIFT));
+		}
+	}
+}
+//searches the current arena for a fit for asize bytes, extending the heap when there is none, and places the block. The heap grows by what a free last block is short of, but by at least EXTEND_MIN: growing by whole CHUNKSIZEs left most of the last one unused at the peak (50k of binary2-bal's).
+static void *arena_malloc(size_t asize)
+{
+    size_t extendsize; /* amount to extend heap if no fit */
+    char *bp;
+
+    /* Search the free list for a fit */
+    if ((bp = find_fit(asize)) != NULL) {
+	place(bp, asize);
+	return bp;
+    }
+
+    /* No fit found. Get more memory and place the block */
+    extendsize = asize;
+#ifndef MM_THREADS
+    /* the heap is one piece, so that is its free last block, if any */
+    if (arena->tail_listp != NULL)
+	extendsize -= GET_SIZE(HDRP(arena->tail_listp));
+#endif
+    extendsize = MAX(extendsize, EXTEND_MIN);
+    if ((bp = extend_heap(extendsize/WSIZE)) == NULL)
+	return NULL;
+    place(bp, asize);
+    return bp;
+}
+//updates the header and footer of the freed block by clearing its allocated bit, and coalesce puts the result at the front of its free list in the current arena. If that leaves a large free block at the end of the heap, trim_heap gives most of it back.
+static void arena_free(void *bp)
+{
+    uint32_t size, prev;
+
+    size = GET_SIZE(HDRP(bp));
+    prev = GET_PREV_ALLOC(HDRP(bp));
+    PUT(HDRP(bp), PACK(size, prev)); 
+    PUT(FTRP(bp), PACK(size, prev));
+    bp = coalesce(bp);
+    trim_heap(bp);
+}
+//resizes ptr to at least asize bytes without moving it and returns ptr, or NULL if that is not possible: a shrink just splits off the tail, a grow first absorbs a free successor and, if the block is the last one before the epilogue, asks mem_sbrk for only the missing bytes up to wsize. The multithreaded mode skips that last step, since its arenas only ever take whole chunks from mem_sbrk.
+static void *resize_in_place(void *ptr, size_t asize, size_t wsize)
+{
+    void *next;
+    size_t csize;    /* current block size */
+    size_t nsize;    /* size of a free successor, 0 if allocated */
+    int last;        /* is the block (or its free successor) the last one? */
+
+    csize = GET_SIZE(HDRP(ptr));
+
+    /* Shrinking: split off the tail and give it back */
+    if (asize <= csize) {
+	split_block(ptr, asize);
+	return ptr;
+    }
+
+    next = NEXT_BLKP(ptr);
+    nsize = GET_ALLOC(HDRP(next)) ? 0 : GET_SIZE(HDRP(next));
+#ifdef MM_THREADS
+    last = 0;
+#else
+    last = (nsize ? GET_SIZE(HDRP(NEXT_BLKP(next))) : GET_SIZE(HDRP(next))) == 0;
+#endif
+
+    /* Absorb the free successor if that is enough */
+    if (nsize && csize + nsize >= asize && !(last && csize + nsize < wsize)) {
+	edit_free_list(next, 0);
+	PUT(HDRP(ptr), PACK(csize + nsize, 1|GET_PREV_ALLOC(HDRP(ptr))));
+	SET_PREV_ALLOC(HDRP(NEXT_BLKP(ptr)));
+	split_block(ptr, wsize);
+	return ptr;
+    }
+
+    /* Last block before the epilogue: sbrk only the missing bytes */
+    if (last) {
+	if (mem_sbrk(wsize - csize - nsize) == (void *)-1)
+	    return NULL;
+	arena->end += wsize - csize - nsize;
+	if (nsize)
+	    edit_free_list(next, 0);
+	PUT(HDRP(ptr), PACK(wsize, 1|GET_PREV_ALLOC(HDRP(ptr))));
+	PUT(HDRP(NEXT_BLKP(ptr)), PACK(0, 1|PREV_ALLOC)); /* new epilogue header */
+	return ptr;
+    }
+    return NULL;
+}
+//gives a block of asize bytes a mem_map region of its own, laid out like the start of the heap: a padding word, then a header with MMAPPED set and the region's size, so the payload is aligned the same way. The header is a word, so a region past MAP_MAX is refused rather than given a size that mm_free and remap_block would get wrong.
+static void *map_block(size_t asize)
+{
+    size_t page = mem_pagesize();
+    size_t size;
+    char *p;
+
+    if (asize > MAP_MAX - page)
+	return NULL;
+    size = (asize + WSIZE + page - 1) / page * page;
+    if ((p = mem_map(size)) == (void *)-1)
+	return NULL;
+    PUT(p, 0);                             /* alignment padding */
+    PUT(p + WSIZE, PACK(size, 1|MMAPPED)); /* header */
+    return p + DSIZE;
+}
+//resizes the region of a mapped block with mem_remap, which moves page table entries instead of copying the payload. Like a heap block it grows with REALLOC_SLACK to spare, as far as MAP_MAX allows, and it keeps its region while the new size still fits. A block that shrinks below MMAP_THRESHOLD goes back to the heap.
+static void *remap_block(void *ptr, size_t size)
+{
+    size_t asize = adjust_size(size);
+    size_t csize = GET_SIZE(HDRP(ptr));
+    size_t page = mem_pagesize();
+    size_t rsize;
+    char *p;
+
+    if (asize < MMAP_THRESHOLD) {
+	if ((p = mm_malloc(size)) == NULL)
+	    return NULL;
+	memcpy(p, ptr, size);
+	mem_unmap((char *)ptr - DSIZE);
+	return p;
+    }
+    if (asize > MAP_MAX - page)
+	return NULL;
+    if (asize + WSIZE <= csize && asize >= csize / 2)
+	return ptr;
+    if (asize + WSIZE > csize) {
+	asize += DSIZE * ((asize >> REALLOC_SLACK) / DSIZE);
+	if (asize > MAP_MAX - page)
+	    asize = MAP_MAX - page;
+    }
+    rsize = (asize + WSIZE + page - 1) / page * page;
+    if ((p = mem_remap((char *)ptr - DSIZE, rsize)) == (void *)-1)
+	return NULL;
+    PUT(p + WSIZE, PACK(rsize, 1|MMAPPED));
+    return p + DSIZE;
+}
+#ifndef MM_THREADS
+//shrinks the heap when the free block bp is the last one and larger than TRIM_THRESHOLD, keeping CHUNKSIZE bytes of it so the next malloc does not have to extend the heap right away. Memlib returns the released pages to the system.
+static void trim_heap(void *bp)
+{
+    size_t size = GET_SIZE(HDRP(bp));
+    size_t trim = size - CHUNKSIZE;
+
+    if (size < TRIM_THRESHOLD || GET_SIZE(HDRP(NEXT_BLKP(bp))) != 0)
+	return;
+    edit_free_list(bp, 0);
+    if (mem_sbrk(-(int)trim) == (void *)-1) {
+	edit_free_list(bp, 1);
+	return;
+    }
+    arena->end -= trim;
+    size -= trim;
+    PUT(HDRP(bp), PACK(size, GET_PREV_ALLOC(HDRP(bp))));
+    PUT(FTRP(bp), PACK(size, GET_PREV_ALLOC(HDRP(bp))));
+    PUT(HDRP(NEXT_BLKP(bp)), PACK(0, 1)); /* new epilogue header */
+    edit_free_list(bp, 1);
+}
+#else
+//makes the arena that owns bp the calling thread's current arena and takes its lock. A NULL bp picks the thread's home arena instead, handed out round robin the first time the thread allocates.
+static void arena_lock(void *bp)
+{
+    if (bp != NULL)
+	arena = chunk_owner[((char *)bp - heap_listp) / ARENA_CHUNK];
+    else {
+	if (home_arena == NULL)
+	    home_arena = &arenas[__sync_fetch_and_add(&next_arena, 1) % NUM_ARENAS];
+	arena = home_arena;
+    }
+    pthread_mutex_lock(&arena->lock);
+}
+//releases the lock of the current arena
+static void arena_unlock(void)
+{
+    pthread_mutex_unlock(&arena->lock);
+}
+//pops a cached block of exactly asize bytes off the calling thread's cache, or returns NULL. Blocks cached before the last mm_init belong to a heap that no longer exists and are dropped.
+static void *tcache_get(size_t asize)
+{
+    int b = (asize - MIN_BLOCK) / DSIZE;
+    char *bp;
+
+    if (asize > TCACHE_MAX)
+	return NULL;
+    if (tcache.generation != mm_generation) {
+	memset(&tcache, 0, sizeof(tcache));
+	tcache.generation = mm_generation;
+    }
+    if ((bp = tcache.bins[b]) == NULL)
+	return NULL;
+    tcache.bins[b] = GET_NEXT(bp);
+    tcache.count[b]--;
+    return bp;
+}
+//pushes the allocated block bp onto the calling thread's cache and returns 1, or returns 0 if it is too large or its bin is full. The block stays marked allocated, so nothing coalesces with it while it is cached. Its header is read without the arena lock; the arena may flip the header's PREV_ALLOC bit meanwhile, but never the size.
+static int tcache_put(void *bp)
+{
+    size_t size = GET_SIZE(HDRP(bp));
+    int b = (size - MIN_BLOCK) / DSIZE;
+
+    if (size > TCACHE_MAX)
+	return 0;
+    if (tcache.generation != mm_generation) {
+	memset(&tcache, 0, sizeof(tcache));
+	tcache.generation = mm_generation;
+    }
+    if (tcache.count[b] == TCACHE_FILL)
+	return 0;
+    if (!tcache_registered) {
+	pthread_once(&tcache_once, tcache_key_init);
+	pthread_setspecific(tcache_key, &tcache);
+	tcache_registered = 1;
+    }
+    SET_NEXT(bp, tcache.bins[b]);
+    tcache.bins[b] = bp;
+    tcache.count[b]++;
+    return 1;
+}
+//gives every block in an exiting thread's cache back to the arena that owns it
+static void tcache_flush(void *tc)
+{
+    tcache_t *t = tc;
+    char *bp;
+    int b;
+
+    if (t->generation != mm_generation)
+	return;
+    for (b = 0; b < TCACHE_BINS; b++) {
+	while ((bp = t->bins[b]) != NULL) {
+	    t->bins[b] = GET_NEXT(bp);
+	    arena_lock(bp);
+	    arena_free(bp);
+	    arena_unlock();
+	}
+	t->count[b] = 0;
+    }
+}
+//creates the key whose destructor flushes a thread's cache when the thread exits
+static void tcache_key_init(void)
+{
+    pthread_key_create(&tcache_key, tcache_flush);
 }
+#endif
@@ -0,0 +1,76 @@
+#!/usr/bin/perl 
+#!/usr/local/bin/perl 
+use Getopt::Std;
+
+#######################################################################
+# rep2bin - convert a Malloc Lab trace file to the binary trace format.
+#
+# This script reads a text trace (.rep) on stdin and writes the same
+# trace in the binary format that mdriver maps into memory instead of
+# parsing. The binary file holds the 8 byte magic "MLTRACE1", the four
+# header values as 32-bit little endian integers, and then num_ops
+# records of three such integers each: the request type (0 = a,
+# 1 = f, 2 = r), the id and the size in bytes (0 for frees).
+#
+#######################################################################
+
+#
+# void usage(void) - print help message and terminate
+#
+sub usage 
+{
+    printf STDERR "$_[0]\n";
+    printf STDERR "Usage: $0 [-h] < file.rep > file.bin\n";
+    printf STDERR "Options:\n";
+    printf STDERR "  -h          Print this message\n";
+    die "\n" ;
+}
+
+##############
+# Main routine
+##############
+
+getopts('h');
+if ($opt_h) {
+    usage("");
+}
+binmode STDOUT;
+
+# Read the trace header values
+for ($i = 0; $i < 4; $i++) {
+    $header[$i] = <STDIN>;
+    chomp($header[$i]);
+}
+($heap_size, $num_ids, $num_ops, $weight) = @header;
+
+%TYPE = ("a" => 0, "f" => 1, "r" => 2);
+$linenum = 4;
+$requestnum = 0;
+$ops = "";
+while ($line = <STDIN>) {
+    chomp($line);
+    $linenum++;
+
+    ($cmd, $id, $size) = split(" ", $line);
+
+    # ignore blank lines
+    if (!$cmd) {
+	next;
+    }
+    if (!exists($TYPE{$cmd})) {
+	die "$0: ERROR[$linenum]: bogus request type $cmd\n";
+    }
+    if ($id < 0 or $id >= $num_ids) {
+	die "$0: ERROR[$linenum]: id $id out of range\n";
+    }
+    $size = 0 unless $size;
+    $ops .= pack("V3", $TYPE{$cmd}, $id, $size);
+    $requestnum++;
+}
+if ($requestnum != $num_ops) {
+    die "$0: ERROR: header says $num_ops requests, found $requestnum\n";
+}
+
+print "MLTRACE1";
+print pack("V4", $heap_size, $num_ids, $num_ops, $weight);
+print $ops;
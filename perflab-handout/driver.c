@@ -26,17 +26,20 @@
 #include "fcyc.h"
 #include "defs.h"
 #include "config.h"
+#include "pool.h"
+#include "planes.h"
+#include "bench.h"
 
 /* Team structure that identifies the students */
 extern team_t team; 
 
 /* Keep track of a number of different test functions */
 #define MAX_BENCHMARKS 100
-#define DIM_CNT 5
+#define DIM_CNT 5    /* default number of dimensions */
+#define MAX_DIMS 16  /* most dimensions that -D can ask for */
 
 /* Misc constants */
 #define BSIZE 32     /* cache block size in bytes */     
-#define MAX_DIM 10240 /* 1024 + 256 */
 
 /* fast versions of min and max */
 #define min(a,b) (a < b ? a : b)
@@ -45,18 +48,40 @@ extern team_t team;
 /* This struct characterizes the results for one benchmark test */
 typedef struct {
     lab_test_func tfunct; /* The test function */
-    double cpes[DIM_CNT]; /* One CPE result for each dimension */
+    double cpes[MAX_DIMS]; /* One CPE result for each dimension */
+    perf_counts_t perf[MAX_DIMS]; /* And its counters, if read (-c) */
+    bench_result_t stats[MAX_DIMS]; /* And its median and CI (-S) */
     char *description;    /* ASCII description of the test function */
     unsigned short valid; /* The function is tested if this is non zero */
 } bench_t;
 
-/* The range of image dimensions that we will be testing */
-static int test_dim_rotate[] = {64, 128, 256, 512, 1024};
-static int test_dim_smooth[] = {64, 128, 256, 512, 1024};
+/* The range of image dimensions that we will be testing (see -D) */
+static int test_dim_rotate[MAX_DIMS] = {64, 128, 256, 512, 1024};
+static int test_dim_smooth[MAX_DIMS] = {64, 128, 256, 512, 1024};
+static int dim_cnt = DIM_CNT;
 
-/* Baseline CPEs (see config.h) */
-static double rotate_baseline_cpes[] = {R64, R128, R256, R512, R1024};
-static double smooth_baseline_cpes[] = {S32, S64, S128, S256, S512};
+/* 
+ * Baseline CPEs (see config.h), for the default dimensions only, or
+ * measured on this machine for the test dimensions (-B)
+ */
+static int baseline_dims[MAX_DIMS] = {64, 128, 256, 512, 1024};
+static double rotate_baseline_cpes[MAX_DIMS] = {R64, R128, R256, R512, R1024};
+static double smooth_baseline_cpes[MAX_DIMS] = {S32, S64, S128, S256, S512};
+static int baseline_cnt = DIM_CNT;
+
+/* 
+ * Odd and prime dimensions that every version is checked on before it
+ * is timed, unless in autograder mode, where the lab promises the
+ * students multiples of 32
+ */
+static int odd_dims[] = {1, 2, 3, 17, 97, 257, 521};
+static int check_odd = 1;
+
+/* Read the performance counters while timing (-c) */
+static int run_perf = 0;
+
+/* Time with the statistical harness in bench.h instead of K-best (-S) */
+static int run_stats = 0;
 
 /* These hold the results for all benchmarks */
 static bench_t benchmarks_rotate[MAX_BENCHMARKS];
@@ -68,11 +93,16 @@ static int smooth_benchmark_count = 0;
 
 /* 
  * An image is a dimxdim matrix of pixels stored in a 1D array.  The
- * data array holds three images (the input original, a copy of the original, 
- * and the output result array. There is also an additional BSIZE bytes
- * of padding for alignment to cache block boundaries.
+ * data buffer holds three images (the input original, a copy of the
+ * original, and the output result array), each of them starting on an
+ * image_align byte boundary (see -A) and then image_pad bytes further
+ * on (see -O), so that the cache sets of the images can be made not
+ * to line up. data grows with the largest dimension asked for.
  */
-static pixel data[(3*MAX_DIM*MAX_DIM) + (BSIZE/sizeof(pixel))];
+static char *data = NULL;
+static size_t data_size = 0;
+static int image_align = BSIZE;
+static int image_pad = 0;
 
 /* Various image pointers */
 static pixel *orig = NULL;         /* original image */
@@ -116,19 +146,28 @@ static int random_in_interval(int low, int high)
 }
 
 /*
- * create - creates a dimxdim image aligned to a BSIZE byte boundary
+ * create - creates a dimxdim image aligned to an image_align byte
+ *     boundary plus image_pad bytes
  */
 static void create(int dim)
 {
     int i, j;
-
-    /* Align the images to BSIZE byte boundaries */
-    orig = data;
-    while ((unsigned long)orig % BSIZE) {
-      orig = (pixel*)(((char*)orig)+1);
+    size_t image = (size_t)dim * dim * sizeof(pixel);
+    size_t stride = (image + image_align - 1) / image_align * image_align 
+	+ image_pad;
+
+    /* Align the images to image_align byte boundaries */
+    if (3*stride + image_align > data_size) {
+	free(data);
+	data_size = 3*stride + image_align;
+	if (posix_memalign((void **)&data, image_align, data_size)) {
+	    printf("Can't allocate the images for dimension %d\n", dim);
+	    exit(EXIT_FAILURE);
+	}
     }
-    result = orig + dim*dim;
-    copy_of_orig = result + dim*dim;
+    orig = (pixel *)(data + image_pad);
+    result = (pixel *)((char *)orig + stride);
+    copy_of_orig = (pixel *)((char *)result + stride);
 
     for (i = 0; i < dim; i++) {
 	for (j = 0; j < dim; j++) {
@@ -294,6 +333,109 @@ static int check_smooth(int dim) {
 }
 
 
+/*
+ * baseline_cpe - The baseline CPE in cpes for dimension dim, or 0 if
+ *     config.h has none for it
+ */
+static double baseline_cpe(double *cpes, int dim)
+{
+    int i;
+
+    for (i = 0; i < baseline_cnt; i++)
+	if (baseline_dims[i] == dim)
+	    return cpes[i];
+    return 0.0;
+}
+
+/*
+ * check_odd_dims - Run f on each of the odd_dims and check the result.
+ *     Returns 1 and reports the first dimension where it is wrong.
+ */
+static int check_odd_dims(lab_test_func f, char *description, 
+			  int (*check)(int))
+{
+    int i, dim;
+
+    for (i = 0; i < sizeof(odd_dims) / sizeof(odd_dims[0]); i++) {
+	dim = odd_dims[i];
+	create(dim);
+	(*f)(dim, orig, result);
+	if (check(dim)) {
+	    printf("Benchmark \"%s\" failed correctness check for dimension %d.\n",
+		   description, dim);
+	    return 1;
+	}
+    }
+    return 0;
+}
+
+/*
+ * stats_name - The name that the history file (-H) keeps the CPE of
+ *     the kernel called description at dim under
+ */
+static void stats_name(char *name, int size, char *kind, int dim, 
+		       char *description)
+{
+    snprintf(name, size, "%s %d: %s", kind, dim, description);
+}
+
+/*
+ * print_stats - Print the bounds of the confidence intervals of the
+ *     CPEs of b, and record their medians for the history file (-H)
+ */
+static void print_stats(char *kind, bench_t *b, int *dims)
+{
+    int i;
+    char name[256];
+    bench_result_t r;
+
+    printf("CI low\t");
+    for (i = 0; i < dim_cnt; i++)
+	printf("\t%.1f", b->stats[i].lo / ((double) dims[i] * dims[i]));
+    printf("\n");
+    printf("CI high\t");
+    for (i = 0; i < dim_cnt; i++)
+	printf("\t%.1f", b->stats[i].hi / ((double) dims[i] * dims[i]));
+    printf("\n");
+    for (i = 0; i < dim_cnt; i++) {
+	r = b->stats[i];
+	r.median /= (double) dims[i] * dims[i];
+	r.lo /= (double) dims[i] * dims[i];
+	r.hi /= (double) dims[i] * dims[i];
+	stats_name(name, sizeof(name), kind, dims[i], b->description);
+	bench_record(name, &r);
+    }
+}
+
+/*
+ * print_counters - Print the instructions per cycle and the events per
+ *     pixel of each counter there is, at each of the dimensions in dims
+ */
+static void print_counters(perf_counts_t *perf, int *dims)
+{
+    int i, e;
+    char label[32];
+
+    printf("%-15s", "IPC");
+    for (i = 0; i < dim_cnt; i++) {
+	if (perf[i].count[PERF_CYCLES] > 0)
+	    printf("\t%.2f", perf[i].count[PERF_INSTRS] / 
+		   perf[i].count[PERF_CYCLES]);
+	else
+	    printf("\t-");
+    }
+    printf("\n");
+    for (e = PERF_L1D_MISSES; e < PERF_NEVENTS; e++) {
+	if (!perf_has(e))
+	    continue;
+	sprintf(label, "%s/px", perf_name(e));
+	printf("%-15s", label);
+	for (i = 0; i < dim_cnt; i++)
+	    printf("\t%.3f", perf[i].count[e] / ((double) dims[i] * dims[i]));
+	printf("\n");
+    }
+}
+
 void func_wrapper(void *arglist[]) 
 {
     pixel *src, *dst;
@@ -310,6 +452,112 @@ void func_wrapper(void *arglist[])
     return;
 }
 
+/* fcyc_sample - One sample of bench_run: one run, timed by fcyc */
+static double fcyc_sample(bench_func f, void *arg)
+{
+    return fcyc((test_funct) f, arg);
+}
+
+/*
+ * time_kernel - Cycles of the kernel call in arglist (see func_wrapper):
+ *     fcyc's K-best, or with -S the median of bench_run, whose 
+ *     confidence interval is stored in r. With -H a kind of kernel 
+ *     (NULL for a baseline) whose CPE regressed is timed again.
+ */
+static double time_kernel(char *kind, char *description, void *arglist[], 
+			  bench_result_t *r)
+{
+    int dim = *(int *) arglist[1];
+    char name[256];
+
+    if (!run_stats)
+	return fcyc((test_funct)&func_wrapper, arglist);
+    if (kind == NULL) {
+	bench_run((bench_func)&func_wrapper, arglist, fcyc_sample, r);
+	return r->median;
+    }
+    stats_name(name, sizeof(name), kind, dim, description);
+    bench_run_named(name, (double) dim * dim, (bench_func)&func_wrapper, 
+		    arglist, fcyc_sample, r);
+    return r->median;
+}
+
+/* 
+ * baseline_rotate, baseline_smooth - Copies of the naive kernels that
+ *     were handed out, which -B times to get the baselines
+ */
+static void baseline_rotate(int dim, pixel *src, pixel *dst) 
+{
+    int i, j;
+
+    for (i = 0; i < dim; i++)
+	for (j = 0; j < dim; j++)
+	    dst[RIDX(dim-1-j, i, dim)] = src[RIDX(i, j, dim)];
+}
+
+typedef struct {
+    int red, green, blue, num;
+} pixel_sum;
+
+static void accumulate_sum(pixel_sum *sum, pixel p) 
+{
+    sum->red += (int) p.red;
+    sum->green += (int) p.green;
+    sum->blue += (int) p.blue;
+    sum->num++;
+}
+
+static pixel baseline_avg(int dim, int i, int j, pixel *src) 
+{
+    int ii, jj;
+    pixel_sum sum = {0, 0, 0, 0};
+    pixel current_pixel;
+
+    for(ii = max(i-1, 0); ii <= min(i+1, dim-1); ii++) 
+	for(jj = max(j-1, 0); jj <= min(j+1, dim-1); jj++) 
+	    accumulate_sum(&sum, src[RIDX(ii, jj, dim)]);
+    current_pixel.red = (unsigned short) (sum.red/sum.num);
+    current_pixel.green = (unsigned short) (sum.green/sum.num);
+    current_pixel.blue = (unsigned short) (sum.blue/sum.num);
+    return current_pixel;
+}
+
+static void baseline_smooth(int dim, pixel *src, pixel *dst) 
+{
+    int i, j;
+
+    for (j = 0; j < dim; j++)
+	for (i = 0; i < dim; i++)
+	    dst[RIDX(i, j, dim)] = baseline_avg(dim, i, j, src);
+}
+
+/*
+ * calibrate - Replace the config.h baselines by the CPEs of the naive
+ *     kernels at each of the test dimensions on this machine
+ */
+static void calibrate(void)
+{
+    int i, dim;
+    bench_result_t r;
+    void *arglist[4];
+
+    printf("Calibrating the baselines on this machine...\n");
+    for (i = 0; i < dim_cnt; i++) {
+	dim = baseline_dims[i] = test_dim_rotate[i];
+	create(dim);
+	arglist[1] = (void *) &dim;
+	arglist[2] = (void *) orig;
+	arglist[3] = (void *) result;
+	arglist[0] = (void *) baseline_rotate;
+	rotate_baseline_cpes[i] = time_kernel(NULL, NULL, arglist, &r) / 
+	    ((double) dim * dim);
+	arglist[0] = (void *) baseline_smooth;
+	smooth_baseline_cpes[i] = time_kernel(NULL, NULL, arglist, &r) / 
+	    ((double) dim * dim);
+    }
+    baseline_cnt = dim_cnt;
+}
+
 void run_rotate_benchmark(int idx, int dim) 
 {
     benchmarks_rotate[idx].tfunct(dim, orig, result);
@@ -319,19 +567,16 @@ void test_rotate(int bench_index)
 {
     int i;
     int test_num;
+    double baseline;
     char *description = benchmarks_rotate[bench_index].description;
   
-    for (test_num = 0; test_num < DIM_CNT; test_num++) {
-	int dim;
+    /* Check for odd dimensions */
+    if (check_odd && check_odd_dims(benchmarks_rotate[bench_index].tfunct, 
+				    description, check_rotate))
+	return;
 
-	/* Check for odd dimension */
-	//create(ODD_DIM);
-	//run_rotate_benchmark(bench_index, ODD_DIM);
-	//if (check_rotate(ODD_DIM)) {
-	//    printf("Benchmark \"%s\" failed correctness check for dimension %d.\n",
-	//	   benchmarks_rotate[bench_index].description, ODD_DIM);
-	//    return;
-	//}
+    for (test_num = 0; test_num < dim_cnt; test_num++) {
+	int dim;
 
 	/* Create a test image of the required dimension */
 	dim = test_dim_rotate[test_num];
@@ -365,9 +610,12 @@ void test_rotate(int bench_index)
 	    arglist[3] = (void *) result;
 
 	    create(dim);
-	    num_cycles = fcyc_v((test_funct_v)&func_wrapper, arglist); 
+	    num_cycles = time_kernel("rotate", description, arglist, 
+				     &benchmarks_rotate[bench_index].stats[test_num]);
 	    cpe = num_cycles/work;
 	    benchmarks_rotate[bench_index].cpes[test_num] = cpe;
+	    if (run_perf)
+		fcyc_perf_counts(&benchmarks_rotate[bench_index].perf[test_num]);
 	}
     }
 
@@ -376,51 +624,67 @@ void test_rotate(int bench_index)
      */
     printf("Rotate: Version = %s:\n", description);
     printf("Dim\t");
-    for (i = 0; i < DIM_CNT; i++)
+    for (i = 0; i < dim_cnt; i++)
 	printf("\t%d", test_dim_rotate[i]);
     printf("\tMean\n");
   
     printf("Your CPEs");
-    for (i = 0; i < DIM_CNT; i++) {
+    for (i = 0; i < dim_cnt; i++) {
 	printf("\t%.1f", benchmarks_rotate[bench_index].cpes[i]);
     }
     printf("\n");
+    if (run_perf)
+	print_counters(benchmarks_rotate[bench_index].perf, test_dim_rotate);
+    if (run_stats)
+	print_stats("rotate", &benchmarks_rotate[bench_index], test_dim_rotate);
 
     printf("Baseline CPEs");
-    for (i = 0; i < DIM_CNT; i++) {
-	printf("\t%.1f", rotate_baseline_cpes[i]);
+    for (i = 0; i < dim_cnt; i++) {
+	baseline = baseline_cpe(rotate_baseline_cpes, test_dim_rotate[i]);
+	if (baseline > 0.0)
+	    printf("\t%.1f", baseline);
+	else
+	    printf("\t-");
     }
     printf("\n");
 
-    /* Compute Speedup */
+    /* Compute speedup against the dimensions that have a baseline */
     {
 	double prod, ratio, mean;
+	int n = 0;
 	prod = 1.0; /* Geometric mean */
 	printf("Speedup\t");
-	for (i = 0; i < DIM_CNT; i++) {
-	    if (benchmarks_rotate[bench_index].cpes[i] > 0.0) {
-		ratio = rotate_baseline_cpes[i]/
-		    benchmarks_rotate[bench_index].cpes[i];
-	    }
-	    else {
+	for (i = 0; i < dim_cnt; i++) {
+	    if (benchmarks_rotate[bench_index].cpes[i] <= 0.0) {
 		printf("Fatal Error: Non-positive CPE value...\n");
 		exit(EXIT_FAILURE);
 	    }
+	    baseline = baseline_cpe(rotate_baseline_cpes, test_dim_rotate[i]);
+	    if (baseline == 0.0) {
+		printf("\t-");
+		continue;
+	    }
+	    ratio = baseline/benchmarks_rotate[bench_index].cpes[i];
 	    prod *= ratio;
+	    n++;
 	    printf("\t%.1f", ratio);
 	}
 
 	/* Geometric mean */
-	mean = pow(prod, 1.0/(double) DIM_CNT);
-	printf("\t%.1f", mean);
-	printf("\n\n");
-	if (mean > rotate_maxmean) {
-	    rotate_maxmean = mean;
-	    rotate_maxmean_desc = benchmarks_rotate[bench_index].description;
+	if (n == 0) {
+	    printf("\t-\n\n");
+	}
+	else {
+	    mean = pow(prod, 1.0/(double) n);
+	    printf("\t%.1f", mean);
+	    printf("\n\n");
+	    if (mean > rotate_maxmean) {
+		rotate_maxmean = mean;
+		rotate_maxmean_desc = benchmarks_rotate[bench_index].description;
+	    }
 	}
     }
 
-
 #ifdef DEBUG
     fflush(stdout);
 #endif
@@ -436,19 +700,16 @@ void test_smooth(int bench_index)
 {
     int i;
     int test_num;
+    double baseline;
     char *description = benchmarks_smooth[bench_index].description;
   
-    for(test_num=0; test_num < DIM_CNT; test_num++) {
-	int dim;
+    /* Check correctness for odd (non power of two) dimensions */
+    if (check_odd && check_odd_dims(benchmarks_smooth[bench_index].tfunct, 
+				    description, check_smooth))
+	return;
 
-	/* Check correctness for odd (non power of two dimensions */
-	//create(ODD_DIM);
-	//run_smooth_benchmark(bench_index, ODD_DIM);
-	//if (check_smooth(ODD_DIM)) {
-	//    printf("Benchmark \"%s\" failed correctness check for dimension %d.\n",
-	//	   benchmarks_smooth[bench_index].description, ODD_DIM);
-	//    return;
-	//}
+    for (test_num = 0; test_num < dim_cnt; test_num++) {
+	int dim;
 
 	/* Create a test image of the required dimension */
 	dim = test_dim_smooth[test_num];
@@ -482,71 +743,284 @@ void test_smooth(int bench_index)
 	    arglist[3] = (void *) result;
         
 	    create(dim);
-	    num_cycles = fcyc_v((test_funct_v)&func_wrapper, arglist); 
+	    num_cycles = time_kernel("smooth", description, arglist, 
+				     &benchmarks_smooth[bench_index].stats[test_num]);
 	    cpe = num_cycles/work;
 	    benchmarks_smooth[bench_index].cpes[test_num] = cpe;
+	    if (run_perf)
+		fcyc_perf_counts(&benchmarks_smooth[bench_index].perf[test_num]);
 	}
     }
 
     /* Print results as a table */
     printf("Smooth: Version = %s:\n", description);
     printf("Dim\t");
-    for (i = 0; i < DIM_CNT; i++)
+    for (i = 0; i < dim_cnt; i++)
 	printf("\t%d", test_dim_smooth[i]);
     printf("\tMean\n");
   
     printf("Your CPEs");
-    for (i = 0; i < DIM_CNT; i++) {
+    for (i = 0; i < dim_cnt; i++) {
 	printf("\t%.1f", benchmarks_smooth[bench_index].cpes[i]);
     }
     printf("\n");
+    if (run_perf)
+	print_counters(benchmarks_smooth[bench_index].perf, test_dim_smooth);
+    if (run_stats)
+	print_stats("smooth", &benchmarks_smooth[bench_index], test_dim_smooth);
 
     printf("Baseline CPEs");
-    for (i = 0; i < DIM_CNT; i++) {
-	printf("\t%.1f", smooth_baseline_cpes[i]);
+    for (i = 0; i < dim_cnt; i++) {
+	baseline = baseline_cpe(smooth_baseline_cpes, test_dim_smooth[i]);
+	if (baseline > 0.0)
+	    printf("\t%.1f", baseline);
+	else
+	    printf("\t-");
     }
     printf("\n");
 
-    /* Compute speedup */
+    /* Compute speedup against the dimensions that have a baseline */
     {
 	double prod, ratio, mean;
+	int n = 0;
 	prod = 1.0; /* Geometric mean */
 	printf("Speedup\t");
-	for (i = 0; i < DIM_CNT; i++) {
-	    if (benchmarks_smooth[bench_index].cpes[i] > 0.0) {
-		ratio = smooth_baseline_cpes[i]/
-		    benchmarks_smooth[bench_index].cpes[i];
-	    }
-	    else {
+	for (i = 0; i < dim_cnt; i++) {
+	    if (benchmarks_smooth[bench_index].cpes[i] <= 0.0) {
 		printf("Fatal Error: Non-positive CPE value...\n");
 		exit(EXIT_FAILURE);
 	    }
+	    baseline = baseline_cpe(smooth_baseline_cpes, test_dim_smooth[i]);
+	    if (baseline == 0.0) {
+		printf("\t-");
+		continue;
+	    }
+	    ratio = baseline/benchmarks_smooth[bench_index].cpes[i];
 	    prod *= ratio;
+	    n++;
 	    printf("\t%.1f", ratio);
 	}
+
 	/* Geometric mean */
-	mean = pow(prod, 1.0/(double) DIM_CNT);
-	printf("\t%.1f", mean);
-	printf("\n\n");
-	if (mean > smooth_maxmean) {
-	    smooth_maxmean = mean;
-	    smooth_maxmean_desc = benchmarks_smooth[bench_index].description;
+	if (n == 0) {
+	    printf("\t-\n\n");
+	}
+	else {
+	    mean = pow(prod, 1.0/(double) n);
+	    printf("\t%.1f", mean);
+	    printf("\n\n");
+	    if (mean > smooth_maxmean) {
+		smooth_maxmean = mean;
+		smooth_maxmean_desc = benchmarks_smooth[bench_index].description;
+	    }
 	}
     }
 
     return;  
 }
 
+/*
+ * scale_benchmark - Measure the CPEs of bench on 1, 2, 4, ... up to
+ *     max_threads threads of the kernel thread pool, at each of the 
+ *     dim_cnt dimensions in dims, and print them with the speedup over
+ *     one thread. A version that never calls pool_run is serial: its
+ *     "speedups" would only be noise, so it is named and skipped.
+ *     Timer interrupt compensation is turned off meanwhile:
+ *     it charges the process's user time, which grows with every busy
+ *     thread, against the wall clock cycles of the caller.
+ */
+static void scale_benchmark(char *kind, bench_t *bench, int *dims, 
+			    int (*check)(int), int max_threads)
+{
+    int i, t, n = 0;
+    int threads[32];
+    double cpes[32][MAX_DIMS];
+    unsigned long runs;
+
+    create(dims[0]);
+    runs = pool_runs();
+    bench->tfunct(dims[0], orig, result);
+    if (pool_runs() == runs) {
+	printf("%s scaling: Version = %s: serial, not scaled\n\n", 
+	       kind, bench->description);
+	return;
+    }
+
+    for (t = 1; t < max_threads; t *= 2)
+	threads[n++] = t;
+    threads[n++] = max_threads;
+
+    set_fcyc_compensate(0);
+    for (t = 0; t < n; t++) {
+	pool_init(threads[t]);
+	for (i = 0; i < dim_cnt; i++) {
+	    int dim = dims[i];
+	    void *arglist[4];
+
+	    create(dim);
+	    bench->tfunct(dim, orig, result);
+	    if (check(dim)) {
+		printf("Benchmark \"%s\" failed correctness check for dimension %d on %d threads.\n",
+		       bench->description, dim, threads[t]);
+		return;
+	    }
+	    arglist[0] = (void *) bench->tfunct;
+	    arglist[1] = (void *) &dim;
+	    arglist[2] = (void *) orig;
+	    arglist[3] = (void *) result;
+	    create(dim);
+	    cpes[t][i] = fcyc((test_funct)&func_wrapper, arglist) / 
+		((double) dim * dim);
+	}
+    }
+    set_fcyc_compensate(1);
+
+    printf("%s scaling: Version = %s:\n", kind, bench->description);
+    printf("Threads\t");
+    for (i = 0; i < dim_cnt; i++)
+	printf("\t%d", dims[i]);
+    printf("\n");
+    for (t = 0; t < n; t++) {
+	printf("%d CPEs\t", threads[t]);
+	for (i = 0; i < dim_cnt; i++)
+	    printf("\t%.1f", cpes[t][i]);
+	printf("\n");
+    }
+    for (t = 1; t < n; t++) {
+	printf("%d Speedup", threads[t]);
+	for (i = 0; i < dim_cnt; i++)
+	    printf("\t%.2f", cpes[0][i] / cpes[t][i]);
+	printf("\n");
+    }
+    printf("\n");
+}
+
+
+/*
+ * planes_wrapper - Run a planes kernel on planes made from the images
+ *     beforehand, and convert_wrapper - on planes made from and turned
+ *     back into the images as part of the run
+ */
+void planes_wrapper(void *arglist[]) 
+{
+    planes_func f = (planes_func) arglist[0];
+
+    (*f)((planes_t *) arglist[1], (planes_t *) arglist[2]);
+}
+
+void convert_wrapper(void *arglist[]) 
+{
+    planes_func f = (planes_func) arglist[0];
+    planes_t *src = (planes_t *) arglist[1];
+    planes_t *dst = (planes_t *) arglist[2];
+
+    to_planes(src->dim, (pixel *) arglist[3], src);
+    (*f)(src, dst);
+    from_planes(dst, (pixel *) arglist[4]);
+}
+
+/*
+ * layout_benchmark - Compare the pixel kernel tfunct with the planes
+ *     kernel pfunct at each of the dim_cnt dimensions in dims: the
+ *     CPEs of pfunct alone, and with the conversions from and back to
+ *     pixels that a caller holding pixels would pay for.
+ */
+static void layout_benchmark(char *kind, lab_test_func tfunct, 
+			     planes_func pfunct, int *dims, int (*check)(int))
+{
+    int i, k;
+    double cpes[3][MAX_DIMS];
+    char *rows[3] = {"Pixels", "Planes", "+Convert"};
+
+    for (i = 0; i < dim_cnt; i++) {
+	int dim = dims[i];
+	planes_t *src = planes_alloc(dim), *dst = planes_alloc(dim);
+	void *arglist[5];
+
+	create(dim);
+	to_planes(dim, orig, src);
+	(*pfunct)(src, dst);
+	from_planes(dst, result);
+	if (check(dim)) {
+	    printf("%s on planes failed correctness check for dimension %d.\n",
+		   kind, dim);
+	    planes_free(src);
+	    planes_free(dst);
+	    return;
+	}
+
+	arglist[0] = (void *) tfunct;
+	arglist[1] = (void *) &dim;
+	arglist[2] = (void *) orig;
+	arglist[3] = (void *) result;
+	cpes[0][i] = fcyc((test_funct)&func_wrapper, arglist) / 
+	    ((double) dim * dim);
+
+	arglist[0] = (void *) pfunct;
+	arglist[1] = (void *) src;
+	arglist[2] = (void *) dst;
+	cpes[1][i] = fcyc((test_funct)&planes_wrapper, arglist) / 
+	    ((double) dim * dim);
+
+	arglist[3] = (void *) orig;
+	arglist[4] = (void *) result;
+	cpes[2][i] = fcyc((test_funct)&convert_wrapper, arglist) / 
+	    ((double) dim * dim);
+
+	planes_free(src);
+	planes_free(dst);
+    }
+
+    printf("%s layout: pixels vs. planes:\n", kind);
+    printf("Dim\t");
+    for (i = 0; i < dim_cnt; i++)
+	printf("\t%d", dims[i]);
+    printf("\n");
+    for (k = 0; k < 3; k++) {
+	printf("%s CPEs", rows[k]);
+	for (i = 0; i < dim_cnt; i++)
+	    printf("\t%.1f", cpes[k][i]);
+	printf("\n");
+    }
+    printf("Speedup\t");
+    for (i = 0; i < dim_cnt; i++)
+	printf("\t%.2f", cpes[0][i] / cpes[1][i]);
+    printf("\n");
+    printf("+Convert");
+    for (i = 0; i < dim_cnt; i++)
+	printf("\t%.2f", cpes[0][i] / cpes[2][i]);
+    printf("\n\n");
+}
+
 
 void usage(char *progname) 
 {
-    fprintf(stderr, "Usage: %s [-hqg] [-f <func_file>] [-d <dump_file>]\n", progname);    
+    fprintf(stderr, "Usage: %s [-hqgl] [-f <func_file>] [-d <dump_file>] [-p <threads>]\n", progname);
+    fprintf(stderr, "       [-D <dim,...>] [-A <align>] [-O <pad>] [-c] [-SB]\n");
+    fprintf(stderr, "       [-H <history>] [-R <percent>]\n");    
     fprintf(stderr, "Options:\n");
     fprintf(stderr, "  -h         Print this message\n");
     fprintf(stderr, "  -q         Quit after dumping (use with -d )\n");
     fprintf(stderr, "  -g         Autograder mode: checks only rotate() and smooth()\n");
     fprintf(stderr, "  -f <file>  Get test function names from dump file <file>\n");
     fprintf(stderr, "  -d <file>  Emit a dump file <file> for later use with -f\n");
+    fprintf(stderr, "  -p <n>     Run the parallel kernels on <n> threads, and show\n");
+    fprintf(stderr, "             how each parallel version scales from 1 to <n> threads\n");
+    fprintf(stderr, "  -l         Compare rotate() and smooth() with the kernels on\n");
+    fprintf(stderr, "             separate colour planes, with and without conversion\n");
+    fprintf(stderr, "  -D <list>  Time the image dimensions in the comma separated <list>\n");
+    fprintf(stderr, "             (default 64,128,256,512,1024)\n");
+    fprintf(stderr, "  -A <n>     Align each image to <n> bytes, a power of 2 (default %d)\n", BSIZE);
+    fprintf(stderr, "  -O <n>     Then offset each image by <n> more bytes, a multiple of 2\n");
+    fprintf(stderr, "  -c         Print IPC and cache, TLB and branch misses per pixel\n");
+    fprintf(stderr, "             next to the CPEs, from the performance counters (not with -p)\n");
+    fprintf(stderr, "  -S         Pin to a CPU and report the median CPE of 15 runs after\n");
+    fprintf(stderr, "             2 warmup runs, with its 95%% bootstrap confidence interval\n");
+    fprintf(stderr, "  -B         Time the naive kernels on this machine for the baselines\n");
+    fprintf(stderr, "  -H <file>  Implies -S; compare the CPEs with the last 5 runs in the\n");
+    fprintf(stderr, "             JSON history <file>, then add this run to it. Exits with 1\n");
+    fprintf(stderr, "             if any CPE regressed\n");
+    fprintf(stderr, "  -R <pct>   Regression threshold for -H (default 5)\n");
     exit(EXIT_FAILURE);
 }
 
@@ -562,13 +1036,18 @@ int main(int argc, char *argv[])
     char c = '0';
     char *bench_func_file = NULL;
     char *func_dump_file = NULL;
+    int nthreads = 0;
+    int layout = 0;
+    int calibrate_baselines = 0;
+    char *history_file = NULL;
+    double threshold = 5;
 
     /* register all the defined functions */
     register_rotate_functions();
     register_smooth_functions();
 
     /* parse command line args */
-    while ((c = getopt(argc, argv, "tgqf:d:s:h")) != -1)
+    while ((c = getopt(argc, argv, "tgqf:d:s:hp:lD:A:O:cSBH:R:")) != -1)
 	switch (c) {
 
 	case 't': /* don't skip team name check (hidden flag) */
@@ -612,6 +1091,78 @@ int main(int argc, char *argv[])
 	    }
 	    break;
 
+	case 'p': /* threads for the parallel kernels */
+	    nthreads = atoi(optarg);
+	    if (nthreads < 1 || nthreads > 32) {
+		printf("The thread count must be 1 to 32\n");
+		exit(1);
+	    }
+	    break;
+
+	case 'l': /* compare the pixel and planes layouts */
+	    layout = 1;
+	    break;
+
+	case 'c': /* read the performance counters */
+	    run_perf = 1;
+	    break;
+
+	case 'S': /* time with the statistical harness */
+	    run_stats = 1;
+	    break;
+
+	case 'B': /* measure the baselines */
+	    calibrate_baselines = 1;
+	    break;
+
+	case 'H': /* history file to compare with and append to */
+	    history_file = strdup(optarg);
+	    run_stats = 1;
+	    break;
+
+	case 'R': /* regression threshold in percent */
+	    threshold = atof(optarg);
+	    break;
+
+	case 'D': /* the image dimensions to time */
+	    {
+		char *tok;
+
+		dim_cnt = 0;
+		for (tok = strtok(optarg, ","); tok; tok = strtok(NULL, ",")) {
+		    if (dim_cnt == MAX_DIMS || atoi(tok) < 1) {
+			printf("Give 1 to %d positive dimensions\n", MAX_DIMS);
+			exit(1);
+		    }
+		    test_dim_rotate[dim_cnt] = test_dim_smooth[dim_cnt] = atoi(tok);
+		    dim_cnt++;
+		}
+		if (dim_cnt == 0) {
+		    printf("Give 1 to %d positive dimensions\n", MAX_DIMS);
+		    exit(1);
+		}
+	    }
+	    break;
+
+	case 'A': /* image alignment */
+	    image_align = atoi(optarg);
+	    if (image_align < (int)sizeof(void *) || 
+		(image_align & (image_align - 1))) {
+		printf("The alignment must be a power of 2 of at least %d\n", 
+		       (int)sizeof(void *));
+		exit(1);
+	    }
+	    break;
+
+	case 'O': /* image offset past the alignment */
+	    image_pad = atoi(optarg);
+	    if (image_pad < 0 || image_pad % sizeof(unsigned short)) {
+		printf("The offset must be a non-negative multiple of %d\n", 
+		       (int)sizeof(unsigned short));
+		exit(1);
+	    }
+	    break;
+
 	case 'h': /* print help message */
 	    usage(argv[0]);
 
@@ -639,6 +1190,11 @@ int main(int argc, char *argv[])
 	printf("\n");
     }
 
+#ifdef BUILD_TAG
+    /* The build configuration, from common/report.pl */
+    printf("Build: %s\n\n", BUILD_TAG);
+#endif
+
     srand(seed);
 
     /* 
@@ -646,6 +1202,7 @@ int main(int argc, char *argv[])
      * the rotate() and bench() functions.
      */
     if (autograder) {
+	check_odd = 0;
 	rotate_benchmark_count = 1;
 	smooth_benchmark_count = 1;
 
@@ -714,6 +1271,28 @@ int main(int argc, char *argv[])
     set_fcyc_cache_size(1 << 14); /* 16 KB cache size */
     set_fcyc_clear_cache(1); /* clear the cache before each measurement */
     set_fcyc_compensate(1); /* try to compensate for timer overhead */
+    if (run_perf && nthreads) {
+	/* The counters only count the thread that opened them */
+	printf("Performance counters miss the pool threads, ignoring -c with -p\n");
+	run_perf = 0;
+    }
+    if (run_perf && set_fcyc_perf(1) == 0) {
+	printf("No performance counters available, ignoring -c\n");
+	run_perf = 0;
+    }
+    if (nthreads)
+	pool_init(nthreads);
+    if (run_stats) {
+	/* Every sample of bench_run is one fcyc run with a cold cache */
+	set_fcyc_k(1);
+	set_fcyc_maxsamples(1);
+	if (bench_pin(-1) < 0)
+	    printf("Could not pin to a CPU, timing unpinned\n");
+	if (history_file)
+	    bench_history(history_file, threshold / 100);
+    }
+    if (calibrate_baselines)
+	calibrate();
  
     for (i = 0; i < rotate_benchmark_count; i++) {
 	if (benchmarks_rotate[i].valid)
@@ -726,6 +1305,26 @@ int main(int argc, char *argv[])
     }
 
 
+    /* Show how the versions scale with the size of the thread pool */
+    if (nthreads > 1) {
+	for (i = 0; i < rotate_benchmark_count; i++)
+	    if (benchmarks_rotate[i].valid)
+		scale_benchmark("Rotate", &benchmarks_rotate[i], 
+				test_dim_rotate, check_rotate, nthreads);
+	for (i = 0; i < smooth_benchmark_count; i++)
+	    if (benchmarks_smooth[i].valid)
+		scale_benchmark("Smooth", &benchmarks_smooth[i], 
+				test_dim_smooth, check_smooth, nthreads);
+    }
+
+    /* Compare the pixel kernels with the kernels on planes */
+    if (layout) {
+	layout_benchmark("Rotate", rotate, planes_rotate, 
+			 test_dim_rotate, check_rotate);
+	layout_benchmark("Smooth", smooth, planes_smooth, 
+			 test_dim_smooth, check_smooth);
+    }
+
     if (autograder) {
 	printf("\nbestscores:%.1f:%.1f:\n", rotate_maxmean, smooth_maxmean);
     }
@@ -735,6 +1334,11 @@ int main(int argc, char *argv[])
 	printf("  Smooth: %3.1f (%s)\n", smooth_maxmean, smooth_maxmean_desc);
     }
 
+    /* Compare with the history, and fail on a regression */
+    if (history_file && 
+	bench_save(history_file, "perflab driver", threshold / 100) != 0)
+	exit(EXIT_FAILURE);
+
     return 0;
 }
 
@@ -5,12 +5,16 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include "defs.h"
+#include "pool.h"
 
 // Just ignore this...
 team_t team = { "", "", /* First member full name */ 
   "",  /* First member email address */ "", ""   
 };
 
+/* Smaller of two ints, for the tile bounds */
+#define min(a, b) ((a) < (b) ? (a) : (b))
+
 /***************
  * ROTATE KERNEL
  ***************/
@@ -32,6 +36,182 @@ void naive_rotate(int dim, pixel *src, pixel *dst)
 	    dst[RIDX(dim-1-j, i, dim)] = src[RIDX(i, j, dim)];
 }
 
+/*
+ * rotate_tile - Tile size for the tiled rotates. A tile of the source
+ * and the matching tile of the destination (2 * 32 * 32 pixels = 12 KB)
+ * should both stay in L1 while it is copied. From 512 up the rows of
+ * a tile are a power-of-two stride of 3 KB or more apart and compete
+ * for the same cache sets, so the tiles are made smaller there.
+ */
+static int rotate_tile(int dim)
+{
+    return dim <= 256 ? 32 : 16;
+}
+
+/* 
+ * tiled_rotate - Rotate tile by tile, so that the dst lines written
+ * for one tile are still cached when the next column of the tile
+ * lands in them. Within a tile, writes go along dst rows.
+ */
+char tiled_rotate_descr[] = "tiled_rotate: Tiles sized per dimension";
+void tiled_rotate(int dim, pixel *src, pixel *dst) 
+{
+    int i, j, ii, jj, ilim, jlim;
+    int t = rotate_tile(dim);
+
+    for (j = 0; j < dim; j += t) {
+	jlim = min(j + t, dim);
+	for (i = 0; i < dim; i += t) {
+	    ilim = min(i + t, dim);
+	    for (jj = j; jj < jlim; jj++)
+		for (ii = i; ii < ilim; ii++)
+		    dst[RIDX(dim-1-jj, ii, dim)] = src[RIDX(ii, jj, dim)];
+	}
+    }
+}
+
+/* 
+ * rotate_cols - Rotate src columns j0 to j1-1, which become dst rows
+ * dim-j1 to dim-1-j0, in tiles, with the walk down a src column
+ * unrolled by 4 to write 4 consecutive pixels of a dst row per step
+ */
+static void rotate_cols(int dim, pixel *src, pixel *dst, int j0, int j1)
+{
+    int i, j, ii, jj, ilim, jlim;
+    int t = rotate_tile(dim);
+    pixel *s, *d;
+
+    for (j = j0; j < j1; j += t) {
+	jlim = min(j + t, j1);
+	for (i = 0; i < dim; i += t) {
+	    ilim = min(i + t, dim);
+	    for (jj = j; jj < jlim; jj++) {
+		s = &src[RIDX(i, jj, dim)];
+		d = &dst[RIDX(dim-1-jj, i, dim)];
+		for (ii = i; ii + 3 < ilim; ii += 4) {
+		    d[0] = s[0];
+		    d[1] = s[dim];
+		    d[2] = s[2*dim];
+		    d[3] = s[3*dim];
+		    s += 4*dim;
+		    d += 4;
+		}
+		for (; ii < ilim; ii++) {
+		    *d++ = *s;
+		    s += dim;
+		}
+	    }
+	}
+    }
+}
+
+/* 
+ * unrolled_rotate - tiled_rotate with the inner loop unrolled by 4
+ */
+char unrolled_rotate_descr[] = "unrolled_rotate: Tiles, inner loop unrolled by 4";
+void unrolled_rotate(int dim, pixel *src, pixel *dst) 
+{
+    rotate_cols(dim, src, dst, 0, dim);
+}
+
+/* The arguments of a kernel call, for the parts run on the pool */
+typedef struct {
+    int dim;
+    pixel *src;
+    pixel *dst;
+} kernel_args;
+
+/* Part id of n of parallel_rotate: a band of src columns */
+static void rotate_part(void *p, int id, int n)
+{
+    kernel_args *a = (kernel_args *)p;
+
+    rotate_cols(a->dim, a->src, a->dst, a->dim * id / n, a->dim * (id+1) / n);
+}
+
+/* 
+ * parallel_rotate - unrolled_rotate split over the thread pool. Each
+ * thread takes a band of src columns, which is a band of whole dst
+ * rows, so no two threads write to the same cache line.
+ */
+char parallel_rotate_descr[] = "parallel_rotate: unrolled_rotate, column bands on the thread pool";
+void parallel_rotate(int dim, pixel *src, pixel *dst) 
+{
+    kernel_args a = { dim, src, dst };
+
+    pool_run(rotate_part, &a);
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <tmmintrin.h>
+
+/*
+ * simd_rotate - Rotate 4x4 blocks of pixels in SSE registers. Each
+ * src row of a block (4 pixels, 24 bytes) is spread out to one pixel
+ * per 64-bit lane with pshufb, the block is transposed with 64-bit
+ * unpacks, and each column is packed back to 24 bytes and stored as a
+ * dst row. The blocks are walked in tiles like tiled_rotate; pixels
+ * left over when dim is not a multiple of 4 are rotated one by one.
+ */
+char simd_rotate_descr[] = "simd_rotate: 4x4 blocks transposed with SSSE3 shuffles";
+__attribute__((target("ssse3")))
+void simd_rotate(int dim, pixel *src, pixel *dst) 
+{
+    int i, j, ii, jj, r, ilim, jlim;
+    int t = rotate_tile(dim);
+    int dim4 = dim & ~3;
+    /* pixels 0 and 1 of 16 bytes, each into its own 64-bit lane */
+    const __m128i spread = _mm_setr_epi8(0, 1, 2, 3, 4, 5, -1, -1,
+					 6, 7, 8, 9, 10, 11, -1, -1);
+    /* and back to 12 packed bytes */
+    const __m128i pack = _mm_setr_epi8(0, 1, 2, 3, 4, 5, 8, 9,
+				       10, 11, 12, 13, -1, -1, -1, -1);
+    __m128i lo[4], hi[4], a, b, c01, c23;
+
+    for (j = 0; j < dim4; j += t) {
+	jlim = min(j + t, dim4);
+	for (i = 0; i < dim4; i += t) {
+	    ilim = min(i + t, dim4);
+	    for (jj = j; jj < jlim; jj += 4) {
+		for (ii = i; ii < ilim; ii += 4) {
+		    /* Spread rows ii..ii+3: lo holds pixels 0,1 and hi 2,3 */
+		    for (r = 0; r < 4; r++) {
+			char *p = (char *)&src[RIDX(ii+r, jj, dim)];
+			a = _mm_loadu_si128((__m128i *)p);
+			b = _mm_loadl_epi64((__m128i *)(p + 16));
+			lo[r] = _mm_shuffle_epi8(a, spread);
+			hi[r] = _mm_shuffle_epi8(_mm_alignr_epi8(b, a, 12), spread);
+		    }
+		    /* Column c of the block becomes dst row dim-1-(jj+c) */
+		    for (r = 0; r < 4; r++) {
+			char *q = (char *)&dst[RIDX(dim-1-(jj+r), ii, dim)];
+			__m128i *x = r < 2 ? lo : hi;
+			if (r & 1) {
+			    c01 = _mm_unpackhi_epi64(x[0], x[1]);
+			    c23 = _mm_unpackhi_epi64(x[2], x[3]);
+			}
+			else {
+			    c01 = _mm_unpacklo_epi64(x[0], x[1]);
+			    c23 = _mm_unpacklo_epi64(x[2], x[3]);
+			}
+			c01 = _mm_shuffle_epi8(c01, pack);
+			c23 = _mm_shuffle_epi8(c23, pack);
+			_mm_storeu_si128((__m128i *)q, 
+					 _mm_or_si128(c01, _mm_slli_si128(c23, 12)));
+			_mm_storel_epi64((__m128i *)(q + 16), _mm_srli_si128(c23, 4));
+		    }
+		}
+	    }
+	}
+    }
+
+    /* The last dim % 4 rows and columns */
+    for (ii = 0; ii < dim; ii++)
+	for (jj = (ii < dim4 ? dim4 : 0); jj < dim; jj++)
+	    dst[RIDX(dim-1-jj, ii, dim)] = src[RIDX(ii, jj, dim)];
+}
+#endif
+
 /* 
  * rotate - Your current working version of rotate
  * IMPORTANT: This is the version you will be graded on
@@ -39,7 +219,7 @@ void naive_rotate(int dim, pixel *src, pixel *dst)
 char rotate_descr[] = "rotate: Current working version";
 void rotate(int dim, pixel *src, pixel *dst) 
 {
-    naive_rotate(dim, src, dst);
+    unrolled_rotate(dim, src, dst);
 }
 
 /*********************************************************************
@@ -54,6 +234,13 @@ void register_rotate_functions()
 {
     //add_rotate_function(&naive_rotate, naive_rotate_descr);   
     add_rotate_function(&rotate, rotate_descr);   
+    add_rotate_function(&tiled_rotate, tiled_rotate_descr);   
+    add_rotate_function(&unrolled_rotate, unrolled_rotate_descr);   
+    add_rotate_function(&parallel_rotate, parallel_rotate_descr);   
+#if defined(__x86_64__) || defined(__i386__)
+    if (__builtin_cpu_supports("ssse3"))
+	add_rotate_function(&simd_rotate, simd_rotate_descr);   
+#endif
     /* ... Register additional test functions here */
 }
 
@@ -75,8 +262,7 @@ typedef struct {
     int num;
 } pixel_sum;
 
-/* Compute min and max of two integers, respectively */
-static int min(int a, int b) { return (a < b ? a : b); }
+/* Compute max of two integers; min is defined at the top */
 static int max(int a, int b) { return (a > b ? a : b); }
 
 /* 
@@ -148,6 +334,143 @@ void naive_smooth(int dim, pixel *src, pixel *dst)
         dst[RIDX(i, j, dim)] = avg(dim, i, j, src);
 }
 
+/*
+ * Exact sum/num for the 9, 6 and 4 pixel boxes without a divide:
+ * multiply by 2^32/num rounded up and shift. The rounding error stays
+ * below 1/num for any sum of up to 9 unsigned shorts.
+ */
+#define DIV9(s) ((unsigned short)(((unsigned long long)(s) * 477218589u) >> 32))
+#define DIV6(s) ((unsigned short)(((unsigned long long)(s) * 715827883u) >> 32))
+#define DIV4(s) ((unsigned short)((s) >> 2))
+
+/*
+ * smooth_row3 - Smooth an interior row b, with rows a above and c
+ * below. The window slides along the row carrying the column sums of
+ * its left, middle and right columns, so each step adds up one new
+ * column. The first and last pixels average 6 pixels, the others 9.
+ */
+static void smooth_row3(int dim, pixel *a, pixel *b, pixel *c, pixel *d)
+{
+    int j;
+    int lr, lg, lb, mr, mg, mb, rr, rg, rb;
+
+    mr = a[0].red + b[0].red + c[0].red;
+    mg = a[0].green + b[0].green + c[0].green;
+    mb = a[0].blue + b[0].blue + c[0].blue;
+    rr = a[1].red + b[1].red + c[1].red;
+    rg = a[1].green + b[1].green + c[1].green;
+    rb = a[1].blue + b[1].blue + c[1].blue;
+    d[0].red = DIV6(mr + rr);
+    d[0].green = DIV6(mg + rg);
+    d[0].blue = DIV6(mb + rb);
+    for (j = 1; j < dim - 1; j++) {
+	lr = mr; lg = mg; lb = mb;
+	mr = rr; mg = rg; mb = rb;
+	rr = a[j+1].red + b[j+1].red + c[j+1].red;
+	rg = a[j+1].green + b[j+1].green + c[j+1].green;
+	rb = a[j+1].blue + b[j+1].blue + c[j+1].blue;
+	d[j].red = DIV9(lr + mr + rr);
+	d[j].green = DIV9(lg + mg + rg);
+	d[j].blue = DIV9(lb + mb + rb);
+    }
+    d[dim-1].red = DIV6(mr + rr);
+    d[dim-1].green = DIV6(mg + rg);
+    d[dim-1].blue = DIV6(mb + rb);
+}
+
+/*
+ * smooth_row2 - Smooth the top or bottom row from the two rows a and
+ * b: the corners average 4 pixels, the rest of the row 6
+ */
+static void smooth_row2(int dim, pixel *a, pixel *b, pixel *d)
+{
+    int j;
+    int lr, lg, lb, mr, mg, mb, rr, rg, rb;
+
+    mr = a[0].red + b[0].red;
+    mg = a[0].green + b[0].green;
+    mb = a[0].blue + b[0].blue;
+    rr = a[1].red + b[1].red;
+    rg = a[1].green + b[1].green;
+    rb = a[1].blue + b[1].blue;
+    d[0].red = DIV4(mr + rr);
+    d[0].green = DIV4(mg + rg);
+    d[0].blue = DIV4(mb + rb);
+    for (j = 1; j < dim - 1; j++) {
+	lr = mr; lg = mg; lb = mb;
+	mr = rr; mg = rg; mb = rb;
+	rr = a[j+1].red + b[j+1].red;
+	rg = a[j+1].green + b[j+1].green;
+	rb = a[j+1].blue + b[j+1].blue;
+	d[j].red = DIV6(lr + mr + rr);
+	d[j].green = DIV6(lg + mg + rg);
+	d[j].blue = DIV6(lb + mb + rb);
+    }
+    d[dim-1].red = DIV4(mr + rr);
+    d[dim-1].green = DIV4(mg + rg);
+    d[dim-1].blue = DIV4(mb + rb);
+}
+
+/*
+ * smooth_rows - Smooth dst rows i0 to i1-1 of an image of at least 2
+ * rows, the top and bottom row with smooth_row2 and the rest with
+ * smooth_row3
+ */
+static void smooth_rows(int dim, pixel *src, pixel *dst, int i0, int i1)
+{
+    int i;
+
+    for (i = i0; i < i1; i++) {
+	if (i == 0)
+	    smooth_row2(dim, src, src + dim, dst);
+	else if (i == dim - 1)
+	    smooth_row2(dim, src + (dim-2)*dim, src + (dim-1)*dim, 
+			dst + (dim-1)*dim);
+	else
+	    smooth_row3(dim, src + (i-1)*dim, src + i*dim, src + (i+1)*dim, 
+			dst + i*dim);
+    }
+}
+
+/*
+ * separable_smooth - Smooth row by row, in memory order, with the top
+ * and bottom rows and the first and last column of each row handled
+ * apart from the interior, so no pixel needs a bounds check
+ */
+char separable_smooth_descr[] = "separable_smooth: Running column sums, edges apart";
+void separable_smooth(int dim, pixel *src, pixel *dst) 
+{
+    if (dim < 2) {
+	naive_smooth(dim, src, dst);
+	return;
+    }
+    smooth_rows(dim, src, dst, 0, dim);
+}
+
+/* Part id of n of parallel_smooth: a band of dst rows */
+static void smooth_part(void *p, int id, int n)
+{
+    kernel_args *a = (kernel_args *)p;
+
+    smooth_rows(a->dim, a->src, a->dst, a->dim * id / n, a->dim * (id+1) / n);
+}
+
+/*
+ * parallel_smooth - separable_smooth split over the thread pool, each
+ * thread smoothing a band of rows
+ */
+char parallel_smooth_descr[] = "parallel_smooth: separable_smooth, row bands on the thread pool";
+void parallel_smooth(int dim, pixel *src, pixel *dst) 
+{
+    kernel_args a = { dim, src, dst };
+
+    if (dim < 2) {
+	naive_smooth(dim, src, dst);
+	return;
+    }
+    pool_run(smooth_part, &a);
+}
+
 /*
  * smooth - Your current working version of smooth. 
  * IMPORTANT: This is the version you will be graded on
@@ -155,7 +478,7 @@ void naive_smooth(int dim, pixel *src, pixel *dst)
 char smooth_descr[] = "smooth: Current working version";
 void smooth(int dim, pixel *src, pixel *dst) 
 {
-    naive_smooth(dim, src, dst);
+    separable_smooth(dim, src, dst);
 }
 
 
@@ -169,6 +492,8 @@ void smooth(int dim, pixel *src, pixel *dst)
 
 void register_smooth_functions() {
     add_smooth_function(&smooth, smooth_descr);
+    add_smooth_function(&separable_smooth, separable_smooth_descr);
+    add_smooth_function(&parallel_smooth, parallel_smooth_descr);
     //add_smooth_function(&naive_smooth, naive_smooth_descr);
     /* ... Register additional test functions here */
 }
@@ -0,0 +1,234 @@
+/*
+ * planes.c - Rotate and smooth on structure of arrays images (see
+ * planes.h), with SSE2 where the compiler has it
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include "planes.h"
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+typedef unsigned short u16;
+
+planes_t *planes_alloc(int dim)
+{
+    planes_t *p = malloc(sizeof(planes_t));
+    size_t bytes = (size_t)dim * dim * sizeof(u16);
+
+    if (p == NULL || posix_memalign((void **)&p->red, 16, bytes) ||
+	posix_memalign((void **)&p->green, 16, bytes) ||
+	posix_memalign((void **)&p->blue, 16, bytes) ||
+	(p->sum = malloc(dim * sizeof(unsigned))) == NULL) {
+	fprintf(stderr, "planes_alloc: out of memory\n");
+	exit(1);
+    }
+    p->dim = dim;
+    return p;
+}
+
+void planes_free(planes_t *p)
+{
+    free(p->red);
+    free(p->green);
+    free(p->blue);
+    free(p->sum);
+    free(p);
+}
+
+void to_planes(int dim, pixel *src, planes_t *dst)
+{
+    int i;
+
+    for (i = 0; i < dim*dim; i++) {
+	dst->red[i] = src[i].red;
+	dst->green[i] = src[i].green;
+	dst->blue[i] = src[i].blue;
+    }
+}
+
+void from_planes(planes_t *src, pixel *dst)
+{
+    int i, dim = src->dim;
+
+    for (i = 0; i < dim*dim; i++) {
+	dst[i].red = src->red[i];
+	dst[i].green = src->green[i];
+	dst[i].blue = src->blue[i];
+    }
+}
+
+/***************
+ * ROTATE
+ ***************/
+
+/*
+ * rotate_plane - Rotate one plane. With SSE2 the plane is cut into
+ * 8x8 blocks that are transposed in registers with 16, 32 and 64-bit
+ * unpacks; each block column is stored as 16 bytes of a dst row. The
+ * blocks are walked in bands of 32 src columns so the src lines stay
+ * cached from one row of blocks to the next.
+ */
+static void rotate_plane(int dim, u16 *src, u16 *dst)
+{
+    int i, j, jj, k, dim8 = 0;
+
+#ifdef __SSE2__
+    __m128i r[8], a[8], b[8];
+
+    dim8 = dim & ~7;
+    for (jj = 0; jj < dim8; jj += 32) {
+	for (i = 0; i < dim8; i += 8) {
+	    for (j = jj; j < jj + 32 && j < dim8; j += 8) {
+		for (k = 0; k < 8; k++)
+		    r[k] = _mm_loadu_si128((__m128i *)&src[RIDX(i+k, j, dim)]);
+		for (k = 0; k < 8; k += 2) {
+		    a[k/2] = _mm_unpacklo_epi16(r[k], r[k+1]);
+		    a[k/2+4] = _mm_unpackhi_epi16(r[k], r[k+1]);
+		}
+		/* a[0..3]: cols 0-3 of row pairs; a[4..7]: cols 4-7 */
+		b[0] = _mm_unpacklo_epi32(a[0], a[1]);
+		b[1] = _mm_unpackhi_epi32(a[0], a[1]);
+		b[2] = _mm_unpacklo_epi32(a[4], a[5]);
+		b[3] = _mm_unpackhi_epi32(a[4], a[5]);
+		b[4] = _mm_unpacklo_epi32(a[2], a[3]);
+		b[5] = _mm_unpackhi_epi32(a[2], a[3]);
+		b[6] = _mm_unpacklo_epi32(a[6], a[7]);
+		b[7] = _mm_unpackhi_epi32(a[6], a[7]);
+		/* b[c/2] and b[c/2+4] hold columns c and c+1 of rows 0-3 and 4-7 */
+		for (k = 0; k < 8; k += 2) {
+		    _mm_storeu_si128((__m128i *)&dst[RIDX(dim-1-(j+k), i, dim)],
+				     _mm_unpacklo_epi64(b[k/2], b[k/2+4]));
+		    _mm_storeu_si128((__m128i *)&dst[RIDX(dim-2-(j+k), i, dim)],
+				     _mm_unpackhi_epi64(b[k/2], b[k/2+4]));
+		}
+	    }
+	}
+    }
+#endif
+
+    /* What the blocks did not cover */
+    for (i = 0; i < dim; i++)
+	for (j = (i < dim8 ? dim8 : 0); j < dim; j++)
+	    dst[RIDX(dim-1-j, i, dim)] = src[RIDX(i, j, dim)];
+}
+
+void planes_rotate(planes_t *src, planes_t *dst)
+{
+    rotate_plane(src->dim, src->red, dst->red);
+    rotate_plane(src->dim, src->green, dst->green);
+    rotate_plane(src->dim, src->blue, dst->blue);
+}
+
+/***************
+ * SMOOTH
+ ***************/
+
+/* avg_plane - Average of the up to 9 values around (i,j), for the borders */
+static u16 avg_plane(int dim, u16 *src, int i, int j)
+{
+    int ii, jj, sum = 0, num = 0;
+
+    for (ii = (i > 0 ? i-1 : 0); ii <= i+1 && ii < dim; ii++)
+	for (jj = (j > 0 ? j-1 : 0); jj <= j+1 && jj < dim; jj++) {
+	    sum += src[RIDX(ii, jj, dim)];
+	    num++;
+	}
+    return sum / num;
+}
+
+/*
+ * col_sums - The sums of the values in rows a, b and c down each of
+ * the dim columns. 3 values of 16 bits overflow a 16-bit lane, so the
+ * sums are widened to 32 bits.
+ */
+static void col_sums(int dim, u16 *a, u16 *b, u16 *c, unsigned *sum)
+{
+    int j = 0;
+
+#ifdef __SSE2__
+    const __m128i zero = _mm_setzero_si128();
+
+    for (; j + 8 <= dim; j += 8) {
+	__m128i x = _mm_loadu_si128((__m128i *)(a + j));
+	__m128i y = _mm_loadu_si128((__m128i *)(b + j));
+	__m128i z = _mm_loadu_si128((__m128i *)(c + j));
+
+	_mm_storeu_si128((__m128i *)(sum + j),
+			 _mm_add_epi32(_mm_add_epi32(_mm_unpacklo_epi16(x, zero),
+						     _mm_unpacklo_epi16(y, zero)),
+				       _mm_unpacklo_epi16(z, zero)));
+	_mm_storeu_si128((__m128i *)(sum + j + 4),
+			 _mm_add_epi32(_mm_add_epi32(_mm_unpackhi_epi16(x, zero),
+						     _mm_unpackhi_epi16(y, zero)),
+				       _mm_unpackhi_epi16(z, zero)));
+    }
+#endif
+    for (; j < dim; j++)
+	sum[j] = a[j] + b[j] + c[j];
+}
+
+#ifdef __SSE2__
+/*
+ * div9 - The 4 sums of 3 column sums around sum, divided by 9. A float
+ * multiply by 1/9 gives a quotient that is at most one off, and the
+ * remainder tells which way to fix it.
+ */
+static inline __m128i div9(unsigned *sum)
+{
+    __m128i s = _mm_add_epi32(_mm_add_epi32(_mm_loadu_si128((__m128i *)(sum - 1)),
+					    _mm_loadu_si128((__m128i *)sum)),
+			      _mm_loadu_si128((__m128i *)(sum + 1)));
+    __m128i q = _mm_cvttps_epi32(_mm_mul_ps(_mm_cvtepi32_ps(s), 
+					     _mm_set1_ps(1.0f / 9)));
+    __m128i r = _mm_sub_epi32(s, _mm_add_epi32(_mm_slli_epi32(q, 3), q));
+
+    q = _mm_sub_epi32(q, _mm_cmpgt_epi32(r, _mm_set1_epi32(8)));
+    return _mm_add_epi32(q, _mm_cmplt_epi32(r, _mm_setzero_si128()));
+}
+#endif
+
+/*
+ * smooth_plane - Smooth one plane: the border values one by one, and
+ * the interior from the column sums of each 3 rows, 8 values at a
+ * time with SSE2
+ */
+static void smooth_plane(int dim, u16 *src, u16 *dst, unsigned *sum)
+{
+    int i, j;
+
+    for (j = 0; j < dim; j++) {
+	dst[RIDX(0, j, dim)] = avg_plane(dim, src, 0, j);
+	dst[RIDX(dim-1, j, dim)] = avg_plane(dim, src, dim-1, j);
+    }
+    for (i = 1; i < dim - 1; i++) {
+	u16 *d = &dst[RIDX(i, 0, dim)];
+
+	col_sums(dim, &src[RIDX(i-1, 0, dim)], &src[RIDX(i, 0, dim)], 
+		 &src[RIDX(i+1, 0, dim)], sum);
+	d[0] = avg_plane(dim, src, i, 0);
+	j = 1;
+#ifdef __SSE2__
+	/* Bias the quotients below 65536 into the range of a signed pack */
+	for (; j + 8 < dim; j += 8) {
+	    const __m128i bias = _mm_set1_epi32(0x8000);
+	    __m128i lo = _mm_sub_epi32(div9(sum + j), bias);
+	    __m128i hi = _mm_sub_epi32(div9(sum + j + 4), bias);
+
+	    _mm_storeu_si128((__m128i *)(d + j), 
+			     _mm_xor_si128(_mm_packs_epi32(lo, hi), 
+					   _mm_set1_epi16((short)0x8000)));
+	}
+#endif
+	for (; j < dim - 1; j++)
+	    d[j] = (sum[j-1] + sum[j] + sum[j+1]) / 9;
+	d[dim-1] = avg_plane(dim, src, i, dim-1);
+    }
+}
+
+void planes_smooth(planes_t *src, planes_t *dst)
+{
+    smooth_plane(src->dim, src->red, dst->red, src->sum);
+    smooth_plane(src->dim, src->green, dst->green, src->sum);
+    smooth_plane(src->dim, src->blue, dst->blue, src->sum);
+}
@@ -0,0 +1,34 @@
+/*
+ * planes.h - A structure of arrays image: the red, green and blue
+ * values of a dimxdim image kept in three separate planes, so that
+ * SIMD code can work on 8 values of one colour at a time instead of
+ * picking them out of 6-byte pixels.
+ */
+#ifndef _PLANES_H_
+#define _PLANES_H_
+
+#include "defs.h"
+
+typedef struct {
+    int dim;
+    unsigned short *red;    /* dim*dim values each, 16 byte aligned */
+    unsigned short *green;
+    unsigned short *blue;
+    unsigned *sum;          /* dim column sums, scratch for planes_smooth */
+} planes_t;
+
+typedef void (*planes_func)(planes_t *, planes_t *);
+
+/* Allocate and free the planes of a dimxdim image */
+planes_t *planes_alloc(int dim);
+void planes_free(planes_t *p);
+
+/* Convert between pixels and planes */
+void to_planes(int dim, pixel *src, planes_t *dst);
+void from_planes(planes_t *src, pixel *dst);
+
+/* The rotate and smooth kernels on planes */
+void planes_rotate(planes_t *src, planes_t *dst);
+void planes_smooth(planes_t *src, planes_t *dst);
+
+#endif /* _PLANES_H_ */
@@ -0,0 +1,113 @@
+/* 
+ * pool.c - A persistent pool of worker threads (see pool.h)
+ *
+ * The workers sleep on a condition variable until pool_run bumps the
+ * job generation, run their part, and the last one to finish wakes
+ * the caller. Part 0 of every job runs on the calling thread.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include "pool.h"
+
+#define MAX_THREADS 64
+
+static pthread_t workers[MAX_THREADS];
+static int nthreads = 1;          /* threads per job, counting the caller */
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t work = PTHREAD_COND_INITIALIZER;  /* new job or quit */
+static pthread_cond_t done = PTHREAD_COND_INITIALIZER;  /* job finished */
+static unsigned generation = 0;   /* bumped for every job */
+static int pending = 0;           /* workers still busy with the job */
+static int quit = 0;              /* set to stop the workers */
+static unsigned long runs = 0;    /* pool_run calls, for pool_runs */
+static pool_func job_func;
+static void *job_arg;
+
+/* Body of worker id: run part id of every job until told to quit */
+static void *worker(void *p)
+{
+    int id = (int)(long)p;
+    unsigned seen = 0;
+
+    pthread_mutex_lock(&lock);
+    for (;;) {
+	while (generation == seen && !quit)
+	    pthread_cond_wait(&work, &lock);
+	if (quit)
+	    break;
+	seen = generation;
+	pthread_mutex_unlock(&lock);
+
+	job_func(job_arg, id, nthreads);
+
+	pthread_mutex_lock(&lock);
+	if (--pending == 0)
+	    pthread_cond_signal(&done);
+    }
+    pthread_mutex_unlock(&lock);
+    return NULL;
+}
+
+void pool_init(int n)
+{
+    int i;
+
+    if (n < 1 || n > MAX_THREADS) {
+	fprintf(stderr, "pool_init: %d threads, must be 1 to %d\n", n, MAX_THREADS);
+	exit(1);
+    }
+
+    /* Stop the old workers */
+    pthread_mutex_lock(&lock);
+    quit = 1;
+    pthread_cond_broadcast(&work);
+    pthread_mutex_unlock(&lock);
+    for (i = 1; i < nthreads; i++)
+	pthread_join(workers[i], NULL);
+
+    quit = 0;
+    generation = 0;
+    nthreads = n;
+    for (i = 1; i < nthreads; i++) {
+	if (pthread_create(&workers[i], NULL, worker, (void *)(long)i) != 0) {
+	    fprintf(stderr, "pool_init: pthread_create failed\n");
+	    exit(1);
+	}
+    }
+}
+
+int pool_threads(void)
+{
+    return nthreads;
+}
+
+unsigned long pool_runs(void)
+{
+    return runs;
+}
+
+void pool_run(pool_func f, void *arg)
+{
+    runs++;
+    if (nthreads == 1) {
+	f(arg, 0, 1);
+	return;
+    }
+
+    pthread_mutex_lock(&lock);
+    job_func = f;
+    job_arg = arg;
+    pending = nthreads - 1;
+    generation++;
+    pthread_cond_broadcast(&work);
+    pthread_mutex_unlock(&lock);
+
+    f(arg, 0, nthreads);
+
+    pthread_mutex_lock(&lock);
+    while (pending > 0)
+	pthread_cond_wait(&done, &lock);
+    pthread_mutex_unlock(&lock);
+}
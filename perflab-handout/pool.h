@@ -0,0 +1,24 @@
+/* 
+ * pool.h - A persistent pool of worker threads for the parallel
+ * kernels. The threads are started once by pool_init and then wait
+ * for work, so a kernel call does not pay for creating threads.
+ */
+#ifndef _POOL_H_
+#define _POOL_H_
+
+/* A piece of work: part id of nparts, where part 0 runs on the caller */
+typedef void (*pool_func)(void *arg, int id, int nparts);
+
+/* (Re)start the pool with nthreads threads, counting the caller */
+void pool_init(int nthreads);
+
+/* Number of threads pool_run uses, 1 if the pool was never started */
+int pool_threads(void);
+
+/* Run f(arg, id, n) for every id in [0, n) on the pool and wait for all */
+void pool_run(pool_func f, void *arg);
+
+/* Number of pool_run calls so far, to tell kernels that use the pool */
+unsigned long pool_runs(void);
+
+#endif /* _POOL_H_ */
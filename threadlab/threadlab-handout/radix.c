@@ -0,0 +1,228 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "radix.h"
+
+// bytes of write-combining buffers for one thread: RADIX_WC of keys
+// per digit, then the values that go with them
+#define WC_ITEMS(job) (RADIX_WC / (job)->key_size)
+#define WC_BYTES(job) (RADIX * (RADIX_WC + WC_ITEMS(job) * (job)->val_size))
+
+int radix_job_init(radix_job_t *job, void *keys, void *vals, long n,
+		   int key_size, int val_size, int nthreads){
+	memset(job, 0, sizeof(*job));
+	if ((key_size != 4 && key_size != 8) || (val_size != 0 && val_size != 4 && val_size != 8) ||
+	    (val_size && !vals) || n < 0 || nthreads < 1)
+		return -1;
+
+	job->keys = keys;
+	job->vals = val_size ? vals : NULL;
+	job->n = n;
+	job->key_size = key_size;
+	job->val_size = val_size;
+	job->nthreads = nthreads;
+	job->tmp_keys = malloc(n * key_size + 1);
+	job->tmp_vals = malloc(n * val_size + 1);
+	if (posix_memalign((void **)&job->counts, 64, nthreads * sizeof(radix_counts_t)) != 0)
+		job->counts = NULL;
+	if (posix_memalign((void **)&job->wc, 64, (size_t)nthreads * WC_BYTES(job)) != 0)
+		job->wc = NULL;
+	if (!job->tmp_keys || !job->tmp_vals || !job->counts || !job->wc){
+		radix_job_free(job);
+		return -1;
+	}
+	pthread_barrier_init(&job->barrier, NULL, nthreads);
+	return 0;
+}
+
+void radix_job_free(radix_job_t *job){
+	if (job->counts && job->wc)
+		pthread_barrier_destroy(&job->barrier);
+	free(job->tmp_keys);
+	free(job->tmp_vals);
+	free(job->counts);
+	free(job->wc);
+	memset(job, 0, sizeof(*job));
+}
+
+static inline __attribute__((always_inline))
+uint64_t load_key(const void *keys, long i, const int ks){
+	return ks == 4 ? ((const uint32_t *)keys)[i] : ((const uint64_t *)keys)[i];
+}
+
+// count the digits at shift of keys [start, end)
+static void count_digits(const void *keys, long start, long end, int shift, int ks, long *count){
+	long i;
+
+	memset(count, 0, RADIX * sizeof(long));
+	if (ks == 4)
+		for (i = start; i < end; i++)
+			count[(load_key(keys, i, 4) >> shift) & (RADIX-1)]++;
+	else
+		for (i = start; i < end; i++)
+			count[(load_key(keys, i, 8) >> shift) & (RADIX-1)]++;
+}
+
+// move keys (and vals) [start, end) of src to their digit's place in
+// dst, starting at off[digit]; always inlined into scatter with
+// constant sizes, so every copy is a single move
+static inline __attribute__((always_inline))
+void scatter_n(radix_job_t *job, int id, const void *src_k, const void *src_v,
+	       void *dst_k, void *dst_v, long start, long end, int shift, long *off,
+	       const int ks, const int vs){
+	const int per = RADIX_WC / ks;
+	unsigned char *kbuf = job->wc + (size_t)id * WC_BYTES(job);
+	unsigned char *vbuf = kbuf + RADIX * RADIX_WC;
+	int fill[RADIX];
+	long i;
+	int d;
+
+	memset(fill, 0, sizeof(fill));
+	for (i = start; i < end; i++){
+		d = (load_key(src_k, i, ks) >> shift) & (RADIX-1);
+		int f = fill[d];
+
+		memcpy(kbuf + d*RADIX_WC + f*ks, (const char *)src_k + i*ks, ks);
+		if (vs)
+			memcpy(vbuf + (d*per + f)*vs, (const char *)src_v + i*vs, vs);
+		if (++f == per){
+			memcpy((char *)dst_k + off[d]*ks, kbuf + d*RADIX_WC, RADIX_WC);
+			if (vs)
+				memcpy((char *)dst_v + off[d]*vs, vbuf + d*per*vs, per*vs);
+			off[d] += per;
+			f = 0;
+		}
+		fill[d] = f;
+	}
+
+	for (d = 0; d < RADIX; d++){
+		memcpy((char *)dst_k + off[d]*ks, kbuf + d*RADIX_WC, fill[d]*ks);
+		if (vs)
+			memcpy((char *)dst_v + off[d]*vs, vbuf + d*per*vs, fill[d]*vs);
+	}
+}
+
+static void scatter(radix_job_t *job, int id, const void *src_k, const void *src_v,
+		    void *dst_k, void *dst_v, long start, long end, int shift, long *off){
+	switch (job->key_size * 16 + job->val_size){
+	case 4*16 + 0: scatter_n(job, id, src_k, src_v, dst_k, dst_v, start, end, shift, off, 4, 0); break;
+	case 4*16 + 4: scatter_n(job, id, src_k, src_v, dst_k, dst_v, start, end, shift, off, 4, 4); break;
+	case 4*16 + 8: scatter_n(job, id, src_k, src_v, dst_k, dst_v, start, end, shift, off, 4, 8); break;
+	case 8*16 + 0: scatter_n(job, id, src_k, src_v, dst_k, dst_v, start, end, shift, off, 8, 0); break;
+	case 8*16 + 4: scatter_n(job, id, src_k, src_v, dst_k, dst_v, start, end, shift, off, 8, 4); break;
+	default:       scatter_n(job, id, src_k, src_v, dst_k, dst_v, start, end, shift, off, 8, 8); break;
+	}
+}
+
+void radix_job_run(radix_job_t *job, int id){
+	const long n = job->n;
+	const int ks = job->key_size, vs = job->val_size, T = job->nthreads;
+	const long start = (long)id * n / T, end = (long)(id+1) * n / T;
+	void *src_k = job->keys, *src_v = job->vals;
+	void *dst_k = job->tmp_keys, *dst_v = job->tmp_vals, *swap;
+	long off[RADIX];
+	int pass, t, d;
+
+	for (pass = 0; pass < ks * 8 / RADIX_BITS; pass++){
+		int shift = pass * RADIX_BITS;
+		long base = 0;
+		int skip = 0;
+
+		count_digits(src_k, start, end, shift, ks, job->counts[id].count);
+		pthread_barrier_wait(&job->barrier);
+
+		// our first element of digit d goes after every element of a
+		// smaller digit, and after those of digit d in earlier blocks;
+		// each thread works this out for itself from all the counts
+		for (d = 0; d < RADIX; d++){
+			long total = 0;
+			for (t = 0; t < T; t++){
+				if (t == id)
+					off[d] = base + total;
+				total += job->counts[t].count[d];
+			}
+			skip |= total == n;  // every key has this digit: nothing moves
+			base += total;
+		}
+
+		if (!skip){
+			scatter(job, id, src_k, src_v, dst_k, dst_v, start, end, shift, off);
+			swap = src_k; src_k = dst_k; dst_k = swap;
+			swap = src_v; src_v = dst_v; dst_v = swap;
+		}
+		// nobody may recount while another thread reads the counts
+		pthread_barrier_wait(&job->barrier);
+	}
+
+	// an odd number of passes left the result in the scratch arrays
+	if (src_k != job->keys){
+		memcpy((char *)job->keys + start*ks, (char *)src_k + start*ks, (end - start) * ks);
+		if (vs)
+			memcpy((char *)job->vals + start*vs, (char *)src_v + start*vs, (end - start) * vs);
+	}
+}
+
+typedef struct {
+	radix_job_t *job;
+	int id;
+	pthread_mutex_t *lock;  // the threads wait for *go before sorting,
+	pthread_cond_t *cond;   // so that they can be told how many of
+	int *go;                // them there are
+} radix_arg_t;
+
+static void *radix_thread(void *vargp){
+	radix_arg_t *arg = vargp;
+
+	pthread_mutex_lock(arg->lock);
+	while (!*arg->go)
+		pthread_cond_wait(arg->cond, arg->lock);
+	pthread_mutex_unlock(arg->lock);
+	if (arg->id < arg->job->nthreads)
+		radix_job_run(arg->job, arg->id);
+	return NULL;
+}
+
+int radix_sort(void *keys, void *vals, long n, int key_size, int val_size, int nthreads){
+	pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+	pthread_cond_t cond = PTHREAD_COND_INITIALIZER;
+	radix_job_t job;
+	pthread_t *threads;
+	radix_arg_t *args;
+	int i, created, go = 0;
+
+	if (radix_job_init(&job, keys, vals, n, key_size, val_size, nthreads) != 0)
+		return -1;
+	threads = malloc(nthreads * sizeof(*threads));
+	args = malloc(nthreads * sizeof(*args));
+	if (!threads || !args){
+		free(threads);
+		free(args);
+		radix_job_free(&job);
+		return -1;
+	}
+
+	for (created = 1; created < nthreads; created++){
+		args[created] = (radix_arg_t){&job, created, &lock, &cond, &go};
+		if (pthread_create(&threads[created], NULL, radix_thread, &args[created]) != 0)
+			break;
+	}
+	// if some threads could not be created, sort on the ones that were
+	if (created < nthreads){
+		job.nthreads = created;
+		pthread_barrier_destroy(&job.barrier);
+		pthread_barrier_init(&job.barrier, NULL, created);
+	}
+	pthread_mutex_lock(&lock);
+	go = 1;
+	pthread_cond_broadcast(&cond);
+	pthread_mutex_unlock(&lock);
+
+	radix_job_run(&job, 0);
+	for (i = 1; i < created; i++)
+		pthread_join(threads[i], NULL);
+
+	free(threads);
+	free(args);
+	radix_job_free(&job);
+	return 0;
+}
@@ -0,0 +1,48 @@
+#ifndef RADIX_H
+#define RADIX_H
+
+#include <pthread.h>
+
+/*
+ * A parallel LSD radix sort of 32 or 64-bit unsigned keys, optionally
+ * carrying a 32 or 64-bit value with each key, built like histo_5:
+ * every pass each thread counts the digits of its block into its own
+ * padded histogram, works out where its elements of each digit go from
+ * all the histograms, and scatters them there through small per-digit
+ * write-combining buffers. The sort is stable.
+ */
+
+#define RADIX_BITS 8
+#define RADIX (1 << RADIX_BITS)
+#define RADIX_WC 64  // bytes of keys in each write-combining buffer
+
+typedef struct {
+	long count[RADIX];
+} __attribute__((aligned(64))) radix_counts_t;
+
+typedef struct {
+	void *keys, *vals;          // sorted in place; vals may be NULL
+	void *tmp_keys, *tmp_vals;  // scratch of the same sizes
+	long n;
+	int key_size, val_size;     // bytes: 4 or 8, and 0, 4 or 8
+	int nthreads;
+	pthread_barrier_t barrier;
+	radix_counts_t *counts;     // one per thread
+	unsigned char *wc;          // write-combining buffers, per thread
+} radix_job_t;
+
+/* Set up job to sort the n keys (and vals, if val_size is not 0) on
+   nthreads threads; returns 0, or -1 for bad sizes or no memory */
+int radix_job_init(radix_job_t *job, void *keys, void *vals, long n,
+		   int key_size, int val_size, int nthreads);
+
+/* Sort; every one of the job's nthreads threads calls this with its
+   own id from 0 to nthreads-1 */
+void radix_job_run(radix_job_t *job, int id);
+
+void radix_job_free(radix_job_t *job);
+
+/* The same, creating the threads itself: returns 0 or -1 */
+int radix_sort(void *keys, void *vals, long n, int key_size, int val_size, int nthreads);
+
+#endif
@@ -18,10 +18,10 @@ info_t info = {
   "Gurbir Arora",
   "105178554",
 };
-	sem_t mutex; //don't forget to initialize in main
+	sem_t mutex; //don't forget to initialize in init_locks
         pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
-        pthread_barrier_t barrier; //don't forget to initialize in main
-        pthread_mutex_t locks[BUCKET_SIZE]; //don't forget to initialize in main 
+        pthread_barrier_t barrier; //don't forget to initialize in init_locks
+        pthread_mutex_t locks[MAX_BUCKETS]; //don't forget to initialize in init_locks 
 /*  =====================================================================
 	YOUR CODE GOES HERE:
 	
@@ -45,25 +45,34 @@ info_t info = {
     =====================================================================
 */
 
-int main() {
+/* run_threads calls this before running the kernels on a new number
+   of threads, so the barrier always waits for nthreads of them */
+void init_locks(void) {
+	static bool initialized = false;
 	/*  =====================================================================
 	YOUR CODE GOES HERE:
   Initialize your locks here
   =====================================================================
   */
 	
-	int ret = pthread_barrier_init(&barrier, NULL, NULL); 	 
+	if (initialized) pthread_barrier_destroy(&barrier);
+	int ret = pthread_barrier_init(&barrier, NULL, nthreads); 	 
   	int i = 0;
+	if (initialized) return;
 	sem_init(&mutex, 0 , 0);
-	for(i = 0; i < BUCKET_SIZE; i++){
+	for(i = 0; i < MAX_BUCKETS; i++){
 	 pthread_mutex_init(&locks[i], NULL);
 } 
 	
   /*  =====================================================================
 	END YOUR CODE HERE
-  DO NOT TOUCH THE REST OF MAIN
     =====================================================================
   */
+	initialized = true;
+}
+
+int main(int argc, char **argv) {
+  parse_args(argc, argv);
   bool isComplete = check_info(info);
   if(isComplete) run_threads();
 
@@ -91,8 +100,8 @@ void *histo_0(void *vargp){
  	int thread_id = (long int)vargp; 
 	if(thread_id==0) { //only run on thread 0
 		int j;
-		for (j=0; j<DATA_SIZE; j++){
-			global_histogram[data[j]%BUCKET_SIZE]++;
+		for (j=0; j<data_size; j++){
+			global_histogram[data[j]%bucket_size]++;
 		}
 	}        
 }
@@ -115,12 +124,12 @@ void *histo_0(void *vargp){
 */
 
 void *histo_1(void *vargp){
-	int ind = (long int)vargp;
-	ind = ind*STEP;
+	int id = (long int)vargp;
+	long ind = BLOCK_START(id), end = BLOCK_START(id+1);
 	int j;
 	 pthread_mutex_lock(&lock);
-	for (j=ind; j<ind+STEP; j++){
-		global_histogram[data[j]%BUCKET_SIZE]++;
+	for (j=ind; j<end; j++){
+		global_histogram[data[j]%bucket_size]++;
 	}
 	 pthread_mutex_unlock(&lock);
 }
@@ -158,13 +167,13 @@ void *histo_1(void *vargp){
 */
 
 void *histo_2(void *vargp){
-	int ind = (long int)vargp;
-	ind = ind*STEP;
+	int id = (long int)vargp;
+	long ind = BLOCK_START(id), end = BLOCK_START(id+1);
 	int j;
 	// return 0; //make sure to comment out; 	
-	for (j=ind; j<ind+STEP; j++){ 
+	for (j=ind; j<end; j++){ 
 		pthread_mutex_lock(locks);
-		global_histogram[data[j]%BUCKET_SIZE]++;
+		global_histogram[data[j]%bucket_size]++;
 		pthread_mutex_unlock(locks);
 	}	
 }
@@ -203,12 +212,12 @@ void *histo_2(void *vargp){
 */
 
 void *histo_3(void *vargp){
-	int ind = (long int)vargp;
-	ind = ind*STEP;
+	int id = (long int)vargp;
+	long ind = BLOCK_START(id), end = BLOCK_START(id+1);
 	int j;
-	for (j=ind; j<ind+STEP; j++){ 
-		//global_histogram[data[j]%BUCKET_SIZE]++;
-	       __sync_fetch_and_add(&(global_histogram[data[j]%BUCKET_SIZE]),1);
+	for (j=ind; j<end; j++){ 
+		//global_histogram[data[j]%bucket_size]++;
+	       __sync_fetch_and_add(&(global_histogram[data[j]%bucket_size]),1);
 	}
 		
 }
@@ -253,12 +262,12 @@ void *histo_3(void *vargp){
 */
 
 void *histo_4(void *vargp){
-	int ind = (long int)vargp;
-	ind = ind*STEP;
+	int id = (long int)vargp;
+	long ind = BLOCK_START(id), end = BLOCK_START(id+1);
 	int j;	
 	pthread_mutex_lock(locks);
-	for (j=ind; j<ind+STEP; j++){
-	       global_histogram[data[j]%BUCKET_SIZE]++;
+	for (j=ind; j<end; j++){
+	       global_histogram[data[j]%bucket_size]++;
 	} 
 	pthread_mutex_unlock(locks);
 }
@@ -280,3 +289,262 @@ void *histo_4(void *vargp){
     =====================================================================
 */
 
+
+
+/*  =====================================================================
+	BEGIN TASK 5 (privatized histogram)
+    =====================================================================
+    =====================================================================
+
+	Each thread counts its block into its own local histogram,
+	padded to whole cache lines so that no two threads ever write
+	the same line. Within a thread, consecutive elements go to
+	SUBHISTS different sub-histograms: with a single one, a run of
+	equal values makes every increment wait for the store of the
+	previous one to the same counter.
+
+	Once counted, the threads fold their histograms together in a
+	tree, halving the live histograms between barriers, and thread 0
+	publishes the sum.
+
+    =====================================================================
+*/
+
+#define CACHE_LINE 64
+#define SUBHISTS 4  // the loop in histo_5 is unrolled by this much
+
+typedef struct {
+	int count[SUBHISTS][MAX_BUCKETS];
+} __attribute__((aligned(CACHE_LINE))) local_histogram_t;
+
+local_histogram_t local_histogram[MAX_THREADS];
+
+// fold every thread's local histogram into global_histogram;
+// all nthreads threads must call it
+void reduce_histograms(int id){
+	local_histogram_t *mine = &local_histogram[id];
+	int b, r, stride;
+
+	for (r = 1; r < SUBHISTS; r++)
+		for (b = 0; b < bucket_size; b++)
+			mine->count[0][b] += mine->count[r][b];
+
+	for (stride = 1; stride < nthreads; stride *= 2){
+		pthread_barrier_wait(&barrier);
+		if (id % (2*stride) == 0 && id + stride < nthreads)
+			for (b = 0; b < bucket_size; b++)
+				mine->count[0][b] += local_histogram[id+stride].count[0][b];
+	}
+
+	if (id == 0)
+		for (b = 0; b < bucket_size; b++)
+			global_histogram[b] = mine->count[0][b];
+}
+
+// count the n elements at p into the sub-histograms of mine; the
+// buckets come from bucket_of, as a division by the run time
+// bucket_size would cost more than the rest of the loop
+void count_scalar(unsigned char *p, long n, local_histogram_t *mine){
+	long j;
+
+	for (j=0; j+SUBHISTS <= n; j+=SUBHISTS){
+		// load first: the int stores could alias the char data
+		int d0 = p[j], d1 = p[j+1], d2 = p[j+2], d3 = p[j+3];
+		mine->count[0][bucket_of[d0]]++;
+		mine->count[1][bucket_of[d1]]++;
+		mine->count[2][bucket_of[d2]]++;
+		mine->count[3][bucket_of[d3]]++;
+	}
+	for (; j<n; j++)
+		mine->count[0][bucket_of[p[j]]]++;
+}
+
+void *histo_5(void *vargp){
+	int id = (long int)vargp;
+	long start = BLOCK_START(id);
+	local_histogram_t *mine = &local_histogram[id];
+
+	memset(mine, 0, sizeof(*mine));
+	count_scalar(data + start, BLOCK_START(id+1) - start, mine);
+	reduce_histograms(id);
+	return NULL;
+}
+
+/*  =====================================================================
+	END TASK 5
+    =====================================================================
+*/
+
+
+
+/*  =====================================================================
+	BEGIN TASK 6 (SIMD histogram)
+    =====================================================================
+    =====================================================================
+
+	With a power of two bucket_size, data[j] % bucket_size is just
+	its low bits, so a whole vector of bytes can be bucketed with one
+	AND. Each bucket then keeps a vector of byte counters: comparing
+	the bucketed bytes with the bucket number gives -1 in the lanes
+	that match, and subtracting that adds one to them. The byte
+	counters are flushed into ints with a sum of absolute
+	differences before any of them can pass 255.
+
+	This uses AVX2 (32 bytes at a time) when the CPU has it and SSE2
+	(16) otherwise, and falls back to count_scalar for bucket counts
+	that are not a power of two or too many to keep in registers.
+	The threads split the data and reduce exactly like histo_5.
+
+    =====================================================================
+*/
+
+#define SIMD_BUCKETS(n) (((n) & ((n)-1)) == 0 && (n) <= 16)
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+
+// count the n elements at p into count, 32 at a time; always inlined
+// into count_avx2 with a constant nb, so acc stays in registers
+static inline __attribute__((target("avx2"), always_inline))
+long count_avx2_n(unsigned char *p, long n, int *count, const int nb){
+	const __m256i mask = _mm256_set1_epi8(nb-1);
+	const __m256i zero = _mm256_setzero_si256();
+	__m256i acc[16];
+	long i = 0, end;
+	int b;
+
+	while (n - i >= 32){
+		end = i + 32*((n - i)/32 < 255 ? (n - i)/32 : 255);
+		for (b = 0; b < nb; b++)
+			acc[b] = zero;
+		for (; i < end; i += 32){
+			__m256i v = _mm256_and_si256(_mm256_loadu_si256((__m256i *)(p+i)), mask);
+			for (b = 0; b < nb; b++)
+				acc[b] = _mm256_sub_epi8(acc[b], _mm256_cmpeq_epi8(v, _mm256_set1_epi8(b)));
+		}
+		for (b = 0; b < nb; b++){
+			__m256i sum = _mm256_sad_epu8(acc[b], zero);
+			count[b] += _mm256_extract_epi64(sum, 0) + _mm256_extract_epi64(sum, 1) +
+				_mm256_extract_epi64(sum, 2) + _mm256_extract_epi64(sum, 3);
+		}
+	}
+	return i;
+}
+
+__attribute__((target("avx2")))
+long count_avx2(unsigned char *p, long n, int *count){
+	switch (bucket_size){
+	case 1: return count_avx2_n(p, n, count, 1);
+	case 2: return count_avx2_n(p, n, count, 2);
+	case 4: return count_avx2_n(p, n, count, 4);
+	case 8: return count_avx2_n(p, n, count, 8);
+	default: return count_avx2_n(p, n, count, 16);
+	}
+}
+
+// count the n elements at p into count, 16 at a time
+static inline __attribute__((target("sse2"), always_inline))
+long count_sse2_n(unsigned char *p, long n, int *count, const int nb){
+	const __m128i mask = _mm_set1_epi8(nb-1);
+	const __m128i zero = _mm_setzero_si128();
+	__m128i acc[16];
+	long i = 0, end;
+	int b;
+
+	while (n - i >= 16){
+		end = i + 16*((n - i)/16 < 255 ? (n - i)/16 : 255);
+		for (b = 0; b < nb; b++)
+			acc[b] = zero;
+		for (; i < end; i += 16){
+			__m128i v = _mm_and_si128(_mm_loadu_si128((__m128i *)(p+i)), mask);
+			for (b = 0; b < nb; b++)
+				acc[b] = _mm_sub_epi8(acc[b], _mm_cmpeq_epi8(v, _mm_set1_epi8(b)));
+		}
+		for (b = 0; b < nb; b++){
+			__m128i sum = _mm_sad_epu8(acc[b], zero);
+			count[b] += _mm_cvtsi128_si32(sum) + _mm_extract_epi16(sum, 4);
+		}
+	}
+	return i;
+}
+
+__attribute__((target("sse2")))
+long count_sse2(unsigned char *p, long n, int *count){
+	switch (bucket_size){
+	case 1: return count_sse2_n(p, n, count, 1);
+	case 2: return count_sse2_n(p, n, count, 2);
+	case 4: return count_sse2_n(p, n, count, 4);
+	case 8: return count_sse2_n(p, n, count, 8);
+	default: return count_sse2_n(p, n, count, 16);
+	}
+}
+#endif
+
+// count the n elements at p into mine, with SIMD where possible
+void count_block(unsigned char *p, long n, local_histogram_t *mine){
+	long done = 0;
+
+#if defined(__x86_64__) || defined(__i386__)
+	if (SIMD_BUCKETS(bucket_size)){
+		if (__builtin_cpu_supports("avx2"))
+			done = count_avx2(p, n, mine->count[0]);
+		else if (__builtin_cpu_supports("sse2"))
+			done = count_sse2(p, n, mine->count[0]);
+	}
+#endif
+	count_scalar(p + done, n - done, mine);
+}
+
+void *histo_6(void *vargp){
+	int id = (long int)vargp;
+	long start = BLOCK_START(id);
+	local_histogram_t *mine = &local_histogram[id];
+
+	memset(mine, 0, sizeof(*mine));
+	count_block(data + start, BLOCK_START(id+1) - start, mine);
+	reduce_histograms(id);
+	return NULL;
+}
+
+/*  =====================================================================
+	END TASK 6
+    =====================================================================
+*/
+
+
+
+/*  =====================================================================
+	BEGIN TASK 7 (work stealing)
+    =====================================================================
+    =====================================================================
+
+	histo_6 gives every thread one block, so the run takes as long
+	as the slowest thread: one that shares its core with another
+	program holds up all the others. Here the data is cut into
+	chunks of chunk_size elements, and every thread starts with the
+	chunks of its own block in a deque. A thread takes chunks from
+	the front of its own deque, and once that is empty it steals
+	the back half of another thread's (see next_chunk in util.c),
+	so the fast threads end up doing the work of the slow one.
+
+	The chunks are counted and reduced exactly like histo_6.
+
+    =====================================================================
+*/
+
+void *histo_7(void *vargp){
+	int id = (long int)vargp;
+	local_histogram_t *mine = &local_histogram[id];
+	long start, end;
+
+	memset(mine, 0, sizeof(*mine));
+	while (next_chunk(id, &start, &end))
+		count_block(data + start, end - start, mine);
+	reduce_histograms(id);
+	return NULL;
+}
+
+/*  =====================================================================
+	END TASK 7
+    =====================================================================
+*/
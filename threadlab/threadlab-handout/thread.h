@@ -6,17 +6,36 @@
 #include <stdio.h>
 #include <pthread.h>
 #include <stdlib.h>
+#include <string.h>
 #include <semaphore.h>
 
-#define DATA_SIZE 100000000
+#define DATA_SIZE 100000000  // defaults, changed with -n, -t and -b
 #define NTHREADS 8
-#define STEP (DATA_SIZE/NTHREADS)
-#define DATA_MAX 255
 #define BUCKET_SIZE 8
+#define DATA_MAX 255
+#define MAX_THREADS 64
+#define MAX_BUCKETS (DATA_MAX+1)
+
+extern long data_size;
+extern int nthreads;
+extern int bucket_size;
+
+// first element of thread id's block; the blocks differ by at most
+// one element, so none of the data is left over
+#define BLOCK_START(id) ((long)(id) * data_size / nthreads)
+
+#define CHUNK_SIZE 16384  // default elements per work-stealing chunk
+extern long chunk_size;
+
+// set [*start, *end) to the next chunk for thread id to count,
+// stealing from other threads once its own are done; false when
+// there are none left
+bool next_chunk(int id, long *start, long *end);
 
-extern int bucket[BUCKET_SIZE];  // record correct bucket result
-extern int global_histogram[BUCKET_SIZE];
-extern unsigned char data[DATA_SIZE];
+extern int bucket[MAX_BUCKETS];  // record correct bucket result
+extern int global_histogram[MAX_BUCKETS];
+extern unsigned char *data;
+extern unsigned char bucket_of[DATA_MAX+1];  // datum % bucket_size
 
 typedef struct {
     char *name;  /* Your full name */
@@ -37,8 +56,20 @@ void *histo_3(void *vargp);
 
 void *histo_4(void *vargp);
 
+void *histo_5(void *vargp);
+
+void *histo_6(void *vargp);
+
+void *histo_7(void *vargp);
+
+#define NROUTINES 8
+
 typedef void* (*f)(void* );
-extern f thread_routine[5];  
+extern f thread_routine[NROUTINES];  
+
+void init_locks(void);
+
+void parse_args(int argc, char **argv);
 
 void run_threads(void);
 
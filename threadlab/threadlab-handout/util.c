@@ -1,72 +1,601 @@
+#define _GNU_SOURCE  // for pthread_setaffinity_np
 #include "thread.h"
+#include "radix.h"
+#include "clock.h"
+#include <limits.h>
+#include <stdint.h>
+#include <sched.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
 
-int bucket[BUCKET_SIZE] = {0};  // record correct bucket result
-int global_histogram[BUCKET_SIZE] = {0};
-unsigned char data[DATA_SIZE];
+long data_size = DATA_SIZE;
+int nthreads = NTHREADS;
+int bucket_size = BUCKET_SIZE;
+long chunk_size = CHUNK_SIZE;
 
-int lower_range[5] = {0, 13000, 10000, 1000, 0};
-int upper_range[5] = {200, 45000, 20000, 5000, 1000};
+int bucket[MAX_BUCKETS] = {0};  // record correct bucket result
+int global_histogram[MAX_BUCKETS] = {0};
+unsigned char *data;
+unsigned char bucket_of[DATA_MAX+1];
 
-int flag_range[5] = {0};
-int correctness[5] = {0};
+int lower_range[NROUTINES] = {0, 13000, 10000, 1000, 0, 0, 0, 0};
+int upper_range[NROUTINES] = {200, 45000, 20000, 5000, 1000, 1000, 1000, 1000};
 
-f thread_routine[5] = {&histo_0, &histo_1, &histo_2, &histo_3, &histo_4};
+int flag_range[NROUTINES] = {0};
+int correctness[NROUTINES] = {0};
 
-void run_threads(){
-  // time variables
-	struct timeval start, end;
-	long mtime, secs, usecs; 
+f thread_routine[NROUTINES] = {&histo_0, &histo_1, &histo_2, &histo_3, &histo_4, &histo_5, &histo_6, &histo_7};
+
+static bool sweep = false;  // time every routine on 1..nthreads threads
+static bool pin = false;    // pin worker i to the i-th allowed CPU
+static bool unbalanced = false;  // compare schedules with a busy CPU
+static long sort_size = 0;  // keys for the radix sort benchmark, if any
+static int trials = 3;      // timed runs of each routine
+static unsigned long seed = 1;  // of the generated data
 
-	// thread id
-	pthread_t thread_id[NTHREADS];
+static void usage(char *prog){
+	fprintf(stderr, "Usage: %s [-hsp] [-n <size>] [-t <threads>] [-b <buckets>]\n", prog);
+	fprintf(stderr, "       [-r <trials>] [-S <seed>] [-c <chunk>] [-u] [-R <keys>]\n");
+	fprintf(stderr, "Options:\n");
+	fprintf(stderr, "  -h           Print this message\n");
+	fprintf(stderr, "  -n <size>    Histogram <size> random bytes (default %d)\n", DATA_SIZE);
+	fprintf(stderr, "  -t <threads> Run the kernels on 1 to %d threads (default %d)\n", MAX_THREADS, NTHREADS);
+	fprintf(stderr, "  -b <buckets> Count 1 to %d buckets (default %d)\n", MAX_BUCKETS, BUCKET_SIZE);
+	fprintf(stderr, "  -s           Time each kernel on 1 to <threads> threads and print\n");
+	fprintf(stderr, "               its speedup and parallel efficiency\n");
+	fprintf(stderr, "  -r <trials>  Time each kernel <trials> times and report the\n");
+	fprintf(stderr, "               fastest and median run (default 3)\n");
+	fprintf(stderr, "  -p           Pin each worker thread to its own CPU\n");
+	fprintf(stderr, "  -S <seed>    Seed for the generated data (default 1)\n");
+	fprintf(stderr, "  -c <chunk>   Steal work in chunks of <chunk> elements (default %d)\n", CHUNK_SIZE);
+	fprintf(stderr, "  -u           Implies -p; compare the static and work stealing\n");
+	fprintf(stderr, "               schedules with and without another process\n");
+	fprintf(stderr, "               spinning on the CPU of worker 0\n");
+	fprintf(stderr, "  -R <keys>    Time the radix sort against qsort on <keys> random\n");
+	fprintf(stderr, "               32 and 64-bit keys and key-value pairs, instead\n");
+	fprintf(stderr, "               of the histograms\n");
+	exit(1);
+}
 
-	long int i;
+// parse a number in [lo, hi] for option opt, or exit
+static long parse_num(char opt, char *arg, long lo, long hi){
+	char *end;
+	long v = strtol(arg, &end, 0);
 
-	// generate data
-	for (i = 0; i < DATA_SIZE; i++) { 
-		int datum = rand() % DATA_MAX; 
-		data[i] = datum;
-		bucket[datum%BUCKET_SIZE]++;
+	if (*arg == '\0' || *end != '\0' || v < lo || v > hi){
+		fprintf(stderr, "-%c: expected a number from %ld to %ld, got '%s'\n", opt, lo, hi, arg);
+		exit(1);
 	}
+	return v;
+}
 
-	// run through each thread routine
-	int thread_rt_id;
-	for (thread_rt_id = 0; thread_rt_id < 5; thread_rt_id++){
+void parse_args(int argc, char **argv){
+	int c;
 
-		int buc_id;
-		for (buc_id=0; buc_id<BUCKET_SIZE; buc_id++){
-			global_histogram[buc_id] = 0;
+	while ((c = getopt(argc, argv, "hn:t:b:sr:pS:c:uR:")) != -1){
+		switch (c){
+		case 'n':
+			data_size = parse_num(c, optarg, 1, INT_MAX);
+			break;
+		case 't':
+			nthreads = parse_num(c, optarg, 1, MAX_THREADS);
+			break;
+		case 'b':
+			bucket_size = parse_num(c, optarg, 1, MAX_BUCKETS);
+			break;
+		case 's':
+			sweep = true;
+			break;
+		case 'r':
+			trials = parse_num(c, optarg, 1, 1000);
+			break;
+		case 'p':
+			pin = true;
+			break;
+		case 'S':
+			seed = parse_num(c, optarg, 0, LONG_MAX);
+			break;
+		case 'c':
+			chunk_size = parse_num(c, optarg, 1, INT_MAX);
+			break;
+		case 'u':
+			unbalanced = pin = true;
+			break;
+		case 'R':
+			sort_size = parse_num(c, optarg, 1, LONG_MAX / 16);
+			break;
+		default:
+			usage(argv[0]);
 		}
+	}
+	if (optind < argc)
+		usage(argv[0]);
+}
 
-		printf("\nRunning thread_%d: \n", thread_rt_id);
-		// get start time
-		gettimeofday(&start, NULL);
+/*
+ * The worker pool: pool_size threads that stay parked on pool_wake
+ * between kernels, so that no thread is created or joined inside a
+ * timed run. pool_run hands every worker the same routine, with the
+ * worker's number as its argument, and waits until all have returned.
+ */
+static pthread_t pool_thread[MAX_THREADS];
+static int pool_size = 0;
+static pthread_mutex_t pool_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t pool_wake = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t pool_done = PTHREAD_COND_INITIALIZER;
+static f pool_routine;            // what to run next; NULL makes the workers exit
+static unsigned long pool_gen;    // bumped for every pool_run
+static unsigned long pool_base;   // pool_gen when the workers were created
+static int pool_busy;             // workers still running pool_routine
 
-		for(i=0; i<NTHREADS; i++){
-			pthread_create(&thread_id[i], NULL, thread_routine[thread_rt_id], (void*)i);
-		}		
+// pin the calling thread to the id-th CPU it is allowed to run on
+static void pin_thread(long id){
+	cpu_set_t allowed, one;
+	int cpu, n = 0, ncpus = 0;
 
-		for(i=0; i < NTHREADS; i++)
-		{
-			pthread_join( thread_id[i], NULL); 
+	if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0)
+		return;
+	ncpus = CPU_COUNT(&allowed);
+	for (cpu = 0; cpu < CPU_SETSIZE; cpu++){
+		if (CPU_ISSET(cpu, &allowed) && n++ == id % ncpus){
+			CPU_ZERO(&one);
+			CPU_SET(cpu, &one);
+			pthread_setaffinity_np(pthread_self(), sizeof(one), &one);
+			return;
 		}
+	}
+}
+
+static void *pool_worker(void *vargp){
+	long id = (long)vargp;
+	unsigned long seen = pool_base;
+	f routine;
+
+	if (pin)
+		pin_thread(id);
+	do {
+		pthread_mutex_lock(&pool_lock);
+		while (pool_gen == seen)
+			pthread_cond_wait(&pool_wake, &pool_lock);
+		seen = pool_gen;
+		routine = pool_routine;
+		pthread_mutex_unlock(&pool_lock);
+
+		if (routine)
+			routine((void*)id);
+
+		pthread_mutex_lock(&pool_lock);
+		if (--pool_busy == 0)
+			pthread_cond_signal(&pool_done);
+		pthread_mutex_unlock(&pool_lock);
+	} while (routine);
+	return NULL;
+}
+
+// run routine on every worker and wait for all of them
+static void pool_run(f routine){
+	pthread_mutex_lock(&pool_lock);
+	pool_routine = routine;
+	pool_busy = pool_size;
+	pool_gen++;
+	pthread_cond_broadcast(&pool_wake);
+	while (pool_busy > 0)
+		pthread_cond_wait(&pool_done, &pool_lock);
+	pthread_mutex_unlock(&pool_lock);
+}
+
+// make the pool n workers, and the locks fit n threads
+static void pool_resize(int n){
+	long i;
+
+	if (n == pool_size)
+		return;
+	if (pool_size > 0){
+		pool_run(NULL);
+		for (i = 0; i < pool_size; i++)
+			pthread_join(pool_thread[i], NULL);
+	}
+	pool_base = pool_gen;
+	for (i = 0; i < n; i++){
+		if (pthread_create(&pool_thread[i], NULL, pool_worker, (void*)i) != 0){
+			fprintf(stderr, "Could not create worker thread %ld\n", i);
+			exit(1);
+		}
+	}
+	pool_size = nthreads = n;
+	init_locks();
+}
+
+/*
+ * The work stealing deques. Thread id's deque holds the chunks
+ * [head, tail) of the data, packed into one word so that the owner
+ * taking the head and a thief taking the tail both CAS the same word.
+ * Chunks only ever leave a deque, so once a thread finds every deque
+ * empty it is done, and a deque never gets back a range it had, so
+ * a CAS cannot succeed on a stale value.
+ */
+#define RANGE(head, tail) ((unsigned long)(tail) << 32 | (unsigned)(head))
+#define HEAD(r) ((long)((r) & 0xffffffffUL))
+#define TAIL(r) ((long)((r) >> 32))
+
+static struct {
+	unsigned long range;
+} __attribute__((aligned(64))) deque[MAX_THREADS];
+
+// give each thread the chunks of its block
+static void reset_chunks(void){
+	long nchunks = (data_size + chunk_size - 1) / chunk_size;
+	int i;
+
+	for (i = 0; i < nthreads; i++)
+		deque[i].range = RANGE((long)i * nchunks / nthreads, (long)(i+1) * nchunks / nthreads);
+}
+
+bool next_chunk(int id, long *start, long *end){
+	unsigned long r;
+	long c;
+	int i;
+
+	// the front of our own deque
+	r = __atomic_load_n(&deque[id].range, __ATOMIC_ACQUIRE);
+	while (HEAD(r) < TAIL(r)){
+		if (__atomic_compare_exchange_n(&deque[id].range, &r, RANGE(HEAD(r)+1, TAIL(r)),
+						false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)){
+			c = HEAD(r);
+			goto found;
+		}
+	}
+
+	// then the back half of the next thread's that has chunks left;
+	// count its first chunk now and keep the rest as our deque
+	for (i = 1; i < nthreads; i++){
+		int victim = (id + i) % nthreads;
+
+		r = __atomic_load_n(&deque[victim].range, __ATOMIC_ACQUIRE);
+		while (HEAD(r) < TAIL(r)){
+			long mid = TAIL(r) - (TAIL(r) - HEAD(r) + 1) / 2;
+			if (__atomic_compare_exchange_n(&deque[victim].range, &r, RANGE(HEAD(r), mid),
+							false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)){
+				__atomic_store_n(&deque[id].range, RANGE(mid+1, TAIL(r)), __ATOMIC_RELEASE);
+				c = mid;
+				goto found;
+			}
+		}
+	}
+	return false;
+
+found:
+	*start = c * chunk_size;
+	*end = *start + chunk_size < data_size ? *start + chunk_size : data_size;
+	return true;
+}
+
+static int cmp_double(const void *a, const void *b){
+	double x = *(const double *)a, y = *(const double *)b;
+	return (x > y) - (x < y);
+}
+
+// run routine rt trials times on threads threads; set the fastest and
+// median times in millisecs, and whether every run matched bucket[]
+static void time_routine(int rt, int threads, double *min, double *median, bool *ok){
+	double ms[1000];
+	tick_t start;
+	int i;
+
+	pool_resize(threads);
+	*ok = true;
+	for (i = 0; i < trials; i++){
+		memset(global_histogram, 0, sizeof(global_histogram));
+		reset_chunks();
+		start = timer_start();
+		pool_run(thread_routine[rt]);
+		ms[i] = timer_secs(timer_stop() - start) * 1e3;
+		*ok &= !memcmp(global_histogram, bucket, sizeof(bucket));
+	}
+	qsort(ms, trials, sizeof(ms[0]), cmp_double);
+	*min = ms[0];
+	*median = trials % 2 ? ms[trials/2] : (ms[trials/2-1] + ms[trials/2]) / 2;
+}
+
+/*
+ * The data is generated GEN_CHUNK elements at a time, each chunk by an
+ * xorshift generator seeded from the chunk number, so it only depends
+ * on seed and not on how many threads generate it. Each worker writes
+ * its own block, which makes it the first to touch those pages, so on
+ * a NUMA machine they are placed near the CPU that histograms them.
+ * The workers count their block into a padded gen_count row, summed
+ * into bucket[] once they are all done.
+ */
+#define GEN_CHUNK 4096
+
+static struct {
+	int count[MAX_BUCKETS];
+} __attribute__((aligned(64))) gen_count[MAX_THREADS];
+
+// splitmix64, to turn consecutive chunk numbers into unrelated seeds
+static unsigned long mix_seed(unsigned long x){
+	x += 0x9e3779b97f4a7c15UL;
+	x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9UL;
+	x = (x ^ (x >> 27)) * 0x94d049bb133111ebUL;
+	return (x ^ (x >> 31)) | 1;  // xorshift state must not be 0
+}
+
+static void *generate_data(void *vargp){
+	long id = (long)vargp;
+	long start = BLOCK_START(id), end = BLOCK_START(id+1), i, j;
+	int *count = gen_count[id].count;
+
+	memset(count, 0, sizeof(gen_count[id].count));
+	for (i = start; i < end; ){
+		long chunk = i / GEN_CHUNK, stop = (chunk+1) * GEN_CHUNK;
+		unsigned long x = mix_seed(seed * 0x100000001b3UL + chunk);
+
+		if (stop > end)
+			stop = end;
+		for (j = chunk * GEN_CHUNK; j < stop; j++){
+			x ^= x << 13;
+			x ^= x >> 7;
+			x ^= x << 17;
+			if (j >= i){
+				int datum = ((x >> 32) * DATA_MAX) >> 32;  // 0..DATA_MAX-1, like rand() % DATA_MAX
+				data[j] = datum;
+				count[bucket_of[datum]]++;
+			}
+		}
+		i = stop;
+	}
+	return NULL;
+}
+
+// time every routine on 1..nthreads threads, then print the fastest
+// times and each routine's speedup and efficiency over its own 1 thread
+// time
+static void run_sweep(void){
+	static double ms[NROUTINES][MAX_THREADS+1];
+	bool wrong[NROUTINES] = {false};
+	int max = nthreads, rt, t, table;
+	double median;
+	bool ok;
+
+	for (rt = 0; rt < NROUTINES; rt++){
+		for (t = 1; t <= max; t++){
+			time_routine(rt, t, &ms[rt][t], &median, &ok);
+			wrong[rt] |= !ok;
+		}
+	}
+
+	printf("\nScaling of %ld elements into %d buckets on 1 to %d threads, best of %d\n",
+	       data_size, bucket_size, max, trials);
+	for (table = 0; table < 3; table++){
+		printf("\n%-12s", table == 0 ? "Time (ms)" : table == 1 ? "Speedup" : "Efficiency");
+		for (t = 1; t <= max; t++)
+			printf("%9d", t);
+		printf("\n");
+		for (rt = 0; rt < NROUTINES; rt++){
+			printf("thread_%-5d", rt);
+			for (t = 1; t <= max; t++){
+				double speedup = ms[rt][1] / ms[rt][t];
+				printf("%9.2f", table == 0 ? ms[rt][t] : table == 1 ? speedup : speedup / t);
+			}
+			printf("%s\n", wrong[rt] ? "  (wrong result)" : "");
+		}
+	}
+}
+
+#define STATIC_ROUTINE 6    // histo_6, one block per thread
+#define STEALING_ROUTINE 7  // histo_7, the same counting with work stealing
+
+// time the static and work stealing schedules, then again with another
+// process spinning on worker 0's CPU, which makes its block the slowest
+static void run_unbalanced(void){
+	int rts[2] = {STATIC_ROUTINE, STEALING_ROUTINE}, i;
+	double ms[2][2], median;
+	bool ok, wrong[2] = {false};
+	pid_t hog;
+
+	for (i = 0; i < 2; i++){
+		time_routine(rts[i], nthreads, &ms[i][0], &median, &ok);
+		wrong[i] |= !ok;
+	}
+
+	if ((hog = fork()) < 0){
+		perror("fork");
+		exit(1);
+	}
+	if (hog == 0){
+		pin_thread(0);
+		for (;;)
+			;
+	}
+	for (i = 0; i < 2; i++){
+		time_routine(rts[i], nthreads, &ms[i][1], &median, &ok);
+		wrong[i] |= !ok;
+	}
+	kill(hog, SIGKILL);
+	waitpid(hog, NULL, 0);
+
+	printf("\nStatic and work stealing schedules of %ld elements on %d threads, best of %d\n",
+	       data_size, nthreads, trials);
+	printf("\n%-20s%12s%12s\n", "Time (ms)", "balanced", "unbalanced");
+	for (i = 0; i < 2; i++)
+		printf("thread_%d %-11s%12.2f%12.2f%s\n", rts[i], i ? "stealing" : "static",
+		       ms[i][0], ms[i][1], wrong[i] ? "  (wrong result)" : "");
+}
+
+/*
+ * The radix sort benchmark: for each kind of input, time the radix
+ * sort on the worker pool and qsort on one thread, sorting the same
+ * keys, with each value set to its key's original position. The radix
+ * sort is checked against qsort, and its values against the keys.
+ */
+static radix_job_t *sort_job;
+
+static void *radix_worker(void *vargp){
+	radix_job_run(sort_job, (long)vargp);
+	return NULL;
+}
+
+static int cmp_u32(const void *a, const void *b){
+	uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+	return (x > y) - (x < y);
+}
+
+static int cmp_u64(const void *a, const void *b){
+	uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+	return (x > y) - (x < y);
+}
+
+static void run_sort_bench(void){
+	static const struct {
+		char *name;
+		int ks, vs;
+		bool small;  // keys 0..DATA_MAX-1, like data[]
+	} kinds[] = {
+		{"32-bit keys like data[]", 4, 0, true},
+		{"32-bit keys", 4, 0, false},
+		{"32-bit key-value pairs", 4, 4, false},
+		{"64-bit keys", 8, 0, false},
+		{"64-bit key-value pairs", 8, 8, false},
+	};
+	long n = sort_size, i;
+	size_t k;
+	int r;
+
+	pool_resize(nthreads);
+	printf("\nRadix sort on %d threads and qsort of %ld keys, best of %d\n", nthreads, n, trials);
+	printf("\n%-26s%12s%12s%10s\n", "Time (ms)", "radix", "qsort", "speedup");
+
+	for (k = 0; k < sizeof(kinds) / sizeof(kinds[0]); k++){
+		int ks = kinds[k].ks, vs = kinds[k].vs, rs = ks + vs;
+		unsigned char *orig = malloc(n * ks), *keys = malloc(n * ks);
+		unsigned char *vals = malloc(n * vs + 1), *recs = malloc(n * rs);
+		unsigned long x = mix_seed(seed);
+		double radix_ms = 0, qsort_ms = 0, t0;
+		tick_t start;
+		radix_job_t job;
+		bool ok = true;
+
+		if (!orig || !keys || !vals || !recs){
+			fprintf(stderr, "Could not allocate the keys to sort\n");
+			exit(1);
+		}
+		for (i = 0; i < n; i++){
+			x ^= x << 13;
+			x ^= x >> 7;
+			x ^= x << 17;
+			uint64_t key = kinds[k].small ? ((x >> 32) * DATA_MAX) >> 32 : x;
+			memcpy(orig + i*ks, &key, ks);  // the low bytes on x86
+		}
+
+		for (r = 0; r < trials; r++){
+			memcpy(keys, orig, n * ks);
+			for (i = 0; i < n && vs; i++)
+				memcpy(vals + i*vs, &i, vs);
+			if (radix_job_init(&job, keys, vals, n, ks, vs, nthreads) != 0){
+				fprintf(stderr, "Could not set up the radix sort\n");
+				exit(1);
+			}
+			sort_job = &job;
+			start = timer_start();
+			pool_run(radix_worker);
+			t0 = timer_secs(timer_stop() - start) * 1e3;
+			radix_ms = r == 0 || t0 < radix_ms ? t0 : radix_ms;
+			radix_job_free(&job);
+
+			for (i = 0; i < n; i++){
+				memcpy(recs + i*rs, orig + i*ks, ks);
+				memcpy(recs + i*rs + ks, &i, vs);
+			}
+			start = timer_start();
+			qsort(recs, n, rs, ks == 4 ? cmp_u32 : cmp_u64);
+			t0 = timer_secs(timer_stop() - start) * 1e3;
+			qsort_ms = r == 0 || t0 < qsort_ms ? t0 : qsort_ms;
+		}
+
+		// same keys as qsort, every value still with its key, and
+		// equal keys still in their original order
+		long pos, last = -1;
+		for (i = 0; i < n && ok; i++){
+			ok = !memcmp(keys + i*ks, recs + i*rs, ks);
+			if (vs){
+				pos = 0;
+				memcpy(&pos, vals + i*vs, vs);
+				ok &= pos >= 0 && pos < n && !memcmp(orig + pos*ks, keys + i*ks, ks);
+				ok &= i == 0 || memcmp(keys + i*ks, keys + (i-1)*ks, ks) || pos > last;
+				last = pos;
+			}
+		}
+		printf("%-26s%12.2f%12.2f%10.2f%s\n", kinds[k].name, radix_ms, qsort_ms,
+		       qsort_ms / radix_ms, ok ? "" : "  (wrong result)");
+		free(orig);
+		free(keys);
+		free(vals);
+		free(recs);
+	}
+}
+
+void run_threads(){
+	long i;
+
+	if (sort_size){
+		run_sort_bench();
+		return;
+	}
+
+	data = malloc(data_size);
+	if (data == NULL){
+		fprintf(stderr, "Could not allocate %ld bytes of data\n", data_size);
+		exit(1);
+	}
+	for (i = 0; i <= DATA_MAX; i++)
+		bucket_of[i] = i % bucket_size;
+
+	// generate data
+	pool_resize(nthreads);
+	pool_run(generate_data);
+	for (i = 0; i < nthreads; i++){
+		int b;
+		for (b = 0; b < bucket_size; b++)
+			bucket[b] += gen_count[i].count[b];
+	}
+
+	if (sweep){
+		run_sweep();
+		return;
+	}
+	if (unbalanced){
+		run_unbalanced();
+		return;
+	}
+
+	// the expected times only hold for the default sizes
+	bool graded = data_size == DATA_SIZE && nthreads == NTHREADS && bucket_size == BUCKET_SIZE;
+
+	// run through each thread routine
+	int thread_rt_id;
+	for (thread_rt_id = 0; thread_rt_id < NROUTINES; thread_rt_id++){
+		double min, median;
+		bool ok;
+
+		printf("\nRunning thread_%d: \n", thread_rt_id);
+		time_routine(thread_rt_id, nthreads, &min, &median, &ok);
+		long mtime = min + 0.5;
 
 		// visualize the histogram
-		int sum = printHistogram(global_histogram, BUCKET_SIZE);
-    if (sum == DATA_SIZE){
+		printHistogram(global_histogram, bucket_size);
+    if (ok){
       correctness[thread_rt_id] = 1;
     } else {
       printf("Wrong result. Please check the correctness of your code.\n");
     }
 
 		// print the total time
-		gettimeofday(&end, NULL);
-		secs  = end.tv_sec  - start.tv_sec;
-		usecs = end.tv_usec - start.tv_usec;
-		mtime = ((secs) * 1000 + usecs/1000.0) + 0.5;
 		printf("Elapsed time: %ld millisecs\n", mtime);
+		printf("Best of %d trials: %.3f ms, median %.3f ms\n", trials, min, median);
     
-    if (correctness[thread_rt_id] && (mtime < lower_range[thread_rt_id] || mtime > upper_range[thread_rt_id])){
+    if (graded && correctness[thread_rt_id] && (mtime < lower_range[thread_rt_id] || mtime > upper_range[thread_rt_id])){
       flag_range[thread_rt_id] = 1;
       printf("Hmm, this is a strange range for this task! The TA will check this solution manually.\n");
     }
@@ -85,7 +614,7 @@ int printHistogram(int *hist, int n) {
 		printf("\n");
 		sum += hist[i];
 	}
-	printf("Calculated sum: %d, correct sum: %d\n", sum, DATA_SIZE);
+	printf("Calculated sum: %d, correct sum: %ld\n", sum, data_size);
  
   return sum;
 }
@@ -120,6 +649,10 @@ bool check_info(info_t info){
     sprintf(hash_cmd, "echo -n %s | md5sum | cut -c -6", info.name);
     system(hash_cmd);
     printf("\n");
+#ifdef BUILD_TAG
+    // the build configuration, from common/report.pl
+    printf("Build: %s\n", BUILD_TAG);
+#endif
     
     return true;
 }
\ No newline at end of file